@@ -1,12 +1,19 @@
 #include "aecm.h"
 
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <utility>
+
 #include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "aecm_state.h"
 #include "delay_estimator.h"
+#include "kernels.h"
 #include "util.h"
 
 #ifdef MSC_VER  // Visual C++
@@ -17,77 +24,133 @@
 #define ALIGN8_END __attribute__((aligned(8)))
 #endif
 
-bool g_firstVAD; // VAD 初回検出フラグ。検出済みならtrue
-uint16_t g_xHistory[PART_LEN1 * MAX_DELAY]; // 遠端スペクトル履歴（遅延候補ごと）
-int g_xHistoryPos; // 遠端スペクトル履歴の書き込みインデックス
+// 処理中のインスタンス（スレッドごと）。状態の配置は aecm_state.h を参照。
+// SelectAecm で切り替える。何も選ばなければ既定のインスタンスを使う。
+static AecmState g_aecmInstance;
+static thread_local AecmState* g_aecm = &g_aecmInstance;
 
-// 直近の遅延推定結果を保持する。単位は 64 サンプル（1 ブロック）。
-static int g_last_estimated_delay_blocks = -2;
+void SelectAecm(AecmState* aecm) {
+  g_aecm = aecm ? aecm : &g_aecmInstance;
+  SetDelayEstimatorState(&g_aecm->delay_farend, &g_aecm->delay_near);
+}
 
+AecmState* GetSelectedAecm() {
+  return g_aecm;
+}
 
-uint32_t g_totCount; // 処理済みブロック数のカウンタ
 
-// dfa: Dynamic Fixed-point Alignment
-int16_t g_dfaCleanQDomain; // クリーン成分の Q-domain 推定値
-int16_t g_dfaCleanQDomainOld; // 上記の1ブロック前の値
-int16_t g_dfaNoisyQDomain; // 雑音成分の Q-domain 推定値
-int16_t g_dfaNoisyQDomainOld; // 雑音 Q-domain の1ブロック前の値
+// ハニング窓の平方根（Q14）。w[i] = sin(π i / (2 PART_LEN + 1)) を丸め、w[PART_LEN] は 1.0 とする。
+struct SqrtHanningTable {
+  int16_t v[PART_LEN1];
+};
 
+static constexpr SqrtHanningTable MakeSqrtHanning() {
+  SqrtHanningTable table{};
+  for (int i = 0; i < PART_LEN; i++) {
+    table.v[i] = (int16_t)(16384.0 * ConstexprSin2Pi(i, 2 * (2 * PART_LEN + 1)) + 0.5);
+  }
+  table.v[PART_LEN] = 16384;
+  return table;
+}
 
-int16_t g_nearLogEnergy[MAX_LOG_LEN]; // 近端信号の対数エネルギー履歴
-int16_t g_farLogEnergy; // 遠端信号の対数エネルギー最新値
-int16_t g_echoAdaptLogEnergy[MAX_LOG_LEN]; // 適応エコーパスによる対数エネルギー履歴
-int16_t g_echoStoredLogEnergy[MAX_LOG_LEN]; // 保存エコーパスによる対数エネルギー履歴
+static constexpr ALIGN8_BEG SqrtHanningTable kSqrtHanningData ALIGN8_END = MakeSqrtHanning();
+static constexpr const int16_t* kSqrtHanning = kSqrtHanningData.v;
 
 
-int16_t g_HStored[PART_LEN1]; // 保存エコーパス係数（Q15）
-int16_t g_HAdapt16[PART_LEN1]; // 適応エコーパス係数（Q15）
-int32_t g_HAdapt32[PART_LEN1]; // 適応エコーパス係数（拡張Q31）
-int16_t g_xBuf[PART_LEN2]; // 遠端時間領域バッファ（FFT入力）
-int16_t g_yBuf[PART_LEN2]; // 近端時間領域バッファ（FFT入力）
-int16_t g_eOverlapBuf[PART_LEN]; // IFFT のオーバーラップ保存領域
+// 全インスタンス共通の設定。処理中の別スレッドからも読むので atomic にし、
+// 設定関数どうしは g_settingsMutex で排他して、値とパイプラインの選択（SelectPipeline）をそろえる。
+static std::mutex g_settingsMutex;
+static std::atomic<bool> g_bypass_supmask{false};
+static std::atomic<bool> g_bypass_nlp{false};
+static std::atomic<int> g_statsLevel{2}; // デバッグ統計 0: なし, 1: 状態ログのみ, 2: 抑圧量の集計も行う
 
-int32_t g_sMagSmooth[PART_LEN1]; // 推定エコー振幅の平滑値
-int16_t g_yMagSmooth[PART_LEN1]; // 近端スペクトル振幅の平滑値
+static void SelectPipeline();
 
+void SetBypassSupMask(int enable) {
+  std::lock_guard<std::mutex> lock(g_settingsMutex);
+  g_bypass_supmask = (enable != 0);
+  SelectPipeline();
+}
+
+void SetBypassNlp(int enable) {
+  std::lock_guard<std::mutex> lock(g_settingsMutex);
+  g_bypass_nlp = (enable != 0);
+  SelectPipeline();
+}
 
-int32_t g_mseAdaptOld; // 適応チャネルの過去 MSE
-int32_t g_mseStoredOld; // 保存チャネルの過去 MSE
-int32_t g_mseThreshold; // MSE ベースのしきい値（可変）
+void SetStatsLevel(int level) {
+  std::lock_guard<std::mutex> lock(g_settingsMutex);
+  g_statsLevel = SAT(2, level, 0);
+  SetDelayEstimatorLogging(g_statsLevel >= 1);
+  SelectPipeline();
+}
 
-int16_t g_farEnergyMin; // 遠端エネルギーの最小値トラッカ
-int16_t g_farEnergyMax; // 遠端エネルギーの最大値トラッカ
-int16_t g_farEnergyMaxMin; // 遠端エネルギーのレンジ指標
-int16_t g_farEnergyVAD; // 遠端 VAD 用エネルギーしきい値
-int16_t g_farEnergyMSEThres; // MSE 判定をするための遠端エネルギー基準値
-bool g_currentVAD; // 近端 VAD の現在のフラグ。声があるならtrue
-int16_t g_vadUpdateCount; // VAD 関連の更新カウンタ
+// 定常雑音の抑圧レベル（0..NS_LEVEL_MAX）と、レベルごとのゲインの下限（Q14）
+static std::atomic<int> g_nsLevel{0};
+static constexpr int16_t kNsGainFloor[NS_LEVEL_MAX + 1] = {
+    ONE_Q14, 8211 /* -6 dB */, 5181 /* -10 dB */, 2914 /* -15 dB */};
 
-int16_t g_startupState; // 起動フェーズの状態
-int16_t g_mseChannelCount; // MSE 判定でのチャネル更新回数
-int16_t g_supGain; // 現在の抑圧ゲイン（Q8）
-int16_t g_supGainOld; // 直前の抑圧ゲイン（Q8）
+void SetNoiseSuppression(int level) {
+  std::lock_guard<std::mutex> lock(g_settingsMutex);
+  g_nsLevel = SAT(NS_LEVEL_MAX, level, 0);
+  SelectPipeline();
+}
 
+int GetNoiseSuppression() {
+  return g_nsLevel;
+}
 
-// ハニング窓の平方根（Q14）。
-static const ALIGN8_BEG int16_t kSqrtHanning[] ALIGN8_END = {
-    0,     399,   798,   1196,  1594,  1990,  2386,  2780,  3172,  3562,  3951,
-    4337,  4720,  5101,  5478,  5853,  6224,  6591,  6954,  7313,  7668,  8019,
-    8364,  8705,  9040,  9370,  9695,  10013, 10326, 10633, 10933, 11227, 11514,
-    11795, 12068, 12335, 12594, 12845, 13089, 13325, 13553, 13773, 13985, 14189,
-    14384, 14571, 14749, 14918, 15079, 15231, 15373, 15506, 15631, 15746, 15851,
-    15947, 16034, 16111, 16179, 16237, 16286, 16325, 16354, 16373, 16384};
+// 自動利得制御の目標レベル（dBFS, 0 で無効）と、それを出力 sum(|E|) の対数（LogOfEnergyInQ8 と同じ尺度）に直したもの
+static std::atomic<int> g_agcTargetDbfs{0};
+static std::atomic<int16_t> g_agcTargetLogQ8{0};
 
+void SetAutoGainControl(int target_dbfs) {
+  std::lock_guard<std::mutex> lock(g_settingsMutex);
+  g_agcTargetDbfs = (target_dbfs == 0) ? 0 : SAT(AGC_TARGET_DBFS_MAX, target_dbfs, AGC_TARGET_DBFS_MIN);
+  // 振幅 1 倍（0 dBFS）は log2(32768) = 15。dB から log2 の Q8 へは 256 * log2(10) / 20 = 42.52 倍（Q8 で 10885）。
+  g_agcTargetLogQ8 = (int16_t)((128 << 7) + (15 << 8) + ((g_agcTargetDbfs.load() * 10885) >> 8) + AGC_LOUDNESS_OFFSET_Q8);
+  SelectPipeline();
+}
 
-static bool g_bypass_supmask = false;
-static bool g_bypass_nlp = false;
+int GetAutoGainControl() {
+  return g_agcTargetDbfs;
+}
 
-void SetBypassSupMask(int enable) {
-  g_bypass_supmask = (enable != 0);
+// 負荷軽減の状態は選択中のインスタンス（AecmState の loadShed*）にあり、InitAecm をまたいで保持する。
+void SetLoadShedLevel(int level) {
+  g_aecm->loadShedLevel = (int16_t)SAT(LOAD_SHED_LEVEL_MAX, level, 0);
 }
 
-void SetBypassNlp(int enable) {
-  g_bypass_nlp = (enable != 0);
+int GetLoadShedLevel() {
+  return g_aecm->loadShedLevel;
+}
+
+void SetLoadShedBudgetUs(int budget_us) {
+  g_aecm->loadShedBudgetUs = budget_us;
+  g_aecm->loadShedAvgUs = 0;
+  g_aecm->loadShedHold = 0;
+}
+
+// 処理時間を 1/8 の一次平滑で追い、予算を超えたらレベルを上げ、
+// 予算の半分を下回ったらレベルを下げる。変更直後は効果が平滑値に現れるまで待つ。
+int UpdateLoadShedLevel(int measured_us) {
+  AecmState* aecm = g_aecm;
+  if (aecm->loadShedBudgetUs <= 0) {
+    return aecm->loadShedLevel;
+  }
+  aecm->loadShedAvgUs += (measured_us - aecm->loadShedAvgUs) >> 3;
+  if (aecm->loadShedHold > 0) {
+    aecm->loadShedHold--;
+    return aecm->loadShedLevel;
+  }
+  if (aecm->loadShedAvgUs > aecm->loadShedBudgetUs && aecm->loadShedLevel < LOAD_SHED_LEVEL_MAX) {
+    aecm->loadShedLevel++;
+    aecm->loadShedHold = LOAD_SHED_HOLD_BLOCKS;
+  } else if (aecm->loadShedAvgUs < (aecm->loadShedBudgetUs >> 1) && aecm->loadShedLevel > 0) {
+    aecm->loadShedLevel--;
+    aecm->loadShedHold = LOAD_SHED_HOLD_BLOCKS;
+  }
+  return aecm->loadShedLevel;
 }
 
 
@@ -120,42 +183,65 @@ int16_t AsymFilt(const int16_t filtOld,
   return retVal;
 }
 
+#if AECM_COMPACT_HISTORY
+// |X| の log2 を Q5（1 オクターブ 32 段）で返す。仮数部は直線近似（[1, 2) をそのまま小数部とみなす）。
+static inline int FarMagLogQ5(uint32_t mag) {
+  const int octave = 31 - CountLeadingZeros32(mag);
+  // 仮数部を [2^15, 2^16) に正規化し、上位 5 ビットを四捨五入して小数部にする
+  return (octave << 5) + (int)(((mag << (15 - octave)) - 32768 + 512) >> 10);
+}
+
+// 遠端スペクトル履歴の圧縮形式。各ビンの log2 (Q5) を、エントリ内の最大ビンから約 7.9 オクターブ（47 dB）下までの
+// 範囲で uint8 の符号 1..255 に収める。entry[PART_LEN1] には符号 1 に対応する基準（log2 の Q4）を置く。
+// 範囲より小さいビンと 0 のビンは符号 0（復号値 0）。量子化誤差は振幅比で最大約 1.6%。
+static void EncodeFarHistoryEntry(const uint16_t* X_mag, uint8_t* entry) {
+  uint16_t max_mag = 0;
+  for (int i = 0; i < PART_LEN1; i++) {
+    max_mag = X_mag[i] > max_mag ? X_mag[i] : max_mag;
+  }
+  // 最大ビンの符号が 255 以下になる最小の基準
+  int base_q4 = 0;
+  if (max_mag > 0) {
+    base_q4 = (FarMagLogQ5(max_mag) - 254 + 1) >> 1;
+    base_q4 = base_q4 > 0 ? base_q4 : 0;
+  }
+  const int base_q5 = base_q4 << 1;
+  for (int i = 0; i < PART_LEN1; i++) {
+    int code = 0;
+    if (X_mag[i] > 0) {
+      code = FarMagLogQ5(X_mag[i]) - base_q5 + 1;
+      code = code > 0 ? code : 0;
+    }
+    entry[i] = (uint8_t)code;
+  }
+  entry[PART_LEN1] = (uint8_t)base_q4;
+}
+
+static void DecodeFarHistoryEntry(const uint8_t* entry, uint16_t* X_mag) {
+  const int base_q5 = entry[PART_LEN1] << 1;
+  for (int i = 0; i < PART_LEN1; i++) {
+    const int log_q5 = entry[i] - 1 + base_q5;
+    const uint32_t mag = ((32u + (log_q5 & 31)) << (log_q5 >> 5)) >> 5;
+    X_mag[i] = entry[i] == 0 ? 0 : (uint16_t)(mag > 65535 ? 65535 : mag);
+  }
+}
+#endif
+
 void TimeToFrequencyDomain(const int16_t* time_signal,
                            ComplexInt16* freq_signal,
                            uint16_t* freq_signal_abs,
                            uint32_t* freq_signal_sum_abs) {
-  int16_t fft[PART_LEN4];
+  int16_t fft[PART_LEN2]; // 窓掛け結果の作業領域
 
-  WindowAndFFT(fft, time_signal, freq_signal, PART_LEN, kSqrtHanning);
+  g_kernels.window_and_fft(fft, time_signal, freq_signal, PART_LEN, kSqrtHanning);
 
   // 実部と虚部を取り出し、各ビンの振幅を計算
-  freq_signal[0].imag = 0;
-  freq_signal[PART_LEN].imag = 0;
-  freq_signal_abs[0] = (uint16_t)ABS_W16(freq_signal[0].real);
-  freq_signal_abs[PART_LEN] = (uint16_t)ABS_W16(freq_signal[PART_LEN].real);
-  (*freq_signal_sum_abs) = (uint32_t)(freq_signal_abs[0]) + (uint32_t)(freq_signal_abs[PART_LEN]);
-
-  for (int i = 1; i < PART_LEN; i++) {
-    if (freq_signal[i].real == 0) {
-      freq_signal_abs[i] = (uint16_t)ABS_W16(freq_signal[i].imag);
-    } else if (freq_signal[i].imag == 0) {
-      freq_signal_abs[i] = (uint16_t)ABS_W16(freq_signal[i].real);
-    } else {
-      int16_t abs_real = ABS_W16(freq_signal[i].real);
-      int16_t abs_imag = ABS_W16(freq_signal[i].imag);
-      int32_t sq_real = abs_real * abs_real;
-      int32_t sq_imag = abs_imag * abs_imag;
-      int32_t sum_sq = AddSatW32(sq_real, sq_imag);
-      int32_t mag = SqrtFloor(sum_sq);
-      freq_signal_abs[i] = (uint16_t)mag;
-    }
-    (*freq_signal_sum_abs) += (uint32_t)freq_signal_abs[i];
-  }
+  g_kernels.magnitude(freq_signal, freq_signal_abs, freq_signal_sum_abs);
 }
 
 
-// 16 kHz 用エコーチャネルの初期化テーブル
-static const int16_t kChannelStored16kHz[PART_LEN1] = {
+// 16 kHz / 64 サンプル（125 Hz 刻み 65 ビン）用エコーチャネルの初期化テーブル
+static constexpr int16_t kChannelStored16kHz[65] = {
     2040, 1590, 1405, 1385, 1451, 1562, 1726, 1882, 1953, 2010, 2040,
     2027, 2014, 1980, 1869, 1732, 1635, 1572, 1517, 1444, 1367, 1294,
     1245, 1233, 1260, 1303, 1373, 1441, 1499, 1549, 1582, 1621, 1676,
@@ -163,6 +249,32 @@ static const int16_t kChannelStored16kHz[PART_LEN1] = {
     2651, 2781, 2922, 3075, 3253, 3471, 3738, 3976, 4151, 4258, 4308,
     4288, 4270, 4253, 4237, 4179, 4086, 3947, 3757, 3484, 3153};
 
+// ビルド時のブロック長・サンプリング周波数の各ビン中心周波数で、上の表を線形補間した初期チャネル。
+// 16 kHz / 64 サンプルでは上の表そのものになる。
+struct ChannelTable {
+  int16_t v[PART_LEN1];
+};
+
+static constexpr ChannelTable MakeChannelStored() {
+  ChannelTable table{};
+  // 参照表上の位置 i * (SAMPLE_RATE_HZ / PART_LEN2) / 125 を pos_num / pos_den で表す
+  const int pos_den = PART_LEN2 * 125;
+  for (int i = 0; i < PART_LEN1; i++) {
+    const int pos_num = i * SAMPLE_RATE_HZ;
+    const int idx = pos_num / pos_den;
+    const int frac = pos_num % pos_den;
+    if (idx >= 64) {
+      table.v[i] = kChannelStored16kHz[64];
+    } else {
+      table.v[i] = (int16_t)((kChannelStored16kHz[idx] * (pos_den - frac) +
+                              kChannelStored16kHz[idx + 1] * frac + pos_den / 2) / pos_den);
+    }
+  }
+  return table;
+}
+
+static constexpr ChannelTable kChannelStored = MakeChannelStored();
+
  
 
 
@@ -176,95 +288,117 @@ static const int16_t kChannelStored16kHz[PART_LEN1] = {
 //
 void InitEchoPath(const int16_t* echo_path) {
   // 保存チャネルをリセット
-  memcpy(g_HStored, echo_path, sizeof(int16_t) * PART_LEN1);
+  memcpy(g_aecm->HStored, echo_path, sizeof(int16_t) * PART_LEN1);
   // 適応チャネルをリセット
-  memcpy(g_HAdapt16, echo_path, sizeof(int16_t) * PART_LEN1);
+  memcpy(g_aecm->HAdapt16, echo_path, sizeof(int16_t) * PART_LEN1);
   for (int i = 0; i < PART_LEN1; i++) {
-    g_HAdapt32[i] = (int32_t)g_HAdapt16[i] << 16;
+    g_aecm->HAdapt32[i] = (int32_t)g_aecm->HAdapt16[i] << 16;
   }
 
   // チャネル保存に関する変数を初期化
-  g_mseAdaptOld = 1000;
-  g_mseStoredOld = 1000;
-  g_mseThreshold = WORD32_MAX;
-  g_mseChannelCount = 0;
+  g_aecm->mseAdaptOld = 1000;
+  g_aecm->mseStoredOld = 1000;
+  g_aecm->mseThreshold = WORD32_MAX;
+  g_aecm->mseChannelCount = 0;
 }
 
 // H_adapt(Q15) → H_stored にコピーして、新しい S_mag を再計算
 void StoreAdaptiveChannel(const uint16_t* X_mag, int32_t* S_mag) {
   // 起動中は毎ブロック保存チャネルを更新
-  memcpy(g_HStored, g_HAdapt16, sizeof(int16_t) * PART_LEN1);
+  memcpy(g_aecm->HStored, g_aecm->HAdapt16, sizeof(int16_t) * PART_LEN1);
   // 推定エコーを再計算
   for (int i = 0; i < PART_LEN; i += 4) {
-    S_mag[i] = MUL_16_U16(g_HStored[i], X_mag[i]);
-    S_mag[i + 1] = MUL_16_U16(g_HStored[i + 1], X_mag[i + 1]);
-    S_mag[i + 2] = MUL_16_U16(g_HStored[i + 2], X_mag[i + 2]);
-    S_mag[i + 3] = MUL_16_U16(g_HStored[i + 3], X_mag[i + 3]);
+    S_mag[i] = MUL_16_U16(g_aecm->HStored[i], X_mag[i]);
+    S_mag[i + 1] = MUL_16_U16(g_aecm->HStored[i + 1], X_mag[i + 1]);
+    S_mag[i + 2] = MUL_16_U16(g_aecm->HStored[i + 2], X_mag[i + 2]);
+    S_mag[i + 3] = MUL_16_U16(g_aecm->HStored[i + 3], X_mag[i + 3]);
   }
   // PART_LEN1 は PART_LEN + 1
-  S_mag[PART_LEN] = MUL_16_U16(g_HStored[PART_LEN], X_mag[PART_LEN]);
+  S_mag[PART_LEN] = MUL_16_U16(g_aecm->HStored[PART_LEN], X_mag[PART_LEN]);
 }
 
 void ResetAdaptiveChannel() {
   // 連続 2 回、保存チャネルの MSE が適応チャネルより十分小さい場合、
   // 適応チャネルをリセットする。
-  memcpy(g_HAdapt16, g_HStored, sizeof(int16_t) * PART_LEN1);
+  memcpy(g_aecm->HAdapt16, g_aecm->HStored, sizeof(int16_t) * PART_LEN1);
   // 32bit チャネル表現を復元
   for (int i = 0; i < PART_LEN; i += 4) {
-    g_HAdapt32[i] = (int32_t)g_HStored[i] << 16;
-    g_HAdapt32[i + 1] = (int32_t)g_HStored[i + 1] << 16;
-    g_HAdapt32[i + 2] = (int32_t)g_HStored[i + 2] << 16;
-    g_HAdapt32[i + 3] = (int32_t)g_HStored[i + 3] << 16;
+    g_aecm->HAdapt32[i] = (int32_t)g_aecm->HStored[i] << 16;
+    g_aecm->HAdapt32[i + 1] = (int32_t)g_aecm->HStored[i + 1] << 16;
+    g_aecm->HAdapt32[i + 2] = (int32_t)g_aecm->HStored[i + 2] << 16;
+    g_aecm->HAdapt32[i + 3] = (int32_t)g_aecm->HStored[i + 3] << 16;
   }
-  g_HAdapt32[PART_LEN] = (int32_t)g_HStored[PART_LEN] << 16;
+  g_aecm->HAdapt32[PART_LEN] = (int32_t)g_aecm->HStored[PART_LEN] << 16;
 }
 
 
 void InitAecm() {
-  // 16kHz 固定
-  memset(g_xBuf, 0, sizeof(g_xBuf));
-  memset(g_yBuf, 0, sizeof(g_yBuf));
-  memset(g_eOverlapBuf, 0, sizeof(g_eOverlapBuf));
+  InitKernels();
 
-  g_last_estimated_delay_blocks = -2;
+  memset(g_aecm->xBuf, 0, sizeof(g_aecm->xBuf));
+  memset(g_aecm->yBuf, 0, sizeof(g_aecm->yBuf));
+  memset(g_aecm->eOverlapBuf, 0, sizeof(g_aecm->eOverlapBuf));
+  g_aecm->farTrackerHold = 0;
+  g_aecm->farSource = NULL;
 
-  g_totCount = 0;
+  g_aecm->last_estimated_delay_blocks = -2;
 
+  g_aecm->totCount = 0;
+
+  InitSpscBufferWith(&g_aecm->farQueue, g_aecm->farQueueData, AECM_FAR_QUEUE_LEN, sizeof(AecmFarBlock));
+  g_aecm->farQueueOverflows = 0;
+  g_aecm->farQueueUnderruns = 0;
+
+  SelectAecm(g_aecm);
   InitDelayEstimatorFarend();
   InitDelayEstimator();
   // 遠端履歴をゼロ初期化
-  memset(g_xHistory, 0, sizeof(uint16_t) * PART_LEN1 * MAX_DELAY);
-  g_xHistoryPos = MAX_DELAY;
-
-  g_dfaCleanQDomain = 0;
-  g_dfaCleanQDomainOld = 0;
-  g_dfaNoisyQDomain = 0;
-  g_dfaNoisyQDomainOld = 0;
+  memset(g_aecm->xHistory, 0, sizeof(g_aecm->xHistory));
+  g_aecm->xHistoryPos = MAX_DELAY;
 
-  memset(g_nearLogEnergy, 0, sizeof(g_nearLogEnergy));
-  g_farLogEnergy = 0;
-  memset(g_echoAdaptLogEnergy, 0, sizeof(g_echoAdaptLogEnergy));
-  memset(g_echoStoredLogEnergy, 0, sizeof(g_echoStoredLogEnergy));
+  g_aecm->dfaCleanQDomain = 0;
+  g_aecm->dfaCleanQDomainOld = 0;
+  g_aecm->dfaNoisyQDomain = 0;
+  g_aecm->dfaNoisyQDomainOld = 0;
 
-  // エコーチャネルを既定形状（16 kHz 固定）で初期化
-  InitEchoPath(kChannelStored16kHz);
+  memset(g_aecm->nearLogEnergy, 0, sizeof(g_aecm->nearLogEnergy));
+  g_aecm->farLogEnergy = 0;
+  memset(g_aecm->echoAdaptLogEnergy, 0, sizeof(g_aecm->echoAdaptLogEnergy));
+  memset(g_aecm->echoStoredLogEnergy, 0, sizeof(g_aecm->echoStoredLogEnergy));
 
-  memset(g_sMagSmooth, 0, sizeof(g_sMagSmooth));
-  memset(g_yMagSmooth, 0, sizeof(g_yMagSmooth));
+  // エコーチャネルを既定形状で初期化
+  InitEchoPath(kChannelStored.v);
 
-  g_farEnergyMin = WORD16_MAX;
-  g_farEnergyMax = WORD16_MIN;
-  g_farEnergyMaxMin = 0;
-  g_farEnergyVAD = FAR_ENERGY_MIN;  // 開始直後の誤検出（音声とみなさない）を防ぐ
+  memset(g_aecm->sMagSmooth, 0, sizeof(g_aecm->sMagSmooth));
+  memset(g_aecm->yMagSmooth, 0, sizeof(g_aecm->yMagSmooth));
+  for (int i = 0; i < PART_LEN1; i++) {
+    g_aecm->nsYMagSmooth[i] = 0;
+    g_aecm->nsNoiseMag[i] = NS_NOISE_UNSET;
+    g_aecm->nsGain[i] = ONE_Q14;
+  }
+  g_aecm->agcLevel = AGC_LEVEL_UNSET;
+  g_aecm->agcNoiseLevel = AGC_LEVEL_UNSET;
+  g_aecm->agcGain = 0;
+  g_aecm->agcLimiterGain = ONE_Q14;
+
+  g_aecm->farEnergyMin = WORD16_MAX;
+  g_aecm->farEnergyMax = WORD16_MIN;
+  g_aecm->farEnergyMaxMin = 0;
+  g_aecm->farEnergyVAD = FAR_ENERGY_MIN;  // 開始直後の誤検出（音声とみなさない）を防ぐ
                                         // 
-  g_farEnergyMSEThres = 0;
-  g_currentVAD = false;
-  g_vadUpdateCount = 0;
-  g_firstVAD = true;
+  g_aecm->farEnergyMSEThres = 0;
+  g_aecm->currentVAD = false;
+  g_aecm->vadUpdateCount = 0;
+  g_aecm->firstVAD = true;
 
-  g_startupState = 0;
-  g_supGain = SUPGAIN_DEFAULT;
-  g_supGainOld = SUPGAIN_DEFAULT;
+  g_aecm->startupState = 0;
+  g_aecm->supGain = SUPGAIN_DEFAULT;
+  g_aecm->supGainOld = SUPGAIN_DEFAULT;
+
+  for (int i = 0; i < PART_LEN1; i++) {
+    g_aecm->GMaskPrev[i] = ONE_Q14;
+  }
+  g_aecm->numPosCoefPrev = PART_LEN1;
 
   // コンパイル時に前提条件を static_assert で確認
   // アセンブリ実装が依存するため、修正時は該当ファイルを要確認。
@@ -286,117 +420,28 @@ void UpdateChannel(const uint16_t* X_mag,
                               const uint16_t* const Y_mag,
                               const int16_t mu,
                               int32_t* S_mag) {
-  uint32_t channel_far_product_q0, near_mag_q0;
   int32_t mseStored;
   int32_t mseAdapt;
 
-  int16_t zerosFar, zerosNum, zerosCh, zerosDfa;
-  int16_t shiftChFar, shiftNum, shift2ResChan;
-  int16_t dfa_shift_candidate;
-  int16_t channel_product_q_domain, near_mag_q_domain;
-
-  // 7. エコーチャネル更新。 NLMS法で計算する。
-  // 更新するのはHadaptで、以下の式を実行する。
-  // ΔH = 2^{-μ} · (|Y| - Hadapt · |X|) · |X|
-  // H = H + ΔH
+  // 7. エコーチャネル更新。 NLMS法で計算する（本体は kernels_impl.h の UpdateChannelKernel）。
   if (mu) { // muが0のときは全く学習しない。
-    for (int i = 0; i < PART_LEN1; i++) { // 周波数ビンごとに
-      // オーバーフロー防止のためチャネルと遠端の正規化量を算出
-      zerosCh = NormU32(g_HAdapt32[i]);
-      zerosFar = NormU32((uint32_t)X_mag[i]);
-      if (zerosCh + zerosFar > 31) {
-        // 乗算しても安全な状態
-        channel_far_product_q0 = UMUL_32_16(g_HAdapt32[i], X_mag[i]);
-        shiftChFar = 0;
-      } else {
-        // 乗算前にシフトダウンが必要
-        shiftChFar = 32 - zerosCh - zerosFar;
-        // zerosCh==zerosFar==0 なら shiftChFar=32 となり、
-        // 右シフト 32 は未定義なのでチェックする。
-        {
-          uint32_t shifted = (shiftChFar >= 32)
-                                  ? 0u
-                                  : (uint32_t)(g_HAdapt32[i] >> shiftChFar);
-          channel_far_product_q0 = shifted * X_mag[i];
-        }
-      }
-      // 分子の Q ドメインを決定
-      zerosNum = NormU32(channel_far_product_q0);
-      if (Y_mag[i]) {
-        zerosDfa = NormU32((uint32_t)Y_mag[i]);
-      } else {
-        zerosDfa = 32;
-      }
-      dfa_shift_candidate = zerosDfa - 2 + g_dfaNoisyQDomain - RESOLUTION_CHANNEL32 + shiftChFar;
-      if (zerosNum > dfa_shift_candidate + 1) {
-        channel_product_q_domain = dfa_shift_candidate;
-        near_mag_q_domain = zerosDfa - 2;
-      } else {
-        channel_product_q_domain = zerosNum - 2;
-        near_mag_q_domain = RESOLUTION_CHANNEL32 - g_dfaNoisyQDomain - shiftChFar  + channel_product_q_domain;
-      }
-      // 同じ Q ドメインに揃えて加算
-      channel_far_product_q0 = SHIFT_W32(channel_far_product_q0, channel_product_q_domain);
-      near_mag_q0 = SHIFT_W32((uint32_t)Y_mag[i], near_mag_q_domain);
-      // residual = |Y| - Hadapt · |X| これが残差信号
-      int32_t residual_q31 = (int32_t)near_mag_q0 - (int32_t)channel_far_product_q0;
-      zerosNum = NormW32(residual_q31);
-      if (residual_q31 && (X_mag[i] > CHANNEL_VAD)) {        
-        // 乗算でオーバーフローしないようにする。
-        int32_t residual_times_far;
-        if (zerosNum + zerosFar > 31) {
-          if (residual_q31 > 0) {
-            residual_times_far = (int32_t)UMUL_32_16(residual_q31, X_mag[i]);
-          } else {
-            residual_times_far = -(int32_t)UMUL_32_16(-residual_q31, X_mag[i]);
-          }
-          shiftNum = 0;
-        } else {
-          shiftNum = 32 - (zerosNum + zerosFar);
-          if (residual_q31 > 0) {
-            residual_times_far = (residual_q31 >> shiftNum) * X_mag[i];
-          } else {
-            residual_times_far = -((-residual_q31 >> shiftNum) * X_mag[i]);
-          }
-        }
-        // residual_times_far が、 残差信号に|X|を掛けたものに対応する。
-        // 周波数ビンに応じて正規化
-        residual_times_far = DivW32W16(residual_times_far, i + 1);
-        // 適切な Q ドメインに揃える。
-        // shift2ResChanはシフト演算の量なので、 muを減算しているのは、1が最大の0.5で10が最小の1/1024であることに注意。
-        // つまり muの減算はμを掛けていることに相当している。
-        shift2ResChan = shiftNum + shiftChFar - channel_product_q_domain - mu - ((30 - zerosFar) << 1);
-        int32_t deltaH_q31;
-        if (NormW32(residual_times_far) < shift2ResChan) {
-          deltaH_q31 = WORD32_MAX;
-        } else {
-          deltaH_q31 = SHIFT_W32(residual_times_far, shift2ResChan);
-        }
-        // ここまでで、ΔHが求まった。ので、Hadaptに加算する。 H = H + ΔH に対応している。
-        g_HAdapt32[i] = AddSatW32(g_HAdapt32[i], deltaH_q31);
-        if (g_HAdapt32[i] < 0) {
-          // チャネル利得が負にならないよう強制
-          g_HAdapt32[i] = 0;
-        }
-        g_HAdapt16[i] = (int16_t)(g_HAdapt32[i] >> 16);
-      }
-    }
+    g_kernels.update_channel(X_mag, Y_mag, mu, g_aecm->dfaNoisyQDomain, g_aecm->HAdapt32, g_aecm->HAdapt16);
   }
   // 適応チャネル更新ここまで
 
 
   // 8. チャネル保存・復元
-  if ((g_startupState == 0) && g_currentVAD) {
+  if ((g_aecm->startupState == 0) && g_aecm->currentVAD) {
     // 起動中は、毎ブロックチャネルを保存し、推定エコーも再計算する。
     StoreAdaptiveChannel(X_mag, S_mag);
   } else {
-    if (g_farLogEnergy < g_farEnergyMSEThres) {
-      g_mseChannelCount = 0;
+    if (g_aecm->farLogEnergy < g_aecm->farEnergyMSEThres) {
+      g_aecm->mseChannelCount = 0;
     } else {
-      g_mseChannelCount++;
+      g_aecm->mseChannelCount++;
     }
     // 検証に十分なデータがあれば、保存を検討
-    if (g_mseChannelCount >= (MIN_MSE_COUNT + 10)) {
+    if (g_aecm->mseChannelCount >= (MIN_MSE_COUNT + 10)) {
       // 十分なデータが揃った
       // 適応版と保存版の MSE を計算
       // 実際には平均絶対誤差に近い指標
@@ -404,99 +449,426 @@ void UpdateChannel(const uint16_t* X_mag,
       mseAdapt = 0;
       for (int i = 0; i < MIN_MSE_COUNT; i++) {
         int32_t stored_error_q8 =
-            static_cast<int32_t>(g_echoStoredLogEnergy[i]) -
-            static_cast<int32_t>(g_nearLogEnergy[i]);
+            static_cast<int32_t>(g_aecm->echoStoredLogEnergy[i]) -
+            static_cast<int32_t>(g_aecm->nearLogEnergy[i]);
         int32_t stored_error_abs_q8 = ABS_W32(stored_error_q8);
         mseStored += stored_error_abs_q8;
 
         int32_t adapt_error_q8 =
-            static_cast<int32_t>(g_echoAdaptLogEnergy[i]) -
-            static_cast<int32_t>(g_nearLogEnergy[i]);
+            static_cast<int32_t>(g_aecm->echoAdaptLogEnergy[i]) -
+            static_cast<int32_t>(g_aecm->nearLogEnergy[i]);
         int32_t adapt_error_abs_q8 = ABS_W32(adapt_error_q8);
         mseAdapt += adapt_error_abs_q8;
       }
       if (((mseStored << MSE_RESOLUTION) < (MIN_MSE_DIFF * mseAdapt)) &
-          ((g_mseStoredOld << MSE_RESOLUTION) <
-           (MIN_MSE_DIFF * g_mseAdaptOld))) {
+          ((g_aecm->mseStoredOld << MSE_RESOLUTION) <
+           (MIN_MSE_DIFF * g_aecm->mseAdaptOld))) {
         // 保存チャネルの方が連続して適応チャネルより低い誤差なら、
         // 適応チャネルをリセットする。
         ResetAdaptiveChannel();
       } else if (((MIN_MSE_DIFF * mseStored) > (mseAdapt << MSE_RESOLUTION)) &
-                 (mseAdapt < g_mseThreshold) &
-                 (g_mseAdaptOld < g_mseThreshold)) {
+                 (mseAdapt < g_aecm->mseThreshold) &
+                 (g_aecm->mseAdaptOld < g_aecm->mseThreshold)) {
         // 適応チャネルの方が連続して保存チャネルより低い誤差なら、
         // 適応チャネルを保存版として採用する。
         StoreAdaptiveChannel(X_mag, S_mag);
 
         // 閾値を更新
-        if (g_mseThreshold == WORD32_MAX) {
-          g_mseThreshold = (mseAdapt + g_mseAdaptOld);
+        if (g_aecm->mseThreshold == WORD32_MAX) {
+          g_aecm->mseThreshold = (mseAdapt + g_aecm->mseAdaptOld);
         } else {
-          int scaled_threshold = g_mseThreshold * 5 / 8;
-          g_mseThreshold += ((mseAdapt - scaled_threshold) * 205) >> 8;
+          int scaled_threshold = g_aecm->mseThreshold * 5 / 8;
+          g_aecm->mseThreshold += ((mseAdapt - scaled_threshold) * 205) >> 8;
         }
       }
 
       // カウンタをリセット
-      g_mseChannelCount = 0;
+      g_aecm->mseChannelCount = 0;
 
       // MSE を記録する。
-      g_mseStoredOld = mseStored;
-      g_mseAdaptOld = mseAdapt;
+      g_aecm->mseStoredOld = mseStored;
+      g_aecm->mseAdaptOld = mseAdapt;
     }
   }
 }
 
-// blockは64サンプルの時間領域データ。符号付き線形PCM -32768 ~ 32767
-// x_block: 遠端, y_block: 近端, e_block: キャンセル済みの残差信号
-int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_block) {
-  // スタートアップ状態を判定する。段階は次の 3 つ:
-  // (0) 最初の CONV_LEN ブロック
-  // (1) さらに CONV_LEN ブロック
-  // (2) それ以降
+// 10. 周波数マスク生成。
+// 平滑化した推定エコー |S| と近端 |Y| の比から Wiener 型のマスク G_mask(Q14) を求める。
+// 戻り値は G_mask の非0係数の数（11 の NLP で使う）。
+// kSupMask が false ならマスクは全ビン 1 とし、平滑化の状態更新だけを行う。
+template <bool kSupMask>
+int16_t CalcSuppressionMask(const int32_t* S_mag, const uint16_t* Y_mag, int16_t* G_mask) {
+  return g_kernels.suppression_mask(S_mag, Y_mag, g_aecm->supGain,
+                                    g_aecm->dfaCleanQDomain - g_aecm->dfaCleanQDomainOld, kSupMask,
+                                    g_aecm->sMagSmooth, g_aecm->yMagSmooth, G_mask);
+}
+
+// 定常雑音の推定と抑圧ゲイン。ビンごとに |Y| を平滑化し、その最小値を雑音とみなす（下がるときはすぐ追い、
+// 上がるときは 1 ブロックに 1/2^NS_RISE_SHIFT 倍まで）。ゲインはスペクトル減算 1 - NS_OVERSUB * 雑音 / 平滑値 を
+// レベルごとの下限で止め、時間方向に平滑化する。
+void UpdateNoiseSuppressionGain(const uint16_t* Y_mag, int16_t* G_ns) {
+  const int16_t floor_q14 = kNsGainFloor[g_nsLevel.load(std::memory_order_relaxed)];
+  for (int i = 0; i < PART_LEN1; i++) {
+    uint32_t smooth = g_aecm->nsYMagSmooth[i];
+    uint32_t noise = g_aecm->nsNoiseMag[i];
+    const uint32_t y_q8 = (uint32_t)Y_mag[i] << 8;
+    if (noise == NS_NOISE_UNSET) {
+      smooth = y_q8;
+    } else {
+      smooth = (uint32_t)((int32_t)smooth + (((int32_t)y_q8 - (int32_t)smooth) >> NS_SMOOTH_SHIFT));
+    }
+    if (smooth < noise) {
+      noise = smooth;
+    } else {
+      noise = MIN(noise + (noise >> NS_RISE_SHIFT) + 1, smooth);
+    }
+    g_aecm->nsYMagSmooth[i] = smooth;
+    g_aecm->nsNoiseMag[i] = noise;
+
+    // G = 1 - NS_OVERSUB * noise / smooth（Q14）
+    int32_t gain = ONE_Q14;
+    if (smooth > 0) {
+      const uint64_t sub_q14 = ((uint64_t)noise * NS_OVERSUB_Q8 << 6) / smooth;
+      gain = sub_q14 >= (uint64_t)ONE_Q14 ? 0 : ONE_Q14 - (int32_t)sub_q14;
+    }
+    gain = MAX(gain, (int32_t)floor_q14);
+    g_aecm->nsGain[i] = (int16_t)(g_aecm->nsGain[i] + ((gain - g_aecm->nsGain[i]) >> NS_GAIN_SMOOTH_SHIFT));
+    G_ns[i] = g_aecm->nsGain[i];
+  }
+}
 
-  if (g_startupState < 2) {
-    g_startupState = (g_totCount >= CONV_LEN) + (g_totCount >= CONV_LEN2);
+// 自動利得制御のゲイン（log2 の Q8）を線形の Q12 に直す。小数部の 2^x は 1 + x (0.6565 + 0.3435 x) で近似する（誤差 0.3% 以内）。
+static int32_t AgcGainToLinearQ12(int16_t gain_q8) {
+  const int int_part = gain_q8 >> 8;
+  const int32_t frac = gain_q8 & 0xFF;
+  const int32_t lin_q14 = ONE_Q14 + ((frac * (10756 + ((5628 * frac) >> 8))) >> 8);
+  return SHIFT_W32(lin_q14, int_part - 2);
+}
+
+// 自動利得制御。マスク後の出力 sum(G_mask * |Y|) の対数をレベルとし、話し声（近端が有音で、出力が雑音レベルより大きい）で
+// エコーが主でない（近端が推定エコーより大きく、マスク後も近端の大半が残る）ブロックだけで平滑化する。ゲインは目標との差を
+// 上げ下げの速さを制限して追い、それ以外のブロックとリミッタが効いている間は上げない。戻り値は 12 で E に掛ける線形ゲイン（Q12）。
+static int32_t UpdateAutoGainControl(const uint16_t* Y_mag, const int16_t* G_mask) {
+  uint32_t out_sum = 0;
+  for (int i = 0; i < PART_LEN1; i++) {
+    out_sum += ((uint32_t)G_mask[i] * Y_mag[i]) >> 14;
+  }
+  const int16_t out_log = LogOfEnergyInQ8(out_sum, g_aecm->dfaCleanQDomain);
+  const int16_t near_log = g_aecm->nearLogEnergy[0];
+  // 出力の雑音レベル（最小値を追い、上がるときはゆっくり）
+  if (g_aecm->agcNoiseLevel == AGC_LEVEL_UNSET || out_log < g_aecm->agcNoiseLevel) {
+    g_aecm->agcNoiseLevel = out_log;
+  } else {
+    g_aecm->agcNoiseLevel = (int16_t)(g_aecm->agcNoiseLevel + ((out_log - g_aecm->agcNoiseLevel) >> AGC_NOISE_RISE_SHIFT));
   }
+  const bool speech = near_log > AGC_NEAR_ACTIVE_Q8 && out_log > g_aecm->agcNoiseLevel + AGC_SPEECH_MARGIN_Q8;
+  const bool near_dominant = near_log > g_aecm->echoStoredLogEnergy[0] + AGC_ECHO_MARGIN_Q8;
+  if (speech && near_dominant && out_log > near_log - AGC_ECHO_MARGIN_Q8) {
+    if (g_aecm->agcLevel == AGC_LEVEL_UNSET) {
+      g_aecm->agcLevel = out_log;
+    } else {
+      g_aecm->agcLevel = (int16_t)(g_aecm->agcLevel + ((out_log - g_aecm->agcLevel) >> AGC_LEVEL_SMOOTH_SHIFT));
+    }
+    const int32_t target = g_agcTargetLogQ8.load(std::memory_order_relaxed);
+    const int32_t desired = SAT(AGC_GAIN_MAX_Q8, target - g_aecm->agcLevel, AGC_GAIN_MIN_Q8);
+    int32_t step = SAT(AGC_GAIN_RISE_Q8, desired - g_aecm->agcGain, -AGC_GAIN_FALL_Q8);
+    if (g_aecm->agcLimiterGain < ONE_Q14) {
+      step = MIN(step, 0);
+    }
+    g_aecm->agcGain = (int16_t)(g_aecm->agcGain + step);
+  }
+  return AgcGainToLinearQ12(g_aecm->agcGain);
+}
 
-  // 1. ブロック入力とバッファ更新 x: x_block y: y_block
-  // 近端/遠端の時間領域フレームをバッファへ蓄える
-  memcpy(g_xBuf + PART_LEN, x_block, sizeof(int16_t) * PART_LEN);
-  memcpy(g_yBuf + PART_LEN, y_block, sizeof(int16_t) * PART_LEN);
+// 自動利得制御の出力段。オーバーラップ加算の和（最大で 16 ビットの 2 倍）の最大振幅が AGC_LIMIT_LEVEL を超えるブロックは、
+// ブロック全体を超えない大きさまで下げる。下げたゲインは AGC_LIMITER_RELEASE_Q14 ずつブロック内で直線的に戻す。
+// どちらの場合もしきい値を超えるサンプルは残らないので、SAT で波形が切れない。
+static void LimitedOverlapAdd(const int16_t* current, const int16_t* overlap, int16_t* out) {
+  int32_t sum[PART_LEN];
+  int32_t peak = 0;
+  for (int i = 0; i < PART_LEN; i++) {
+    sum[i] = (int32_t)current[i] + g_aecm->eOverlapBuf[i];
+    peak = MAX(peak, ABS_W32(sum[i]));
+  }
+  const int32_t prev = g_aecm->agcLimiterGain;
+  const int32_t target = (peak > AGC_LIMIT_LEVEL) ? ((int32_t)AGC_LIMIT_LEVEL << 14) / peak : ONE_Q14;
+  if (target < prev) {
+    for (int i = 0; i < PART_LEN; i++) {
+      out[i] = (int16_t)((sum[i] * target) >> 14);
+    }
+    g_aecm->agcLimiterGain = (int16_t)target;
+  } else if (prev == ONE_Q14) {
+    for (int i = 0; i < PART_LEN; i++) {
+      out[i] = (int16_t)sum[i];
+    }
+  } else {
+    const int32_t next = MIN(target, prev + AGC_LIMITER_RELEASE_Q14);
+    for (int i = 0; i < PART_LEN; i++) {
+      const int32_t gain = prev + (next - prev) * (i + 1) / PART_LEN;
+      out[i] = (int16_t)((sum[i] * gain) >> 14);
+    }
+    g_aecm->agcLimiterGain = (int16_t)next;
+  }
+  memcpy(g_aecm->eOverlapBuf, overlap, sizeof(g_aecm->eOverlapBuf));
+}
+
+void OverlapAddOutputBlock(const AecmOutputBlock* output, int16_t* out) {
+  if (g_agcTargetDbfs != 0) {
+    LimitedOverlapAdd(output->current, output->overlap, out);
+    return;
+  }
+  for (int i = 0; i < PART_LEN; i++) {
+    out[i] = SatW32ToW16((int32_t)output->current[i] + g_aecm->eOverlapBuf[i]);
+  }
+  memcpy(g_aecm->eOverlapBuf, output->overlap, sizeof(g_aecm->eOverlapBuf));
+}
 
-  // 2. 時間領域から周波数領域に変換. Y_freqは捨てる。
-  ComplexInt16 Y_freq[PART_LEN2]; // Y の周波数領域表現
-  uint16_t X_mag[PART_LEN1]; // |X| Xの絶対値スペクトル
-  uint16_t Y_mag[PART_LEN1]; // |Y| Yの絶対値スペクトル
+// ProcessBlock の機能構成。テンプレート引数にして、無効な機能の分岐と統計処理を
+// コンパイル時に取り除く。実行時フラグからの選択は SelectPipeline で行う。
+struct PipelinePolicy {
+  bool supmask; // 抑圧マスク（false で全ビン 1）
+  bool nlp; // NLP（false で nlpGain を常に 1）
+  bool delay_decimated; // 遅延推定を LOAD_SHED_DELAY_INTERVAL ブロックに 1 回に間引く
+  int stats_level; // デバッグ統計 0: なし, 1: 状態ログのみ, 2: 抑圧量の集計も行う
+  bool ns; // 定常雑音の抑圧（SetNoiseSuppression）
+  bool agc; // 自動利得制御（SetAutoGainControl）
+};
+
+// 遠端 1 ブロックの変換。窓掛け・FFT で |X| を求め、履歴のエントリにする（2値化はしない）。
+// x_frame: 直前と今回の遠端ブロックを並べた PART_LEN2 サンプル。X_mag_buf: |X| の置き場所（圧縮形式のときに使う）。
+// 戻り値は |X|。インスタンスの状態を読み書きしないので、別スレッドから同時に呼べる。
+const uint16_t* TransformFarFrame(const int16_t* x_frame, AecmFarBlock* far, uint16_t* X_mag_buf) {
+  ComplexInt16 X_freq[PART_LEN2]; // X の周波数領域表現（捨てる）
+  TransformFarSpectrum(x_frame, X_freq);
+  return FarSpectrumToEntry(X_freq, far, X_mag_buf);
+}
+
+void TransformFarSpectrum(const int16_t* x_frame, ComplexInt16* X_freq) {
+  int16_t fft[PART_LEN2]; // 窓掛け結果の作業領域
+  g_kernels.window_and_fft(fft, x_frame, X_freq, PART_LEN, kSqrtHanning); // X = FFT(x)
+}
+
+const uint16_t* FarSpectrumToEntry(ComplexInt16* X_freq, AecmFarBlock* far, uint16_t* X_mag_buf) {
   uint32_t X_mag_sum = 0; // sum(|X|) 遠端のエネルギー
-  TimeToFrequencyDomain(g_xBuf, Y_freq, X_mag, &X_mag_sum); // |X|, sum(|X|) = FFT(x)
-  uint32_t Y_mag_sum = 0;
-  TimeToFrequencyDomain(g_yBuf, Y_freq, Y_mag, &Y_mag_sum); // Y, |Y|, sum(|Y|) = FFT(y)
+#if AECM_COMPACT_HISTORY
+  uint16_t* X_mag = X_mag_buf; // |X| Xの絶対値スペクトル
+  g_kernels.magnitude(X_freq, X_mag, &X_mag_sum); // |X|, sum(|X|)
+  EncodeFarHistoryEntry(X_mag, far->entry); // |X|を圧縮する
+#else
+  (void)X_mag_buf;
+  uint16_t* X_mag = far->entry; // |X| は履歴のエントリそのもの
+  g_kernels.magnitude(X_freq, X_mag, &X_mag_sum); // |X|, sum(|X|)
+#endif
+  return X_mag;
+}
+
+// 遠端 1 ブロックの解析（再生側）。変換して遅延推定用の2値スペクトルも求める。
+// 触るのは遠端の時間領域バッファと2値化のしきい値だけで、収録側の状態は読み書きしない。
+// 遠端は StageFarBlock（または StagePcmBlock）で xBuf の後半に置いてあること。
+static void AnalyzeFarBlock(AecmFarBlock* far) {
+  uint16_t X_mag_buf[PART_LEN1];
+  far->binary = BinarizeFarSpectrum(TransformFarFrame(g_aecm->xBuf, far, X_mag_buf));
+
+  // 次ブロックで使用するため、最新フレームの後半を先頭へシフト
+  memcpy(g_aecm->xBuf, g_aecm->xBuf + PART_LEN, sizeof(int16_t) * PART_LEN);
+}
+
+// y_frame: 直前と今回の近端ブロックを並べた PART_LEN2 サンプル
+void AnalyzeNearBlock(const int16_t* y_frame, AecmNearBlock* near) {
+  near->Y_mag_sum = 0;
+  TimeToFrequencyDomain(y_frame, near->Y_freq, near->Y_mag, &near->Y_mag_sum); // Y, |Y|, sum(|Y|) = FFT(y)
+}
+
+// 遠端・近端の時間領域フレームをバッファへ蓄える
+static inline void StageFarBlock(const int16_t* x_block) {
+  memcpy(g_aecm->xBuf + PART_LEN, x_block, sizeof(int16_t) * PART_LEN);
+}
+
+static inline void StageNearBlock(const int16_t* y_block) {
+  memcpy(g_aecm->yBuf + PART_LEN, y_block, sizeof(int16_t) * PART_LEN);
+}
 
-  g_xHistoryPos++;
-  if (g_xHistoryPos >= MAX_DELAY) {
-    g_xHistoryPos = 0;
+static inline bool IsValidPcmBuffer(const AecmPcmBuffer* pcm) {
+  return pcm->stride >= 1 && pcm->channel >= 0 && pcm->channel < pcm->stride;
+}
+
+// float（-1.0 .. 1.0）を Q15 の int16 へ。最近接に丸めて飽和し、NaN は 0 にする。
+static inline int16_t FloatToS16(float v) {
+  const float scaled = v * 32768.0f;
+  if (scaled >= (float)WORD16_MAX) return WORD16_MAX;
+  if (scaled <= (float)WORD16_MIN) return WORD16_MIN;
+  if (scaled != scaled) return 0;
+  return (int16_t)lrintf(scaled);
+}
+
+// 呼び出し側のバッファの 1 チャネル（PART_LEN フレーム）を変換しながら時間領域バッファ dst へ置く。
+// 変換用の中間バッファは持たず、FFT 前のステージングへ直接書く。
+static void StagePcmBlock(const AecmPcmBuffer* pcm, int16_t* dst) {
+  const int stride = pcm->stride;
+  if (pcm->format == AECM_PCM_F32) {
+    const float* src = static_cast<const float*>(pcm->data) + pcm->channel;
+    for (int i = 0; i < PART_LEN; i++) {
+      dst[i] = FloatToS16(src[i * stride]);
+    }
+  } else if (stride == 1) {
+    memcpy(dst, pcm->data, sizeof(int16_t) * PART_LEN);
+  } else {
+    const int16_t* src = static_cast<const int16_t*>(pcm->data) + pcm->channel;
+    for (int i = 0; i < PART_LEN; i++) {
+      dst[i] = src[i * stride];
+    }
+  }
+}
+
+// 出力 1 ブロックを呼び出し側のバッファの 1 チャネルへ書く（他のチャネルは触らない）
+static void WritePcmBlock(const int16_t* e_block, const AecmPcmBuffer* pcm) {
+  const int stride = pcm->stride;
+  if (pcm->format == AECM_PCM_F32) {
+    float* dst = static_cast<float*>(pcm->data) + pcm->channel;
+    for (int i = 0; i < PART_LEN; i++) {
+      dst[i * stride] = e_block[i] * (1.0f / 32768.0f);
+    }
+  } else {
+    int16_t* dst = static_cast<int16_t*>(pcm->data) + pcm->channel;
+    for (int i = 0; i < PART_LEN; i++) {
+      dst[i * stride] = e_block[i];
+    }
+  }
+}
+
+// 12 の E = G_mask * Y。agc_gain_q12（Q12）が 1 でなければ自動利得制御のゲインもまとめて掛け、16 ビットに飽和させる。
+static inline void ApplyMaskToSpectrum(const ComplexInt16* Y_freq, const int16_t* G_mask, int32_t agc_gain_q12,
+                                       ComplexInt16* E_freq) {
+  if (agc_gain_q12 == AGC_UNITY_Q12) {
+    for (int i = 0; i < PART_LEN1; i++) {
+      E_freq[i].real = (int16_t)(MUL_16_16_RSFT_WITH_ROUND(Y_freq[i].real, G_mask[i], 14));
+      E_freq[i].imag = (int16_t)(MUL_16_16_RSFT_WITH_ROUND(Y_freq[i].imag, G_mask[i], 14));
+    }
+    return;
+  }
+  for (int i = 0; i < PART_LEN1; i++) {
+    const int64_t gain_q14 = ((int32_t)G_mask[i] * agc_gain_q12) >> 12;
+    E_freq[i].real = SatW32ToW16((int32_t)((Y_freq[i].real * gain_q14 + (1 << 13)) >> 14));
+    E_freq[i].imag = SatW32ToW16((int32_t)((Y_freq[i].imag * gain_q14 + (1 << 13)) >> 14));
+  }
+}
+
+// 負荷軽減中（レベル 4）の合成: IFFT を省略し、マスク平均を広帯域ゲインとして時間領域で掛ける。
+// 解析窓・合成窓とオーバーラップ加算は IFFT 経路と同じ形にするので、レベルを切り替えたブロックでも出力はつながる。
+// agc_gain_q12 は自動利得制御のゲイン（無効なら AGC_UNITY_Q12）。1 を超えるとき current / overlap は飽和させる。
+static void BroadbandGainSynthesis(const int16_t* G_mask, int32_t agc_gain_q12, int16_t* current, int16_t* overlap) {
+  int32_t broadband_gain_q14 = 0;
+  for (int i = 0; i < PART_LEN1; i++) {
+    broadband_gain_q14 += G_mask[i];
+  }
+  broadband_gain_q14 /= PART_LEN1;
+  broadband_gain_q14 = (broadband_gain_q14 * agc_gain_q12) >> 12;
+  for (int i = 0; i < PART_LEN; ++i) {
+    int16_t windowed_current = (int16_t)((g_aecm->yBuf[i] * kSqrtHanning[i]) >> 14);
+    int16_t windowed_overlap = (int16_t)((g_aecm->yBuf[PART_LEN + i] * kSqrtHanning[PART_LEN - i]) >> 14);
+    int32_t current_q0 = MUL_16_16_RSFT_WITH_ROUND(windowed_current, kSqrtHanning[i], 14);
+    int32_t overlap_q0 = (windowed_overlap * kSqrtHanning[PART_LEN - i]) >> 14;
+    current[i] = SatW32ToW16((int32_t)(((int64_t)current_q0 * broadband_gain_q14) >> 14));
+    overlap[i] = SatW32ToW16((int32_t)(((int64_t)overlap_q0 * broadband_gain_q14) >> 14));
+  }
+}
+
+// スタートアップ状態を判定する。段階は次の 3 つ:
+// (0) 最初の CONV_LEN ブロック
+// (1) さらに CONV_LEN ブロック
+// (2) それ以降
+static inline void UpdateStartupState() {
+  if (g_aecm->startupState < 2) {
+    g_aecm->startupState = (g_aecm->totCount >= CONV_LEN) + (g_aecm->totCount >= CONV_LEN2);
+  }
+}
+
+// 2 の後半と 3: 遠端の解析結果を履歴に積み、近端 |Y| との比較で遅延を推定して、遠端スペクトルを整列する。
+// decimated: 遅延推定を間引くブロック（前回の推定値を使う）。戻り値は遅延（ブロック）、推定器のエラーなら -1。
+// *X_mag_aligned には整列した |X|（非圧縮形式では履歴の中、圧縮形式では X_mag_decoded）を返す。
+static int PushAndAlignFar(const AecmFarBlock* far, const uint16_t* Y_mag, bool decimated,
+                           const uint16_t** X_mag_aligned, uint16_t* X_mag_decoded) {
+  // 遠端を共有しているとき（マルチマイク）は、履歴への追加は共有元が済ませているので読むだけにする
+  const AecmState* far_state = g_aecm->farSource ? g_aecm->farSource : g_aecm;
+  if (!g_aecm->farSource) {
+    g_aecm->xHistoryPos++;
+    if (g_aecm->xHistoryPos >= MAX_DELAY) {
+      g_aecm->xHistoryPos = 0;
+    }
+    memcpy(&(g_aecm->xHistory[g_aecm->xHistoryPos * FAR_HISTORY_ENTRY_LEN]), far->entry, sizeof(far->entry)); // |X|を履歴に積む
   }
-  memcpy(&(g_xHistory[g_xHistoryPos * PART_LEN1]), X_mag, sizeof(uint16_t) * PART_LEN1); // |X|を履歴に積む
 
   // 3. 2値スペクトル履歴からブロック単位の遅延を推定する。
-  int delay = DelayEstimatorProcess(Y_mag,X_mag); // delay : 整数値。単位はブロック
+  int delay; // delay : 整数値。単位はブロック
+  if (decimated) {
+    // 負荷軽減中: 遠端の2値スペクトル履歴だけ進め、遅延は前回の推定値を使う。
+    if (!g_aecm->farSource) {
+      AddBinaryFarSpectrum(far->binary);
+    }
+    delay = g_aecm->last_estimated_delay_blocks;
+  } else if (g_aecm->farSource) {
+    delay = DelayEstimatorProcessNear(Y_mag);
+  } else {
+    delay = DelayEstimatorProcess(Y_mag, far->binary);
+  }
   if (delay == -1) {
-    g_last_estimated_delay_blocks = -1;
+    g_aecm->last_estimated_delay_blocks = -1;
     return -1;
   } else if (delay == -2) {
-    g_last_estimated_delay_blocks = -2;
+    g_aecm->last_estimated_delay_blocks = -2;
     delay = 0;  // 遅延が不明な場合は 0 と仮定する。
   } else {
-    g_last_estimated_delay_blocks = delay;
+    g_aecm->last_estimated_delay_blocks = delay;
   }
 
   // 推定した遅延に合わせて遠端スペクトルを整列する。整列とは処理対象とするブロックを選ぶこと。
-  int buffer_position = g_xHistoryPos - delay;
+  int buffer_position = far_state->xHistoryPos - delay;
   if (buffer_position < 0) {
     buffer_position += MAX_DELAY;
   }
-  const uint16_t* X_mag_aligned = &(g_xHistory[buffer_position * PART_LEN1]); // |X_aligned|
+#if AECM_COMPACT_HISTORY
+  DecodeFarHistoryEntry(&(far_state->xHistory[buffer_position * FAR_HISTORY_ENTRY_LEN]), X_mag_decoded);
+  *X_mag_aligned = X_mag_decoded; // |X_aligned|（整列したエントリだけ復号する）
+#else
+  (void)X_mag_decoded;
+  *X_mag_aligned = &(far_state->xHistory[buffer_position * PART_LEN1]); // |X_aligned|
+#endif
+  return delay;
+}
+
+template <PipelinePolicy P>
+static int ProcessAlignedImpl(const uint16_t* X_mag_aligned, int delay, const AecmNearBlock* near,
+                              const int16_t* y_block, int16_t* e_block, AecmOutputBlock* deferred);
+
+// blockはBLOCK_LENサンプルの時間領域データ。符号付き線形PCM -32768 ~ 32767
+// far: 遠端ブロックの解析結果（AnalyzeFarBlock）, near: 近端ブロックの解析結果（AnalyzeNearBlock）,
+// y_block: 近端（StageNearBlock で yBuf に置いてあること）, e_block: キャンセル済みの残差信号
+// deferred: NULL でなければ 13 の合成を行わずにここへ残す（ProcessTransformedBlock）
+template <PipelinePolicy P>
+static int ProcessBlockImpl(const AecmFarBlock* far, const AecmNearBlock* near, const int16_t* y_block,
+                            int16_t* e_block, AecmOutputBlock* deferred) {
+  UpdateStartupState();
+
+  // 1. ブロック入力とバッファ更新（StageNearBlock で済んでいる）
+  // 2. 時間領域から周波数領域に変換（AnalyzeFarBlock / AnalyzeNearBlock で済んでいる）
+  const uint16_t* Y_mag = near->Y_mag; // |Y| Yの絶対値スペクトル
+  const uint16_t* X_mag_aligned; // |X_aligned|
+  uint16_t X_mag_decoded[PART_LEN1];
+  const int delay = PushAndAlignFar(far, Y_mag, P.delay_decimated && (g_aecm->totCount % LOAD_SHED_DELAY_INTERVAL) != 0,
+                                    &X_mag_aligned, X_mag_decoded);
+  if (delay < 0) {
+    return -1;
+  }
+  return ProcessAlignedImpl<P>(X_mag_aligned, delay, near, y_block, e_block, deferred);
+}
+
+// 4 以降: 整列済みの遠端 |X| で近端 1 ブロックを処理する。delay は状態ログ用。
+template <PipelinePolicy P>
+static int ProcessAlignedImpl(const uint16_t* X_mag_aligned, int delay, const AecmNearBlock* near,
+                              const int16_t* y_block, int16_t* e_block, AecmOutputBlock* deferred) {
+  const ComplexInt16* Y_freq = near->Y_freq; // Y の周波数領域表現
+  const uint16_t* Y_mag = near->Y_mag; // |Y| Yの絶対値スペクトル
+  const uint32_t Y_mag_sum = near->Y_mag_sum;
 
   // 4. 対数表現エネルギー4種類の履歴を更新
   uint32_t far_energy_sum = 0;    // 遠端スペクトル|X(k)|の総和
@@ -508,46 +880,49 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
   int16_t increase_min_shifts = 11;
   int16_t decrease_min_shifts = 3;
 
-  g_dfaNoisyQDomainOld = g_dfaNoisyQDomain;
-  g_dfaNoisyQDomain = 0;
+  g_aecm->dfaNoisyQDomainOld = g_aecm->dfaNoisyQDomain;
+  g_aecm->dfaNoisyQDomain = 0;
 
-  g_dfaCleanQDomainOld = g_dfaNoisyQDomainOld;
-  g_dfaCleanQDomain = g_dfaNoisyQDomain;
+  g_aecm->dfaCleanQDomainOld = g_aecm->dfaNoisyQDomainOld;
+  g_aecm->dfaCleanQDomain = g_aecm->dfaNoisyQDomain;
   
   // 近端の対数エネルギー履歴を後ろに1つずらす
-  memmove(g_nearLogEnergy + 1, g_nearLogEnergy, sizeof(int16_t) * (MAX_LOG_LEN - 1));
-  g_nearLogEnergy[0] = LogOfEnergyInQ8(Y_mag_sum, g_dfaNoisyQDomain);
+  memmove(g_aecm->nearLogEnergy + 1, g_aecm->nearLogEnergy, sizeof(int16_t) * (MAX_LOG_LEN - 1));
+  g_aecm->nearLogEnergy[0] = LogOfEnergyInQ8(Y_mag_sum, g_aecm->dfaNoisyQDomain);
 
   int32_t S_mag[PART_LEN1]; // |Ŝ(k)|: 予測エコー振幅（チャネル通過後）    
   for (int i = 0; i < PART_LEN1; i++) {
-      S_mag[i] = MUL_16_U16(g_HStored[i], X_mag_aligned[i]);  // 推定エコー信号Sを計算
+      S_mag[i] = MUL_16_U16(g_aecm->HStored[i], X_mag_aligned[i]);  // 推定エコー信号Sを計算
       far_energy_sum += (uint32_t)X_mag_aligned[i];            // 遠端エネルギー総和
-      adapt_energy_sum += g_HAdapt16[i] * X_mag_aligned[i];    // 適応チャネルによるエコーエネルギー
+      adapt_energy_sum += g_aecm->HAdapt16[i] * X_mag_aligned[i];    // 適応チャネルによるエコーエネルギー
       stored_energy_sum += (uint32_t)S_mag[i];                 // 保存チャネルのエネルギー
   }
 
   // 対数エネルギー履歴バッファを後ろに1つずらす
-  memmove(g_echoAdaptLogEnergy + 1, g_echoAdaptLogEnergy, sizeof(int16_t) * (MAX_LOG_LEN - 1));
-  memmove(g_echoStoredLogEnergy + 1, g_echoStoredLogEnergy, sizeof(int16_t) * (MAX_LOG_LEN - 1));
+  memmove(g_aecm->echoAdaptLogEnergy + 1, g_aecm->echoAdaptLogEnergy, sizeof(int16_t) * (MAX_LOG_LEN - 1));
+  memmove(g_aecm->echoStoredLogEnergy + 1, g_aecm->echoStoredLogEnergy, sizeof(int16_t) * (MAX_LOG_LEN - 1));
 
-  g_farLogEnergy = LogOfEnergyInQ8(far_energy_sum, 0);
-  g_echoAdaptLogEnergy[0] = LogOfEnergyInQ8(adapt_energy_sum, RESOLUTION_CHANNEL16);  // 後ろにずらしたので[0]に代入可能。
-  g_echoStoredLogEnergy[0] = LogOfEnergyInQ8(stored_energy_sum, RESOLUTION_CHANNEL16);  // 後ろにずらしたので[0]に代入可能。
+  g_aecm->farLogEnergy = LogOfEnergyInQ8(far_energy_sum, 0);
+  g_aecm->echoAdaptLogEnergy[0] = LogOfEnergyInQ8(adapt_energy_sum, RESOLUTION_CHANNEL16);  // 後ろにずらしたので[0]に代入可能。
+  g_aecm->echoStoredLogEnergy[0] = LogOfEnergyInQ8(stored_energy_sum, RESOLUTION_CHANNEL16);  // 後ろにずらしたので[0]に代入可能。
 
   // 5. 遠端のエネルギーを評価する
-  if (g_farLogEnergy > FAR_ENERGY_MIN) {
-      if (g_startupState == 0) {
+  if (g_aecm->farTrackerHold > 0) {
+      // 再開直後: 整列した遠端はまだ空の履歴なので、無音としてトラッカを引き下げないようにする。
+      g_aecm->farTrackerHold--;
+  } else if (g_aecm->farLogEnergy > FAR_ENERGY_MIN) {
+      if (g_aecm->startupState == 0) {
           increase_max_shifts = 2;
           decrease_min_shifts = 2;
           increase_min_shifts = 8;
       }
       // AsymFilt: 上昇は速く、下降は遅くする非対称フィルタ
-      g_farEnergyMin = AsymFilt(g_farEnergyMin, g_farLogEnergy, increase_min_shifts, decrease_min_shifts);
-      g_farEnergyMax = AsymFilt(g_farEnergyMax, g_farLogEnergy, increase_max_shifts, decrease_max_shifts);
-      g_farEnergyMaxMin = g_farEnergyMax - g_farEnergyMin;
+      g_aecm->farEnergyMin = AsymFilt(g_aecm->farEnergyMin, g_aecm->farLogEnergy, increase_min_shifts, decrease_min_shifts);
+      g_aecm->farEnergyMax = AsymFilt(g_aecm->farEnergyMax, g_aecm->farLogEnergy, increase_max_shifts, decrease_max_shifts);
+      g_aecm->farEnergyMaxMin = g_aecm->farEnergyMax - g_aecm->farEnergyMin;
 
-      // VAD判定用の閾値 g_farEnergyVAD を更新する。
-      vad_offset_q8 = 2560 - g_farEnergyMin;
+      // VAD判定用の閾値 g_aecm->farEnergyVAD を更新する。
+      vad_offset_q8 = 2560 - g_aecm->farEnergyMin;
       if (vad_offset_q8 > 0) {
           vad_offset_q8 = static_cast<int16_t>((vad_offset_q8 * FAR_ENERGY_VAD_REGION) >> 9);
       } else {
@@ -555,35 +930,35 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
       }
       vad_offset_q8 += FAR_ENERGY_VAD_REGION;
 
-      if ((g_startupState == 0) | (g_vadUpdateCount > 1024)) { // 起動直後と、長期間一定だったときはリセットする
-          g_farEnergyVAD = g_farEnergyMin + vad_offset_q8;
+      if ((g_aecm->startupState == 0) | (g_aecm->vadUpdateCount > 1024)) { // 起動直後と、長期間一定だったときはリセットする
+          g_aecm->farEnergyVAD = g_aecm->farEnergyMin + vad_offset_q8;
       } else {
-          if (g_farEnergyVAD > g_farLogEnergy) {
-              g_farEnergyVAD += (g_farLogEnergy + vad_offset_q8 - g_farEnergyVAD) >> 6; // 遠端が閾値より小さいときはゆっくり更新する。カウンタはゆっくりにする用
-              g_vadUpdateCount = 0;
+          if (g_aecm->farEnergyVAD > g_aecm->farLogEnergy) {
+              g_aecm->farEnergyVAD += (g_aecm->farLogEnergy + vad_offset_q8 - g_aecm->farEnergyVAD) >> 6; // 遠端が閾値より小さいときはゆっくり更新する。カウンタはゆっくりにする用
+              g_aecm->vadUpdateCount = 0;
           } else {
-              g_vadUpdateCount++;
+              g_aecm->vadUpdateCount++;
           }
       }
-      g_farEnergyMSEThres = g_farEnergyVAD + (1 << 8); // この値を後段8でHの昇格判定に使う。
+      g_aecm->farEnergyMSEThres = g_aecm->farEnergyVAD + (1 << 8); // この値を後段8でHの昇格判定に使う。
   }
 
   // VADの結論を出す
-  if (g_farLogEnergy > g_farEnergyVAD) { 
-      if ((g_startupState == 0) | (g_farEnergyMaxMin > FAR_ENERGY_DIFF)) {
-          g_currentVAD = true; // 声がある
+  if (g_aecm->farLogEnergy > g_aecm->farEnergyVAD) { 
+      if ((g_aecm->startupState == 0) | (g_aecm->farEnergyMaxMin > FAR_ENERGY_DIFF)) {
+          g_aecm->currentVAD = true; // 声がある
       }
   } else {
-      g_currentVAD = false; // 声がない
+      g_aecm->currentVAD = false; // 声がない
   }
-  if (g_currentVAD && g_firstVAD) { // 最初に声が入ったか?
-      g_firstVAD = false;
-      if (g_echoAdaptLogEnergy[0] > g_nearLogEnergy[0]) {
+  if (g_aecm->currentVAD && g_aecm->firstVAD) { // 最初に声が入ったか?
+      g_aecm->firstVAD = false;
+      if (g_aecm->echoAdaptLogEnergy[0] > g_aecm->nearLogEnergy[0]) {
           for (int i = 0; i < PART_LEN1; i++) {
-              g_HAdapt16[i] >>= 3;
+              g_aecm->HAdapt16[i] >>= 3;
           }
-          g_echoAdaptLogEnergy[0] -= (3 << 8);
-          g_firstVAD = true;
+          g_aecm->echoAdaptLogEnergy[0] -= (3 << 8);
+          g_aecm->firstVAD = true;
       }
   }
 
@@ -592,15 +967,15 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
   const int MU_MAX = 1;   // 遠端エネルギーに依存する最大ステップ（2^-MU_MAX） 
   const int MU_DIFF = 9;  // MU_MIN と MU_MAX の差   
   int16_t mu = MU_MAX;
-  if (!g_currentVAD) { 
+  if (!g_aecm->currentVAD) { 
     mu = 0; // 声がないときは、全く学習しない。
-  } else if (g_startupState > 0) {
-    if (g_farEnergyMin >= g_farEnergyMax) { // 初期化直後はこの値がブレることがある。そのときに混乱しないため
+  } else if (g_aecm->startupState > 0) {
+    if (g_aecm->farEnergyMin >= g_aecm->farEnergyMax) { // 初期化直後はこの値がブレることがある。そのときに混乱しないため
       mu = MU_MIN; 
     } else {
-      int16_t mu_tmp16 = g_farLogEnergy - g_farEnergyMin;
+      int16_t mu_tmp16 = g_aecm->farLogEnergy - g_aecm->farEnergyMin;
       int32_t mu_tmp32 = mu_tmp16 * MU_DIFF;
-      mu_tmp32 = DivW32W16(mu_tmp32, g_farEnergyMaxMin);
+      mu_tmp32 = DivW32W16(mu_tmp32, g_aecm->farEnergyMaxMin);
       mu = static_cast<int16_t>(MU_MIN - 1 - mu_tmp32);
     }
     if (mu < MU_MAX) {
@@ -608,8 +983,12 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
     }
   }
 
+  if (g_aecm->loadShedLevel >= 1) {
+    mu = 0; // 負荷軽減中は NLMS 適応を凍結する。
+  }
+
   // 処理済みブロック数をインクリメント
-  g_totCount++;
+  g_aecm->totCount++;
 
   // 7. エコーチャネル更新
   // NLM法で、 muを用いて Hadaptを更新する。関数内部に処理内容をコメントしている。
@@ -621,12 +1000,12 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
   int16_t supGain_interp_target;
   int16_t dE = 0;
 
-  if (!g_currentVAD) {
+  if (!g_aecm->currentVAD) {
       supGain = 0;
   } else {
       // 近端と推定エコーの対数エネルギー差をとり、抑圧ゲインをどれだけ下げるか判断する。
       // dE が近端と推定エコーのエネルギーの差。
-      supGain_interp_target = (g_nearLogEnergy[0] - g_echoStoredLogEnergy[0] - ENERGY_DEV_OFFSET);
+      supGain_interp_target = (g_aecm->nearLogEnergy[0] - g_aecm->echoStoredLogEnergy[0] - ENERGY_DEV_OFFSET);
       dE = ABS_W16(supGain_interp_target);
 
       if (dE < ENERGY_DEV_TOL) {
@@ -642,138 +1021,51 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
       }
   }
 
-  if (supGain > g_supGainOld) {
+  if (supGain > g_aecm->supGainOld) {
       supGain_interp_target = supGain;
   } else {
-      supGain_interp_target = g_supGainOld;
+      supGain_interp_target = g_aecm->supGainOld;
   }
-  g_supGainOld = supGain;
-  if (supGain_interp_target < g_supGain) {
+  g_aecm->supGainOld = supGain;
+  if (supGain_interp_target < g_aecm->supGain) {
       // 下降方向：滑らかに減衰させる。
-      g_supGain += (int16_t)((supGain_interp_target - g_supGain) >> 4);
+      g_aecm->supGain += (int16_t)((supGain_interp_target - g_aecm->supGain) >> 4);
   } else {
       // 上昇方向：同じ平滑係数でゆっくり追随。
-      g_supGain += (int16_t)((supGain_interp_target - g_supGain) >> 4);
+      g_aecm->supGain += (int16_t)((supGain_interp_target - g_aecm->supGain) >> 4);
   }
   // 抑圧ゲイン更新ここまで
 
 
-  // 10. 周波数マスク生成  
+  // 10. 周波数マスク生成
   int16_t G_mask[PART_LEN1];
-  int16_t numPosCoef = 0;
+  int16_t numPosCoef;
+  if (g_aecm->loadShedLevel >= 3 && (g_aecm->totCount % LOAD_SHED_MASK_INTERVAL) != 0) {
+    // 負荷軽減中: 前回計算したマスクを再利用する。
+    memcpy(G_mask, g_aecm->GMaskPrev, sizeof(G_mask));
+    numPosCoef = g_aecm->numPosCoefPrev;
+  } else {
+    numPosCoef = CalcSuppressionMask<P.supmask>(S_mag, Y_mag, G_mask);
+    memcpy(g_aecm->GMaskPrev, G_mask, sizeof(G_mask));
+    g_aecm->numPosCoefPrev = numPosCoef;
+  }
   double sum_gain = 0.0;
   double mask_removed_block = 0.0;
   double nlp_removed_block = 0.0;
   double freq_input_block = 0.0;
   double actual_after_block = 0.0;
   double min_final_gain = 1.0;
-  for (int i = 0; i < PART_LEN1; i++) {
-    // 推定エコー振幅を更新・平滑化して、最新の抑圧対象エネルギーを取得
-    int32_t smooth_error_q31 = S_mag[i] - g_sMagSmooth[i];
-    g_sMagSmooth[i] += (int32_t)(((int64_t)smooth_error_q31 * 50) >> 8);
-
-    // エコー推定量と抑圧ゲインのビット幅を調べ、整数演算用のスケーリングを決定
-    int16_t smooth_echo_leading_zeros = NormW32(g_sMagSmooth[i]) + 1;
-    int16_t sup_gain_leading_zeros = NormW16(g_supGain) + 1;
-    uint32_t S_magGained;
-    int16_t resolutionDiff;
-    if (smooth_echo_leading_zeros + sup_gain_leading_zeros > 16) {
-      S_magGained = UMUL_32_16((uint32_t)g_sMagSmooth[i], (uint16_t)g_supGain);
-      resolutionDiff = 14 - RESOLUTION_CHANNEL16 - RESOLUTION_SUPGAIN;
-    } else {
-      int16_t gain_shift_candidate = 17 - smooth_echo_leading_zeros - sup_gain_leading_zeros;
-      resolutionDiff = 14 + gain_shift_candidate - RESOLUTION_CHANNEL16 - RESOLUTION_SUPGAIN;
-      if (smooth_echo_leading_zeros > gain_shift_candidate) {
-        S_magGained = UMUL_32_16((uint32_t)g_sMagSmooth[i], g_supGain >> gain_shift_candidate);
-      } else {
-        S_magGained = (g_sMagSmooth[i] >> gain_shift_candidate) * g_supGain;
-      }
-    }
-    // 近端スペクトルの Q ドメインを最新状態にそろえる
-    int16_t smoothed_near_leading_zeros = NormW16(g_yMagSmooth[i]);
-    int16_t y_mag_q_domain_diff = g_dfaCleanQDomain - g_dfaCleanQDomainOld;
-    int16_t qDomainDiff;
-    int16_t smoothed_near_mag_q15;
-    int16_t raw_near_mag_q15;
-    if (smoothed_near_leading_zeros < y_mag_q_domain_diff && g_yMagSmooth[i]) {
-      smoothed_near_mag_q15 = g_yMagSmooth[i] * (1 << smoothed_near_leading_zeros);
-      qDomainDiff = smoothed_near_leading_zeros - y_mag_q_domain_diff;
-      raw_near_mag_q15 = Y_mag[i] >> -qDomainDiff;
-    } else {
-      smoothed_near_mag_q15 = y_mag_q_domain_diff < 0
-                     ? g_yMagSmooth[i] >> -y_mag_q_domain_diff
-                     : g_yMagSmooth[i] * (1 << y_mag_q_domain_diff);
-      qDomainDiff = 0;
-      raw_near_mag_q15 = Y_mag[i];
-    }
-    // 近端振幅をスムージングしつつ、過剰なスケールにならないよう制限
-    int32_t near_mag_delta_q15 = (int32_t)(raw_near_mag_q15 - smoothed_near_mag_q15);
-    raw_near_mag_q15 = (int16_t)(near_mag_delta_q15 >> 4);
-    raw_near_mag_q15 += smoothed_near_mag_q15;
-    int16_t raw_near_leading_zeros = NormW16(raw_near_mag_q15);
-    if ((raw_near_mag_q15) & (-qDomainDiff > raw_near_leading_zeros)) {
-      g_yMagSmooth[i] = WORD16_MAX;
-    } else {
-      g_yMagSmooth[i] = qDomainDiff < 0 ? raw_near_mag_q15 * (1 << -qDomainDiff)
-                                             : raw_near_mag_q15 >> qDomainDiff;
-    }
-    // ここまでで、|Y_smooth|が計算できた。固定小数の計算を正しくやるために、かなり長いコードになっている
 
-    // 推定エコー比率を計算し、帯域ごとのマスク値 G(k) を決定
-    if (S_magGained == 0) {
-      G_mask[i] = ONE_Q14;
-    } else if (g_yMagSmooth[i] == 0) {
-      G_mask[i] = 0;
-    } else {
-      S_magGained += (uint32_t)(g_yMagSmooth[i] >> 1); // |S_gained|を計算
-      uint32_t echo_ratio_q14 = DivU32U16(S_magGained, (uint16_t)g_yMagSmooth[i]);
-
-      int32_t ratio_q14 = (int32_t)SHIFT_W32(echo_ratio_q14, resolutionDiff); //  |S_gained|  /  |Y_smooth|  に相当
-      if (ratio_q14 > ONE_Q14) {
-        G_mask[i] = 0;
-      } else if (ratio_q14 < 0) {
-        G_mask[i] = ONE_Q14;
-      } else {
-        G_mask[i] = ONE_Q14 - (int16_t)ratio_q14; // 1 からratioを引いている
-        if (G_mask[i] < 0) { // 負にならないようにする
-          G_mask[i] = 0;
-        }
-      }
-    }
-    if (G_mask[i]) {
-        numPosCoef++; // G_maskの、0ではない係数を数えておく
-    }
-  }
-  if (g_bypass_supmask) {
-    for (int i = 0; i < PART_LEN1; ++i) {
-      G_mask[i] = ONE_Q14;
-    }
-    numPosCoef = PART_LEN1;
-  }
-  // 抑圧マスクを 2 乗して、強いエコー帯域の減衰をさらに強調する。
-  // この部分を削除してもキャンセルはできるが、キャンセルが効き始める前のハウリングがひどくなる。  
-  for (int i = 0; i < PART_LEN1; i++) {
-    G_mask[i] = (int16_t)((G_mask[i] * G_mask[i]) >> 14);
-  }
-
-  // 中域帯域の平均ゲインを求め、残りの帯域が過剰に開かないよう上限値として使う。
-  // この部分を削除してもキャンセルはできるが、キャンセルが効き始める前のハウリングがひどくなる。
-  const int kMinPrefBand = 4;
-  const int kMaxPrefBand = 24;
-  int32_t avgG32 = 0;
-  for (int i = kMinPrefBand; i <= kMaxPrefBand; i++) {
-    avgG32 += (int32_t)G_mask[i];
-  }
-  avgG32 /= (kMaxPrefBand - kMinPrefBand + 1);
-
-  for (int i = kMaxPrefBand; i < PART_LEN1; i++) {
-    if (G_mask[i] > (int16_t)avgG32) {
-      G_mask[i] = (int16_t)avgG32;
-    }
+  // 定常雑音の抑圧ゲイン。11 で NLP 後のマスクに掛ける。
+  int16_t G_ns[PART_LEN1];
+  if constexpr (P.ns) {
+    UpdateNoiseSuppressionGain(Y_mag, G_ns);
   }
 
   // 最終出力を計算するがこのループの中に、 11と12が含まれる。
-  ComplexInt16 E_freq[PART_LEN2]; 
+  // マスクが全ビン 1 / 全ビン 0 になったかを記録し、13 の IFFT を省略できるか判断する。
+  bool mask_all_unity = true;
+  bool mask_all_zero = true;
   for (int i = 0; i < PART_LEN1; i++) { // ビンごとに
     // 11. NLP
     if (G_mask[i] > NLP_COMP_HIGH) { // 1を越えないようにする
@@ -783,10 +1075,8 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
     }
 
     // G_maskで非0の係数が3個未満だったらそのビンはバッサリ0にする(非線形)
-    int16_t nlpGain = (numPosCoef < 3) ? 0 : ONE_Q14; 
-    if (g_bypass_nlp) { 
-      nlpGain = ONE_Q14; // パススルーのテストを素路時はnlpGainはいつも1にする
-    }
+    // NLP 無効時は nlpGain をいつも 1 にする
+    const int16_t nlpGain = (P.nlp && numPosCoef < 3) ? 0 : ONE_Q14;
 
     int16_t sup_gain_q14 = G_mask[i];
     // 抑圧マスクとNLPゲインを掛け合わせ、実際に適用する抑圧ゲインを確定する。
@@ -795,180 +1085,703 @@ int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_bloc
     } else {
       G_mask[i] = (int16_t)((G_mask[i] * nlpGain) >> 14);
     }
+    if constexpr (P.ns) {
+      G_mask[i] = (int16_t)((G_mask[i] * G_ns[i]) >> 14);
+    }
     
-    // 12. エコー抑圧済み信号を生成
-    // MUL_16_16 はかけ算をする関数。 G_mask と Y_freqを掛けている。つまり E = G_mask * Y
-    // Eは、エコーキャンセラの最終出力の誤差信号の周波数表現。これはスペクトルではなく位相を含むので複素数の配列。
-    E_freq[i].real = (int16_t)(MUL_16_16_RSFT_WITH_ROUND(Y_freq[i].real, G_mask[i], 14));
-    E_freq[i].imag = (int16_t)(MUL_16_16_RSFT_WITH_ROUND(Y_freq[i].imag, G_mask[i], 14));
+    mask_all_unity &= (G_mask[i] == ONE_Q14);
+    mask_all_zero &= (G_mask[i] == 0);
 
     // デバッグ出力用の計測
-    double gain_normalized = static_cast<double>(G_mask[i]) / static_cast<double>(ONE_Q14);
-    sum_gain += gain_normalized;
+    if constexpr (P.stats_level >= 2) {
+      double gain_normalized = static_cast<double>(G_mask[i]) / static_cast<double>(ONE_Q14);
+      sum_gain += gain_normalized;
+
+      double sup_gain = static_cast<double>(sup_gain_q14) / static_cast<double>(ONE_Q14);
+      double final_gain = gain_normalized;
+      double y_real = static_cast<double>(Y_freq[i].real);
+      double y_imag = static_cast<double>(Y_freq[i].imag);
+      double mag_sq = y_real * y_real + y_imag * y_imag;
+      freq_input_block += mag_sq;
+
+      double energy_after_sup = mag_sq * sup_gain * sup_gain;
+      double energy_after_final = mag_sq * final_gain * final_gain;
+      double removed_sup = mag_sq - energy_after_sup;
+      double removed_nlp = energy_after_sup - energy_after_final;
+      if (removed_sup < 0.0) {
+        removed_sup = 0.0;
+      }
+      if (removed_nlp < 0.0) {
+        removed_nlp = 0.0;
+      }
+      mask_removed_block += removed_sup;
+      nlp_removed_block += removed_nlp;
+      actual_after_block += energy_after_final;
+      if (final_gain < min_final_gain) {
+        min_final_gain = final_gain;
+      }
+    }
+  }
+
+  if constexpr (P.stats_level >= 2) {
+    double switch_after_block = freq_input_block * min_final_gain * min_final_gain;
+
+    // デバッグ出力
+    double avg_gain = sum_gain / PART_LEN1;
+    double suppression_db;
+    if (avg_gain <= 0.0) avg_gain = 0.0;
+    double clamped_gain = avg_gain;
+    const double kMinGain = 1e-3;
+    if (clamped_gain < kMinGain) clamped_gain = kMinGain;
+    suppression_db = 20.0 * log10(clamped_gain);
+
+    AecmDebugStats& stats = g_aecm->stats;
+    stats.dbg_sup_counter++;
+    if (!stats.initialized || suppression_db < stats.best_db) {
+        stats.best_db = suppression_db;
+        stats.best_gain = clamped_gain;
+        stats.initialized = 1;
+    }
+    if (stats.dbg_sup_counter % 100 == 0) {
+        stats.pending_suppression_log = 1;
+    }
+
+    stats.suppression_freq_input_energy += freq_input_block;
+    stats.suppression_freq_mask_removed += mask_removed_block;
+    stats.suppression_freq_nlp_removed += nlp_removed_block;
+    stats.suppression_freq_actual_energy += actual_after_block;
+    stats.suppression_freq_switch_energy += switch_after_block;
+  }
+
+  // 自動利得制御のゲイン（Q12）。マスク確定後の G_mask * |Y| からレベルを測り、12 で E にまとめて掛ける。
+  int32_t agc_gain_q12 = AGC_UNITY_Q12;
+  if constexpr (P.agc) {
+    agc_gain_q12 = UpdateAutoGainControl(Y_mag, G_mask);
+  }
 
-    double sup_gain = static_cast<double>(sup_gain_q14) / static_cast<double>(ONE_Q14);
-    double final_gain = gain_normalized;
-    double y_real = static_cast<double>(Y_freq[i].real);
-    double y_imag = static_cast<double>(Y_freq[i].imag);
-    double mag_sq = y_real * y_real + y_imag * y_imag;
-    freq_input_block += mag_sq;
+  // 12. エコー抑圧済み信号を生成
+  // MUL_16_16 はかけ算をする関数。 G_mask と Y_freqを掛けている。つまり E = G_mask * Y
+  // Eは、エコーキャンセラの最終出力の誤差信号の周波数表現。これはスペクトルではなく位相を含むので複素数の配列。
+  // G_mask が全ビン 1 なら丸め込みの乗算結果は Y そのものなので、Y_freq をそのまま E として使う。
+  const bool gain_only = (g_aecm->loadShedLevel >= 4);
+  const bool agc_unity = (agc_gain_q12 == AGC_UNITY_Q12);
+  ComplexInt16 E_freq[PART_LEN2];
+  const ComplexInt16* E_src = Y_freq;
+  if ((!mask_all_unity || !agc_unity) && !mask_all_zero && !gain_only) {
+    ApplyMaskToSpectrum(Y_freq, G_mask, agc_gain_q12, E_freq);
+    E_src = E_freq;
+  }
 
-    double energy_after_sup = mag_sq * sup_gain * sup_gain;
-    double energy_after_final = mag_sq * final_gain * final_gain;
-    double removed_sup = mag_sq - energy_after_sup;
-    double removed_nlp = energy_after_sup - energy_after_final;
-    if (removed_sup < 0.0) {
-      removed_sup = 0.0;
+  // 13. 出力
+  if (deferred && deferred->spectrum) {
+    // 周波数領域の出力。全ビン 0・広帯域ゲインの省略はせず、E をそのまま返す（合成は SynthesizeSpectrumBlock）。
+    AecmSpectrumBlock* spectrum = deferred->spectrum;
+    if (gain_only && (!mask_all_unity || !agc_unity) && !mask_all_zero) {
+      ApplyMaskToSpectrum(Y_freq, G_mask, agc_gain_q12, E_freq);
+      E_src = E_freq;
+    }
+    for (int i = 0; i < PART_LEN1; i++) {
+      spectrum->E[2 * i] = mask_all_zero ? 0 : E_src[i].real;
+      spectrum->E[2 * i + 1] = mask_all_zero ? 0 : E_src[i].imag;
     }
-    if (removed_nlp < 0.0) {
-      removed_nlp = 0.0;
+    memcpy(spectrum->X_mag, X_mag_aligned, sizeof(spectrum->X_mag));
+    memcpy(spectrum->Y_mag, Y_mag, sizeof(spectrum->Y_mag));
+    memcpy(spectrum->G_mask, G_mask, sizeof(spectrum->G_mask));
+    spectrum->fft_scale_shift = PART_LEN_SHIFT;
+  } else if (deferred) {
+    // 合成を後回しにする。オーバーラップ加算は呼び出し側がブロック順に行う。
+    deferred->needs_ifft = false;
+    if (mask_all_zero) {
+      memset(deferred->current, 0, sizeof(deferred->current));
+      memset(deferred->overlap, 0, sizeof(deferred->overlap));
+    } else if (gain_only) {
+      BroadbandGainSynthesis(G_mask, agc_gain_q12, deferred->current, deferred->overlap);
+    } else {
+      deferred->needs_ifft = true;
+      memcpy(deferred->E, E_src, sizeof(deferred->E));
+    }
+  } else if constexpr (P.agc) {
+    // 自動利得制御: 今回の前半と次へのオーバーラップを求め、オーバーラップ加算をリミッタに通す。
+    int16_t current[PART_LEN];
+    int16_t overlap[PART_LEN];
+    if (mask_all_zero) {
+      memset(current, 0, sizeof(current));
+      memset(overlap, 0, sizeof(overlap));
+    } else if (gain_only) {
+      BroadbandGainSynthesis(G_mask, agc_gain_q12, current, overlap);
+    } else {
+      // 空のオーバーラップ領域で合成すると、current には SAT(今回の前半)、overlap には今回の後半が入る
+      memset(overlap, 0, sizeof(overlap));
+      g_kernels.inverse_fft_overlap_add(E_src, kSqrtHanning, overlap, current);
+    }
+    LimitedOverlapAdd(current, overlap, e_block);
+  } else if (mask_all_zero) {
+    // E = 0 の IFFT は全サンプル 0 になるので、前ブロックのオーバーラップ分を
+    // そのまま出力し、オーバーラップ保存領域を空にするだけでよい。
+    memcpy(e_block, g_aecm->eOverlapBuf, sizeof(int16_t) * PART_LEN);
+    memset(g_aecm->eOverlapBuf, 0, sizeof(g_aecm->eOverlapBuf));
+  } else if (gain_only) {
+    int16_t current[PART_LEN];
+    int16_t overlap[PART_LEN];
+    BroadbandGainSynthesis(G_mask, AGC_UNITY_Q12, current, overlap);
+    for (int i = 0; i < PART_LEN; ++i) {
+      int32_t overlap_sum = current[i] + g_aecm->eOverlapBuf[i];
+      e_block[i] = (int16_t)SAT(WORD16_MAX, overlap_sum, WORD16_MIN);
+      g_aecm->eOverlapBuf[i] = overlap[i];
+    }
+  } else {
+    // 全ビン 1 の場合も固定小数 FFT の往復は恒等変換にならないため、IFFT は省略しない。
+    // 逆 FFT・合成窓・オーバーラップ加算は 1 つのカーネルで行う。
+    g_kernels.inverse_fft_overlap_add(E_src, kSqrtHanning, g_aecm->eOverlapBuf, e_block);
+  }
+
+  if constexpr (P.stats_level >= 2) {
+    AecmDebugStats& stats = g_aecm->stats;
+    // サプレッサ適用前後のブロックエネルギーを測定
+    int64_t input_energy_block = 0;
+    int64_t output_energy_block = 0;
+    for (int i = 0; e_block && i < PART_LEN; ++i) {
+      int32_t y_val = y_block[i];
+      int32_t e_val = e_block[i];
+      input_energy_block += (int64_t)y_val * y_val;
+      output_energy_block += (int64_t)e_val * e_val;
     }
-    mask_removed_block += removed_sup;
-    nlp_removed_block += removed_nlp;
-    actual_after_block += energy_after_final;
-    if (final_gain < min_final_gain) {
-      min_final_gain = final_gain;
+
+    stats.suppression_input_energy += static_cast<double>(input_energy_block);
+    stats.suppression_output_energy += static_cast<double>(output_energy_block);
+
+    if (stats.pending_suppression_log) {
+        double total_input_energy = stats.suppression_input_energy;
+        double total_output_energy = stats.suppression_output_energy;
+        double removed_energy = total_input_energy - total_output_energy;
+        if (removed_energy < 0.0) {
+          removed_energy = 0.0;
+        }
+        double removal_ratio = 0.0;
+        if (total_input_energy > 0.0) {
+          removal_ratio = (removed_energy / total_input_energy) * 100.0;
+        }
+        double freq_total_input = stats.suppression_freq_input_energy;
+        double freq_mask_removed = stats.suppression_freq_mask_removed;
+        double freq_nlp_removed = stats.suppression_freq_nlp_removed;
+        double freq_mask_ratio = 0.0;
+        double freq_nlp_ratio = 0.0;
+        double survival_actual = 0.0;
+        double survival_switch = 0.0;
+        if (freq_total_input > 0.0) {
+          freq_mask_ratio = (freq_mask_removed / freq_total_input) * 100.0;
+          freq_nlp_ratio = (freq_nlp_removed / freq_total_input) * 100.0;
+          survival_actual = (stats.suppression_freq_actual_energy / freq_total_input) * 100.0;
+          survival_switch = (stats.suppression_freq_switch_energy / freq_total_input) * 100.0;
+        }
+        fprintf(stderr,
+                "[Suppression] window=%d avg_gain=%.3f (%.1f dB) removed=%.2e (%.1f%%) mask=%.2e (%.1f%%) nlp=%.2e (%.1f%%) survival=%.1f%% switch=%.1f%%%s%s\n",
+                stats.dbg_sup_counter,
+                stats.best_gain,
+                stats.best_db,
+                removed_energy,
+                removal_ratio,
+                freq_mask_removed,
+                freq_mask_ratio,
+                freq_nlp_removed,
+                freq_nlp_ratio,
+                survival_actual,
+                survival_switch,
+                P.supmask ? "" : " supmask-off",
+                P.nlp ? "" : " nlp-off");
+
+        stats.suppression_input_energy = 0.0;
+        stats.suppression_output_energy = 0.0;
+        stats.suppression_freq_input_energy = 0.0;
+        stats.suppression_freq_mask_removed = 0.0;
+        stats.suppression_freq_nlp_removed = 0.0;
+        stats.suppression_freq_actual_energy = 0.0;
+        stats.suppression_freq_switch_energy = 0.0;
+        stats.pending_suppression_log = 0;
+        stats.initialized = 0;
     }
   }
 
-  double switch_after_block = freq_input_block * min_final_gain * min_final_gain;
+  // 次ブロックで使用するため、最新フレームの後半を先頭へシフト
+  memcpy(g_aecm->yBuf, g_aecm->yBuf + PART_LEN, sizeof(int16_t) * PART_LEN);
+
 
   // デバッグ出力
-  double avg_gain = sum_gain / PART_LEN1;
-  double suppression_db;
-  if (avg_gain <= 0.0) avg_gain = 0.0;
-  double clamped_gain = avg_gain;
-  const double kMinGain = 1e-3;
-  if (clamped_gain < kMinGain) clamped_gain = kMinGain;
-  suppression_db = 20.0 * log10(clamped_gain);
-
-  static int dbg_sup_counter = 0;
-  static double best_gain = 1.0;
-  static double best_db = 0.0;
-  static int initialized = 0;
-  static int pending_suppression_log = 0;
-  static double suppression_freq_input_energy = 0.0;
-  static double suppression_freq_mask_removed = 0.0;
-  static double suppression_freq_nlp_removed = 0.0;
-  static double suppression_freq_actual_energy = 0.0;
-  static double suppression_freq_switch_energy = 0.0;
-  dbg_sup_counter++;
-  if (!initialized || suppression_db < best_db) {
-      best_db = suppression_db;
-      best_gain = clamped_gain;
-      initialized = 1;
-  }
-  if (dbg_sup_counter % 100 == 0) {
-      pending_suppression_log = 1;
-  }
-
-  suppression_freq_input_energy += freq_input_block;
-  suppression_freq_mask_removed += mask_removed_block;
-  suppression_freq_nlp_removed += nlp_removed_block;
-  suppression_freq_actual_energy += actual_after_block;
-  suppression_freq_switch_energy += switch_after_block;
+  if constexpr (P.stats_level >= 1) {
+    AecmDebugStats& stats = g_aecm->stats;
+    stats.dbg_ss_counter++;
+    if (stats.dbg_ss_counter % 100 == 0) {
+        fprintf(stderr, "[AECM] block=%d startupState=%d est_delay=%d\n",
+                stats.dbg_ss_counter, (int)g_aecm->startupState, delay);
+    }
+  }
 
+  return 0;
+}
 
-  // 13. 出力
-  int16_t fft[PART_LEN4 + 2];
-  int16_t time_current[PART_LEN];
-  int16_t time_overlap[PART_LEN];
-  InverseFFTAndWindow(fft,
-                      E_freq,
-                      PART_LEN,
-                      PART_LEN2,
-                      kSqrtHanning,
-                      time_current,
-                      time_overlap);
+// 全構成の ProcessBlockImpl を並べた表。添字のビットが構成に対応する。
+// bit0: supmask, bit1: nlp, bit2: delay_decimated, bit3: ns, bit4: agc, bit5 以上: stats_level
+static constexpr PipelinePolicy PolicyFromIndex(int index) {
+  return PipelinePolicy{(index & 1) != 0, (index & 2) != 0, (index & 4) != 0, index >> 5, (index & 8) != 0,
+                        (index & 16) != 0};
+}
 
-  for (int i = 0; i < PART_LEN; ++i) {
-    int32_t overlap_sum = (int32_t)time_current[i] + g_eOverlapBuf[i];
-    e_block[i] = (int16_t)SAT(WORD16_MAX, overlap_sum, WORD16_MIN);
-    g_eOverlapBuf[i] = time_overlap[i];
+typedef int (*ProcessBlockFn)(const AecmFarBlock*, const AecmNearBlock*, const int16_t*, int16_t*, AecmOutputBlock*);
+
+template <size_t... I>
+static constexpr std::array<ProcessBlockFn, sizeof...(I)> MakeProcessBlockTable(std::index_sequence<I...>) {
+  return {{&ProcessBlockImpl<PolicyFromIndex((int)I)>...}};
+}
+
+static constexpr std::array<ProcessBlockFn, 3 * 32> kProcessBlockTable =
+    MakeProcessBlockTable(std::make_index_sequence<3 * 32>());
+
+// 整列済みの遠端で処理する ProcessAlignedImpl の表（ProcessAlignedBlock）。添字は上と同じ。
+typedef int (*ProcessAlignedFn)(const uint16_t*, int, const AecmNearBlock*, const int16_t*, int16_t*, AecmOutputBlock*);
+
+template <size_t... I>
+static constexpr std::array<ProcessAlignedFn, sizeof...(I)> MakeProcessAlignedTable(std::index_sequence<I...>) {
+  return {{&ProcessAlignedImpl<PolicyFromIndex((int)I)>...}};
+}
+
+static constexpr std::array<ProcessAlignedFn, 3 * 32> kProcessAlignedTable =
+    MakeProcessAlignedTable(std::make_index_sequence<3 * 32>());
+
+// 全インスタンス共通の設定から決まるテーブルの添字。遅延推定の間引き（bit 2）は
+// インスタンスごとの負荷軽減レベルで決まるので、呼び出しのたびに足す。
+// 処理中の別スレッドは呼び出しのたびにこの値を読むだけで、関数ポインタを共有して書き換えることはない。
+// 初期値は supmask/NLP 有効、統計はすべて出力。
+static std::atomic<int> g_pipelineIndex{(2 << 5) | 2 | 1};
+
+// 設定が変わったときだけ（g_settingsMutex を持って）呼ばれ、全インスタンス共通の添字を作り直す。
+static void SelectPipeline() {
+  int index = g_statsLevel << 5;
+  if (!g_bypass_supmask) index |= 1;
+  if (!g_bypass_nlp) index |= 2;
+  if (g_nsLevel > 0) index |= 8;
+  if (g_agcTargetDbfs != 0) index |= 16;
+  g_pipelineIndex = index;
+}
+
+// 選択中のインスタンスで実行する ProcessBlockImpl / ProcessAlignedImpl
+static inline int PipelineIndex() {
+  return g_pipelineIndex.load(std::memory_order_relaxed) | (g_aecm->loadShedLevel >= 2 ? 4 : 0);
+}
+
+static inline ProcessBlockFn SelectedProcessBlock() {
+  return kProcessBlockTable[PipelineIndex()];
+}
+
+static inline ProcessAlignedFn SelectedProcessAligned() {
+  return kProcessAlignedTable[PipelineIndex()];
+}
+
+// 遠端・近端を xBuf / yBuf の後半に置いてから呼ぶ
+static int ProcessStagedBlock(int16_t* e_block) {
+  AecmFarBlock far;
+  AnalyzeFarBlock(&far);
+  AecmNearBlock near;
+  AnalyzeNearBlock(g_aecm->yBuf, &near);
+  return SelectedProcessBlock()(&far, &near, g_aecm->yBuf + PART_LEN, e_block, NULL);
+}
+
+int ProcessBlock(const int16_t* x_block, const int16_t* y_block, int16_t* e_block) {
+  StageFarBlock(x_block);
+  StageNearBlock(y_block);
+  return ProcessStagedBlock(e_block);
+}
+
+int ProcessBlockSpectrum(const int16_t* farend, const int16_t* nearend, AecmSpectrumBlock* spectrum) {
+  StageFarBlock(farend);
+  StageNearBlock(nearend);
+  AecmFarBlock far;
+  AnalyzeFarBlock(&far);
+  AecmNearBlock near;
+  AnalyzeNearBlock(g_aecm->yBuf, &near);
+  AecmOutputBlock output;
+  output.spectrum = spectrum;
+  return SelectedProcessBlock()(&far, &near, g_aecm->yBuf + PART_LEN, NULL, &output);
+}
+
+void SynthesizeSpectrumBlock(const AecmSpectrumBlock* spectrum, int16_t* out) {
+  ComplexInt16 E_freq[PART_LEN1];
+  for (int i = 0; i < PART_LEN1; i++) {
+    E_freq[i].real = spectrum->E[2 * i];
+    E_freq[i].imag = spectrum->E[2 * i + 1];
+  }
+  if (g_agcTargetDbfs != 0) {
+    AecmOutputBlock output;
+    memset(output.overlap, 0, sizeof(output.overlap));
+    g_kernels.inverse_fft_overlap_add(E_freq, kSqrtHanning, output.overlap, output.current);
+    OverlapAddOutputBlock(&output, out);
+    return;
   }
+  g_kernels.inverse_fft_overlap_add(E_freq, kSqrtHanning, g_aecm->eOverlapBuf, out);
+}
 
-  // サプレッサ適用前後のブロックエネルギーを測定
-  int64_t input_energy_block = 0;
-  int64_t output_energy_block = 0;
-  for (int i = 0; i < PART_LEN; ++i) {
-    int32_t y_val = y_block[i];
-    int32_t e_val = e_block[i];
-    input_energy_block += (int64_t)y_val * y_val;
-    output_energy_block += (int64_t)e_val * e_val;
-  }
-
-  static double suppression_input_energy = 0.0;
-  static double suppression_output_energy = 0.0;
-  suppression_input_energy += static_cast<double>(input_energy_block);
-  suppression_output_energy += static_cast<double>(output_energy_block);
-
-  if (pending_suppression_log) {
-      double total_input_energy = suppression_input_energy;
-      double total_output_energy = suppression_output_energy;
-      double removed_energy = total_input_energy - total_output_energy;
-      if (removed_energy < 0.0) {
-        removed_energy = 0.0;
-      }
-      double removal_ratio = 0.0;
-      if (total_input_energy > 0.0) {
-        removal_ratio = (removed_energy / total_input_energy) * 100.0;
+int ProcessBlockPcm(const AecmPcmBuffer* farend, const AecmPcmBuffer* nearend, const AecmPcmBuffer* out) {
+  if (!IsValidPcmBuffer(farend) || !IsValidPcmBuffer(nearend) || !IsValidPcmBuffer(out)) {
+    return -1;
+  }
+  StagePcmBlock(farend, g_aecm->xBuf + PART_LEN);
+  StagePcmBlock(nearend, g_aecm->yBuf + PART_LEN);
+  int16_t e_block[PART_LEN];
+  const int ret = ProcessStagedBlock(e_block);
+  WritePcmBlock(e_block, out);
+  return ret;
+}
+
+int ProcessTransformedBlock(AecmFarBlock* far, const uint16_t* X_mag, const AecmNearBlock* near,
+                            const int16_t* y_block, int16_t* e_block, AecmOutputBlock* deferred) {
+  far->binary = BinarizeFarSpectrum(X_mag);
+  StageNearBlock(y_block);
+  if (deferred) {
+    deferred->spectrum = NULL;
+  }
+  return SelectedProcessBlock()(far, near, y_block, e_block, deferred);
+}
+
+bool CanDeferOutput() {
+  return g_statsLevel < 2;
+}
+
+void SynthesizeOutputBlock(AecmOutputBlock* deferred) {
+  if (!deferred->needs_ifft) {
+    return;
+  }
+  // 空のオーバーラップ領域で合成すると、出力は SAT(今回の前半) = 今回の前半、領域には今回の後半が残る
+  memset(deferred->overlap, 0, sizeof(deferred->overlap));
+  g_kernels.inverse_fft_overlap_add(deferred->E, kSqrtHanning, deferred->overlap, deferred->current);
+}
+
+int ProcessBlocks(const int16_t* farend, const int16_t* nearend, int16_t* out, int nblocks) {
+  AecmFarBlock far[AECM_BATCH_BLOCKS];
+  AecmNearBlock near[AECM_BATCH_BLOCKS];
+  int ret = 0;
+  for (int first = 0; first < nblocks; first += AECM_BATCH_BLOCKS) {
+    const int count = MIN(AECM_BATCH_BLOCKS, nblocks - first);
+
+    // 解析段: 入力サンプルだけで決まる窓掛け・FFT・|X|・|Y|・遠端の2値化を、まとめて先に行う。
+    // 近端の窓は直前と今回のブロックにまたがるので、入力配列の中ならそこから直接変換する。
+    for (int k = 0; k < count; k++) {
+      const int n = first + k;
+      StageFarBlock(farend + n * BLOCK_LEN);
+      AnalyzeFarBlock(&far[k]);
+      if (n == 0) {
+        StageNearBlock(nearend);
+        AnalyzeNearBlock(g_aecm->yBuf, &near[k]);
+      } else {
+        AnalyzeNearBlock(nearend + (n - 1) * BLOCK_LEN, &near[k]);
       }
-      double freq_total_input = suppression_freq_input_energy;
-      double freq_mask_removed = suppression_freq_mask_removed;
-      double freq_nlp_removed = suppression_freq_nlp_removed;
-      double freq_mask_ratio = 0.0;
-      double freq_nlp_ratio = 0.0;
-      double survival_actual = 0.0;
-      double survival_switch = 0.0;
-      if (freq_total_input > 0.0) {
-        freq_mask_ratio = (freq_mask_removed / freq_total_input) * 100.0;
-        freq_nlp_ratio = (freq_nlp_removed / freq_total_input) * 100.0;
-        survival_actual = (suppression_freq_actual_energy / freq_total_input) * 100.0;
-        survival_switch = (suppression_freq_switch_energy / freq_total_input) * 100.0;
+    }
+
+    // 逐次段: 遅延推定・整列・適応・抑圧・IFFT をブロック順に行う
+    for (int k = 0; k < count; k++) {
+      const int n = first + k;
+      StageNearBlock(nearend + n * BLOCK_LEN);
+      if (SelectedProcessBlock()(&far[k], &near[k], nearend + n * BLOCK_LEN, out + n * BLOCK_LEN, NULL) != 0) {
+        ret = -1;
       }
-      fprintf(stderr,
-              "[Suppression] window=%d avg_gain=%.3f (%.1f dB) removed=%.2e (%.1f%%) mask=%.2e (%.1f%%) nlp=%.2e (%.1f%%) survival=%.1f%% switch=%.1f%%%s%s\n",
-              dbg_sup_counter,
-              best_gain,
-              best_db,
-              removed_energy,
-              removal_ratio,
-              freq_mask_removed,
-              freq_mask_ratio,
-              freq_nlp_removed,
-              freq_nlp_ratio,
-              survival_actual,
-              survival_switch,
-              g_bypass_supmask ? " supmask-off" : "",
-              g_bypass_nlp ? " nlp-off" : "");
-
-      suppression_input_energy = 0.0;
-      suppression_output_energy = 0.0;
-      suppression_freq_input_energy = 0.0;
-      suppression_freq_mask_removed = 0.0;
-      suppression_freq_nlp_removed = 0.0;
-      suppression_freq_actual_energy = 0.0;
-      suppression_freq_switch_energy = 0.0;
-      pending_suppression_log = 0;
-      initialized = 0;
+    }
   }
+  return ret;
+}
 
-  // 次ブロックで使用するため、最新フレームの後半を先頭へシフト
-  memcpy(g_xBuf, g_xBuf + PART_LEN, sizeof(int16_t) * PART_LEN);
-  memcpy(g_yBuf, g_yBuf + PART_LEN, sizeof(int16_t) * PART_LEN);
+// キューが空のときに使う無音の遠端ブロック（|X| がすべて 0、2値スペクトルも 0）
+static constexpr AecmFarBlock kSilentFarBlock = {};
+
+// 遠端を xBuf の後半に置いてから呼ぶ
+static int QueueStagedFarBlock() {
+  void* slot = NULL;
+  void* unused_ptr = NULL;
+  size_t slot_bytes = 0;
+  size_t unused_bytes = 0;
+  if (GetSpscBufferWriteRegions(&g_aecm->farQueue, 1, &slot, &slot_bytes, &unused_ptr, &unused_bytes) == 0) {
+    g_aecm->farQueueOverflows++;
+    return -1;
+  }
+  // キューの枠へ直接書き、書き終えてから収録側へ公開する
+  AnalyzeFarBlock(static_cast<AecmFarBlock*>(slot));
+  MoveSpscWritePtr(&g_aecm->farQueue, 1);
+  return 0;
+}
 
+int ProcessRenderBlock(const int16_t* farend) {
+  StageFarBlock(farend);
+  return QueueStagedFarBlock();
+}
 
-  // デバッグ出力
-  static int dbg_ss_counter = 0;
-  dbg_ss_counter++;
-  if (dbg_ss_counter % 100 == 0) {
-      fprintf(stderr, "[AECM] block=%d startupState=%d est_delay=%d\n",
-              dbg_ss_counter, (int)g_startupState, delay);
+int ProcessRenderBlockPcm(const AecmPcmBuffer* farend) {
+  if (!IsValidPcmBuffer(farend)) {
+    return -1;
   }
+  StagePcmBlock(farend, g_aecm->xBuf + PART_LEN);
+  return QueueStagedFarBlock();
+}
 
-  return 0;
+// 近端を yBuf の後半に置いてから呼ぶ
+static int CaptureStagedBlock(int16_t* out) {
+  void* slot = NULL;
+  void* unused_ptr = NULL;
+  size_t slot_bytes = 0;
+  size_t unused_bytes = 0;
+  const bool queued =
+      GetSpscBufferReadRegions(&g_aecm->farQueue, 1, &slot, &slot_bytes, &unused_ptr, &unused_bytes) != 0;
+  const AecmFarBlock* far = &kSilentFarBlock;
+  if (queued) {
+    far = static_cast<const AecmFarBlock*>(slot);
+  } else {
+    g_aecm->farQueueUnderruns++;
+  }
+  AecmNearBlock near;
+  AnalyzeNearBlock(g_aecm->yBuf, &near);
+  const int ret = SelectedProcessBlock()(far, &near, g_aecm->yBuf + PART_LEN, out, NULL);
+  if (queued) {
+    // 処理が終わってから枠を再生側へ返す
+    MoveSpscReadPtr(&g_aecm->farQueue, 1);
+  }
+  return ret;
+}
+
+int ProcessCaptureBlock(const int16_t* nearend, int16_t* out) {
+  StageNearBlock(nearend);
+  return CaptureStagedBlock(out);
+}
+
+int ProcessCaptureBlockPcm(const AecmPcmBuffer* nearend, const AecmPcmBuffer* out) {
+  if (!IsValidPcmBuffer(nearend) || !IsValidPcmBuffer(out)) {
+    return -1;
+  }
+  StagePcmBlock(nearend, g_aecm->yBuf + PART_LEN);
+  int16_t e_block[PART_LEN];
+  const int ret = CaptureStagedBlock(e_block);
+  WritePcmBlock(e_block, out);
+  return ret;
+}
+
+void GetRenderQueueStats(AecmRenderQueueStats* stats) {
+  stats->queued = (int)spsc_available_read(&g_aecm->farQueue);
+  stats->overflows = g_aecm->farQueueOverflows;
+  stats->underruns = g_aecm->farQueueUnderruns;
 }
 
 int GetLastEstimatedDelay() {
-  return g_last_estimated_delay_blocks;
+  return g_aecm->last_estimated_delay_blocks;
+}
+
+void ShareFarState(const AecmState* source) {
+  g_aecm->farSource = source;
+  g_aecm->delay_near.binary_handle.farend =
+      const_cast<BinaryDelayEstimatorFarend*>(&(source ? source : g_aecm)->delay_farend.binary_farend);
+}
+
+int ProcessSharedFarBlock(const int16_t* nearend, int16_t* out) {
+  AecmNearBlock near;
+  StageNearBlock(nearend);
+  AnalyzeNearBlock(g_aecm->yBuf, &near);
+  // 遠端の解析結果は読まれない（履歴は farSource から読む）
+  return SelectedProcessBlock()(&kSilentFarBlock, &near, nearend, out, NULL);
+}
+
+void AnalyzeCaptureBlock(const int16_t* nearend, AecmNearBlock* near) {
+  StageNearBlock(nearend);
+  AnalyzeNearBlock(g_aecm->yBuf, near);
+}
+
+int AnalyzeRenderChannel(const int16_t* farend, const uint16_t* Y_mag, uint16_t* X_mag_aligned) {
+  AecmFarBlock far;
+  StageFarBlock(farend);
+  AnalyzeFarBlock(&far);
+  const bool decimated = g_aecm->loadShedLevel >= 2 && (g_aecm->totCount % LOAD_SHED_DELAY_INTERVAL) != 0;
+  g_aecm->totCount++;
+  const uint16_t* aligned;
+  uint16_t decoded[PART_LEN1];
+  const int delay = PushAndAlignFar(&far, Y_mag, decimated, &aligned, decoded);
+  if (delay < 0) {
+    memset(X_mag_aligned, 0, sizeof(uint16_t) * PART_LEN1);
+    return -1;
+  }
+  memcpy(X_mag_aligned, aligned, sizeof(uint16_t) * PART_LEN1);
+  return delay;
+}
+
+int ProcessFarSpectrumBlock(ComplexInt16* X_freq, const int16_t* nearend, int16_t* out) {
+  AecmFarBlock far;
+  uint16_t X_mag_buf[PART_LEN1];
+  far.binary = BinarizeFarSpectrum(FarSpectrumToEntry(X_freq, &far, X_mag_buf));
+  AecmNearBlock near;
+  StageNearBlock(nearend);
+  AnalyzeNearBlock(g_aecm->yBuf, &near);
+  return SelectedProcessBlock()(&far, &near, g_aecm->yBuf + PART_LEN, out, NULL);
+}
+
+int ProcessAlignedBlock(const uint16_t* X_mag_aligned, int delay, const AecmNearBlock* near, int16_t* out) {
+  UpdateStartupState();
+  g_aecm->last_estimated_delay_blocks = delay;
+  return SelectedProcessAligned()(X_mag_aligned, delay, near, g_aecm->yBuf + PART_LEN, out, NULL);
+}
+
+void CopyAecmState(AecmState* dst, const AecmState* src) {
+  // キュー（std::atomic の位置を含む）より前とデバッグ統計だけを写す
+  memcpy((void*)dst, (const void*)src, offsetof(AecmState, farQueueOverflows));
+  dst->stats = src->stats;
+  // インスタンスの中を指すポインタとキューを dst のものに直す（遠端を共有していれば共有元のまま）
+  dst->delay_near.binary_handle.farend =
+      const_cast<BinaryDelayEstimatorFarend*>(&(dst->farSource ? dst->farSource : dst)->delay_farend.binary_farend);
+  InitSpscBufferWith(&dst->farQueue, dst->farQueueData, AECM_FAR_QUEUE_LEN, sizeof(AecmFarBlock));
+  dst->farQueueOverflows = 0;
+  dst->farQueueUnderruns = 0;
+}
+
+// チェックポイントの見出し。ビルドの違い（ブロック長・サンプリング周波数・履歴の形式・状態の並び）を戻す前に検出する。
+struct AecmCheckpointHeader {
+  uint32_t magic; // AECM_CHECKPOINT_MAGIC
+  uint32_t version; // AECM_CHECKPOINT_VERSION
+  uint32_t block_len;
+  uint32_t sample_rate_hz;
+  uint32_t compact_history;
+  uint32_t shared_far; // 1: 遠端を共有していた（ShareFarState）。自分の遠端スペクトル履歴を持たないので戻せない
+  uint64_t state_bytes; // 続く状態の大きさ
+};
+
+// 書き出すのは AecmState の先頭から遠端解析結果のキューの手前まで（hot / delay / history 区画と xBuf）。
+// キュー（std::atomic の位置と格納先）とデバッグ統計は書かず、戻すときはキューを空にする。
+// 範囲内のポインタ（farSource と遅延推定器の遠端履歴への参照）は書き出すときに 0 にし、戻すときに作り直す。
+static constexpr size_t kCheckpointStateBytes = offsetof(AecmState, farQueueOverflows);
+static constexpr size_t kCheckpointFarSourceOffset = offsetof(AecmState, farSource);
+static constexpr size_t kCheckpointFarendOffset = offsetof(AecmState, delay_near) +
+                                                  offsetof(DelayEstimator, binary_handle) +
+                                                  offsetof(BinaryDelayEstimator, farend);
+
+size_t GetAecmCheckpointSize() {
+  return sizeof(AecmCheckpointHeader) + kCheckpointStateBytes;
+}
+
+void SaveAecmCheckpoint(void* buffer) {
+  AecmCheckpointHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = AECM_CHECKPOINT_MAGIC;
+  header.version = AECM_CHECKPOINT_VERSION;
+  header.block_len = BLOCK_LEN;
+  header.sample_rate_hz = SAMPLE_RATE_HZ;
+  header.compact_history = AECM_COMPACT_HISTORY;
+  header.shared_far = (g_aecm->farSource != NULL);
+  header.state_bytes = kCheckpointStateBytes;
+  uint8_t* out = (uint8_t*)buffer;
+  memcpy(out, &header, sizeof(header));
+  uint8_t* state = out + sizeof(header);
+  memcpy(state, (const void*)g_aecm, kCheckpointStateBytes);
+  memset(state + kCheckpointFarSourceOffset, 0, sizeof(g_aecm->farSource));
+  memset(state + kCheckpointFarendOffset, 0, sizeof(g_aecm->delay_near.binary_handle.farend));
+}
+
+int RestoreAecmCheckpoint(const void* buffer, size_t size) {
+  if (size != GetAecmCheckpointSize()) {
+    return -1;
+  }
+  // buffer はバイト単位でしか読まないので、境界に揃っていなくてよい
+  AecmCheckpointHeader header;
+  memcpy(&header, buffer, sizeof(header));
+  if (header.magic != AECM_CHECKPOINT_MAGIC || header.version != AECM_CHECKPOINT_VERSION ||
+      header.block_len != BLOCK_LEN || header.sample_rate_hz != SAMPLE_RATE_HZ ||
+      header.compact_history != AECM_COMPACT_HISTORY || header.state_bytes != kCheckpointStateBytes ||
+      header.shared_far != 0) {
+    return -1;
+  }
+  memcpy((void*)g_aecm, (const uint8_t*)buffer + sizeof(header), kCheckpointStateBytes);
+  ShareFarState(NULL);
+  InitSpscBufferWith(&g_aecm->farQueue, g_aecm->farQueueData, AECM_FAR_QUEUE_LEN, sizeof(AecmFarBlock));
+  g_aecm->farQueueOverflows = 0;
+  g_aecm->farQueueUnderruns = 0;
+  return 0;
+}
+
+void HibernateAecm(AecmSleepState* sleep) {
+  const BinaryDelayEstimator& estimator = g_aecm->delay_near.binary_handle;
+  memcpy(sleep->HStored, g_aecm->HStored, sizeof(sleep->HStored));
+  sleep->farEnergyMin = g_aecm->farEnergyMin;
+  sleep->farEnergyMax = g_aecm->farEnergyMax;
+  sleep->farEnergyMaxMin = g_aecm->farEnergyMaxMin;
+  sleep->farEnergyVAD = g_aecm->farEnergyVAD;
+  sleep->farEnergyMSEThres = g_aecm->farEnergyMSEThres;
+  sleep->supGain = g_aecm->supGain;
+  sleep->startupState = g_aecm->startupState;
+  sleep->mseThreshold = g_aecm->mseThreshold;
+  sleep->totCount = g_aecm->totCount;
+  sleep->last_estimated_delay_blocks = g_aecm->last_estimated_delay_blocks;
+  sleep->last_delay = estimator.last_delay;
+  sleep->last_delay_probability = estimator.last_delay_probability;
+  sleep->minimum_probability = estimator.minimum_probability;
+  sleep->last_delay_histogram = estimator.last_delay_histogram;
+  sleep->delay_histogram = estimator.last_delay >= 0 ? estimator.histogram[estimator.last_delay] : 0.f;
+  sleep->farSource = g_aecm->farSource;
+}
+
+// 初期化後、保存チャネルとトラッカを戻す。適応チャネルは保存チャネルから作り直し（ResetAdaptiveChannel と同じ）、
+// 遅延推定器は確定していた遅延を比較基準に据えて、新しい候補が十分な根拠を得るまで維持する。
+void ResumeAecm(const AecmSleepState* sleep) {
+  InitAecm();
+  InitEchoPath(sleep->HStored);
+  g_aecm->mseThreshold = sleep->mseThreshold;
+  g_aecm->farEnergyMin = sleep->farEnergyMin;
+  g_aecm->farEnergyMax = sleep->farEnergyMax;
+  g_aecm->farEnergyMaxMin = sleep->farEnergyMaxMin;
+  g_aecm->farEnergyVAD = sleep->farEnergyVAD;
+  g_aecm->farEnergyMSEThres = sleep->farEnergyMSEThres;
+  g_aecm->supGain = sleep->supGain;
+  g_aecm->supGainOld = sleep->supGain;
+  g_aecm->startupState = sleep->startupState;
+  g_aecm->totCount = sleep->totCount;
+  g_aecm->firstVAD = (sleep->startupState == 0);
+  g_aecm->last_estimated_delay_blocks = sleep->last_estimated_delay_blocks;
+  // 遠端を共有していれば共有元の履歴をそのまま読む。自分の履歴は空なので埋まるまでトラッカを止める。
+  ShareFarState(sleep->farSource);
+  g_aecm->farTrackerHold = sleep->farSource ? 0 : MAX_DELAY;
+
+  BinaryDelayEstimator& estimator = g_aecm->delay_near.binary_handle;
+  estimator.last_delay = sleep->last_delay;
+  estimator.last_delay_probability = sleep->last_delay_probability;
+  estimator.minimum_probability = sleep->minimum_probability;
+  estimator.last_delay_histogram = sleep->last_delay_histogram;
+  if (sleep->last_delay >= 0) {
+    estimator.last_candidate_delay = sleep->last_delay;
+    estimator.compare_delay = sleep->last_delay;
+    estimator.histogram[sleep->last_delay] = sleep->delay_histogram;
+  }
+}
+
+// [offset, offset + bytes) が掛かるキャッシュラインの数
+static int CacheLinesSpanned(size_t offset, size_t bytes) {
+  return (int)((offset + bytes - 1) / AECM_CACHE_LINE - offset / AECM_CACHE_LINE + 1);
+}
+
+void GetAecmLayoutReport(AecmLayoutReport* report) {
+  const size_t delay_offset = offsetof(AecmState, delay_farend);
+  const size_t history_offset = offsetof(AecmState, xHistory);
+  const size_t render_offset = offsetof(AecmState, xBuf);
+  const size_t stats_offset = offsetof(AecmState, stats);
+  report->instance_bytes = sizeof(AecmState);
+  report->hot_bytes = delay_offset;
+  report->delay_bytes = history_offset - delay_offset;
+  report->history_bytes = render_offset - history_offset;
+  report->history_entry_bytes = sizeof(g_aecm->xHistory) / MAX_DELAY;
+  report->render_bytes = stats_offset - render_offset;
+  report->stats_bytes = sizeof(AecmState) - stats_offset;
+  report->instance_lines = (int)(sizeof(AecmState) / AECM_CACHE_LINE);
+
+  // 遠端スペクトル履歴は 1 ブロックで 1 エントリ書いて 1 エントリ読む。
+  // エントリがラインをまたぐ数は位置で変わるので、最も多い場合で数える。
+  int history_entry_lines = 0;
+  for (int i = 0; i < MAX_DELAY; i++) {
+    int lines = CacheLinesSpanned(history_offset + report->history_entry_bytes * i,
+                                  report->history_entry_bytes);
+    if (lines > history_entry_lines) {
+      history_entry_lines = lines;
+    }
+  }
+  // ProcessBlock ではキューを使わず、render 区画で触るのは遠端の時間領域バッファだけ。
+  // stats 区画は統計レベル 1 以上のときだけ触るが、上限なので含める。
+  report->lines_per_block = CacheLinesSpanned(0, history_offset) + 2 * history_entry_lines +
+                            CacheLinesSpanned(render_offset, sizeof(g_aecm->xBuf)) +
+                            CacheLinesSpanned(stats_offset, sizeof(g_aecm->stats));
 }
@@ -7,14 +7,152 @@
 #include "aecm_defines.h"
 
 
+// インスタンス。状態はすべて AecmState（aecm_state.h）にあり、InitAecm / ProcessBlock / GetLastEstimatedDelay は
+// SelectAecm で選んだインスタンスを処理する。選択はスレッドごとで、何も選ばなければ既定のインスタンスを使う。
+// 複数のインスタンスは aecm_pool.h のプールから得る。下の設定関数のうち負荷軽減は選択中のインスタンスごと、
+// それ以外（バイパス・統計・雑音抑圧・自動利得制御・カーネル）は全インスタンス共通。共通の設定はカーネルを除き、
+// 別のスレッドが処理している最中に変更してよい（遅くとも次のブロックから反映される）。
+typedef struct AecmState AecmState;
+void SelectAecm(AecmState* aecm); // NULL で既定のインスタンスに戻す
+AecmState* GetSelectedAecm();
+
 void InitAecm();
 int ProcessBlock(const int16_t* farend,
                  const int16_t* nearend,
                  int16_t* out);
 int GetLastEstimatedDelay();
 
+// nblocks ブロック分（各配列 nblocks * BLOCK_LEN サンプル）をまとめて処理する。出力は ProcessBlock を
+// ブロックごとに呼んだ場合と同じ。入力だけで決まる窓掛け・FFT・振幅・遠端の2値化を AECM_BATCH_BLOCKS ブロック分
+// 先にまとめて行い、続けて遅延推定・適応・抑圧をブロック順に行う。いずれかのブロックが -1 を返せば -1。
+int ProcessBlocks(const int16_t* farend, const int16_t* nearend, int16_t* out, int nblocks);
+
+// 再生（レンダー）側と収録（キャプチャ）側を別々のスレッドで処理する入り口。ProcessBlock の代わりに使う。
+// ProcessRenderBlock は再生スレッドで遠端 1 ブロックを窓掛け・FFT・2値化し、結果をインスタンス内の
+// ロックフリーのキュー（AECM_FAR_QUEUE_LEN ブロック）に積む。キューが満杯なら -1 を返し、そのブロックは捨てる。
+// ProcessCaptureBlock は収録スレッドでキューから遠端 1 ブロック分を取り出し、近端の変換・整列・適応・抑圧を行う。
+// キューが空なら遠端を無音として処理する。戻り値は ProcessBlock と同じ。
+// 両方のスレッドで同じインスタンスを SelectAecm しておくこと。InitAecm は両スレッドを止めてから呼ぶ。
+// 遠端と近端のブロックが 1 対 1 に対応していれば、出力は同じブロックを ProcessBlock に渡した場合と一致する。
+int ProcessRenderBlock(const int16_t* farend);
+int ProcessCaptureBlock(const int16_t* nearend, int16_t* out);
+
+typedef struct {
+  int queued; // キューにある遠端ブロック数
+  uint32_t overflows; // キューが満杯で捨てた遠端ブロック数
+  uint32_t underruns; // キューが空で遠端を無音とみなした近端ブロック数
+} AecmRenderQueueStats;
+void GetRenderQueueStats(AecmRenderQueueStats* stats);
+
+// 呼び出し側の形式のままの入出力。インターリーブされた多チャネルのバッファから 1 チャネルを直接読み書きする。
+// 入力は int16 への変換（float は ×32768 して最近接に丸め、範囲外は飽和、NaN は 0）とチャネルの取り出しを、
+// FFT 前の時間領域バッファ（xBuf / yBuf）へ書き込むときに一緒に行う。出力は同じ規則で呼び出し側のバッファの該当チャネルへ書く。
+// out は nearend と同じバッファ・チャネルでもよい（入力を読み終えてから書く）。
+// int16 の入力と、それを 32768 で割った float の入力とでは出力は同じで、int16 版の関数ともビット単位で一致する。
+typedef enum {
+  AECM_PCM_S16 = 0, // int16_t
+  AECM_PCM_F32 = 1, // float, -1.0 .. 1.0
+} AecmPcmFormat;
+typedef struct {
+  void* data; // バッファの先頭（最初のフレームのチャネル 0）。入力では書き換えない
+  AecmPcmFormat format;
+  int stride; // 1 サンプル進むときに進むサンプル数（インターリーブのチャネル数, 1 以上）
+  int channel; // 使うチャネル（0 .. stride - 1）
+} AecmPcmBuffer;
+// 各バッファの BLOCK_LEN フレーム分を処理する。stride / channel が不正なら何もせず -1。
+int ProcessBlockPcm(const AecmPcmBuffer* farend, const AecmPcmBuffer* nearend, const AecmPcmBuffer* out);
+int ProcessRenderBlockPcm(const AecmPcmBuffer* farend);
+int ProcessCaptureBlockPcm(const AecmPcmBuffer* nearend, const AecmPcmBuffer* out);
+
+// 周波数領域の出力。ProcessBlock の最後の IFFT・合成窓を行わず、抑圧後の近端スペクトル E を返す。
+// 後段（雑音抑圧・符号化器の解析・スペクトル表示など）が同じ窓・同じ点数の領域で処理を続け、最後に 1 回だけ
+// SynthesizeSpectrumBlock で時間領域に戻す。E・|X|・|Y| はすべて同じ領域で、16 ビット PCM（Q0）の PART_LEN2 サンプルに
+// sqrt-Hanning 窓を掛けた DFT を 2^fft_scale_shift で割ったもの。ビン k の周波数は k * サンプリング周波数 / PART_LEN2。
+typedef struct {
+  int16_t E[PART_LEN1 * 2]; // 抑圧後の近端スペクトル（ビンごとに実部・虚部の順, Q0）
+  uint16_t X_mag[PART_LEN1]; // 遅延に合わせて整列した遠端 |X|（AECM_COMPACT_HISTORY では圧縮履歴の復号値）
+  uint16_t Y_mag[PART_LEN1]; // 近端 |Y|
+  int16_t G_mask[PART_LEN1]; // E = G_mask * Y のゲイン（Q14, NLP 込み。自動利得制御のゲインは含まない）
+  int fft_scale_shift; // DFT を割った 2 のべき（PART_LEN_SHIFT, DFT の点数 PART_LEN2 の log2）
+} AecmSpectrumBlock;
+// 遠端・近端 1 ブロックを処理し、出力を spectrum に返す。戻り値は ProcessBlock と同じ。
+// 負荷軽減レベル 4 でも E = G_mask * Y を作る（時間領域での広帯域ゲインは使わない）。
+// 統計レベル 2 の抑圧量の集計のうち、時間領域の出力を使う部分は行わない。
+int ProcessBlockSpectrum(const int16_t* farend, const int16_t* nearend, AecmSpectrumBlock* spectrum);
+// spectrum->E（後段で書き換えてよい）を逆 FFT・合成窓・オーバーラップ加算して out に BLOCK_LEN サンプル書く。
+// オーバーラップは選択中のインスタンスが持つので、ProcessBlockSpectrum 1 回ごとに 1 回、同じ順に呼ぶこと。
+// E を書き換えなければ、出力は ProcessBlock とビット単位で一致する（負荷軽減レベル 4 を除く）。
+void SynthesizeSpectrumBlock(const AecmSpectrumBlock* spectrum, int16_t* out);
+
+// チェックポイント。選択中のインスタンスの状態を見出し付きのバイト列に書き出し、後で（別のプロセスでも）戻す。
+// 同じビルド（ブロック長・サンプリング周波数・AECM_COMPACT_HISTORY・状態の並び）の間でのみ有効で、
+// 見出しが合わなければ戻さずに -1 を返す。遠端を共有していた（ShareFarState）インスタンスの状態も -1。
+// 遠端解析結果のキューは空にして戻し、デバッグ統計は戻さない。
+size_t GetAecmCheckpointSize();
+void SaveAecmCheckpoint(void* buffer);
+int RestoreAecmCheckpoint(const void* buffer, size_t size);
+
 // デバッグ向け制御（0:有効, 非0:バイパス）。
 void SetBypassSupMask(int enable);
 void SetBypassNlp(int enable);
 
+// stderr へのデバッグ統計の量。0: なし, 1: 100 ブロックごとの状態ログのみ, 2: 抑圧量の集計も行う（既定）。
+// レベルを下げると統計計算そのものがコンパイル時に除かれた経路で処理する。
+void SetStatsLevel(int level);
+
+// 定常雑音の抑圧。0: なし（既定）, 1〜3: 抑圧の下限 -6 / -10 / -15 dB。
+// 近端の振幅スペクトルから定常雑音を推定し（平滑値の最小値を約 4 dB/秒で追う）、スペクトル減算のゲインを
+// エコー抑圧のマスクに掛けてから 1 回の IFFT で出力する。別の雑音抑圧器を後段に置く場合の窓掛け・FFT・IFFT が要らない。
+// 処理中いつでも変更できる（推定は 0 の間も進めないので、有効にしてから数百ミリ秒は推定が追いつくまで弱め）。
+void SetNoiseSuppression(int level);
+int GetNoiseSuppression();
+
+// 自動利得制御。target_dbfs は近端の話し声の目標レベル（-30 .. -3 dBFS, 範囲外は丸める）、0 で無効（既定）。
+// エコー抑圧後のスペクトルからレベルを測り（近端が有音で、エコーが主でないブロックだけ）、平滑化した広帯域ゲイン
+// （-12 .. +18 dB, 上げるときは約 6 dB/秒, 下げるときは約 24 dB/秒）を E にまとめて掛ける。オーバーラップ加算では
+// -1 dBFS を超えるブロックをリミッタで下げる。別の AGC を後段に置く場合の 1 パスと遅延が要らない。処理中いつでも変更できる。
+void SetAutoGainControl(int target_dbfs);
+int GetAutoGainControl();
+
+// 負荷軽減レベル。数値が大きいほど処理を間引き、下位レベルの間引きも含む。
+//   0: 通常処理
+//   1: NLMS 適応を凍結（保存チャネルはそのまま使う）
+//   2: 遅延推定を LOAD_SHED_DELAY_INTERVAL ブロックに 1 回に間引く
+//   3: 周波数マスクを LOAD_SHED_MASK_INTERVAL ブロックに 1 回だけ計算し、間は前回値を再利用
+//   4: IFFT を省略し、マスク平均の広帯域ゲインを時間領域で掛ける
+// 処理中いつでも変更できる。レベル・予算・自動制御の状態は選択中のインスタンスごとに持ち、InitAecm では変わらない
+// （プールから取得したインスタンスは 0 から始まる）。
+void SetLoadShedLevel(int level);
+int GetLoadShedLevel();
+
+// スケジューラ向けの自動制御。1 ブロックの処理時間予算（マイクロ秒, 0 で無効）を設定し、
+// 実測したブロック処理時間を UpdateLoadShedLevel に渡すとレベルを上げ下げする。
+// 戻り値は更新後のレベル。
+void SetLoadShedBudgetUs(int budget_us);
+int UpdateLoadShedLevel(int measured_us);
+
+// CPU 別カーネルの選択。InitAecm が CPU の対応命令（x86 は cpuid）から最速と見込まれる版を選ぶ。
+// SetKernelBenchmark(1) にするとその場で候補の版を実測し、カーネルごとに速い版を選ぶ。
+// SetKernelVariant で版を名前で固定できる（"generic", "sse4.2", "avx2", "avx512"。NULL で自動に戻す）。
+// 使えない版なら -1 を返す。どの版も出力はビット単位で同じ。
+// この 2 つはカーネル表を書き換えるので、どのスレッドも処理していないとき（起動時など）に呼ぶこと。
+void SetKernelBenchmark(int enable);
+int SetKernelVariant(const char* name);
+const char* GetKernelVariant();
+
+// インスタンス状態の配置（aecm_state.h）。状態は hot / delay / history / render / stats の 5 区画に分かれ、
+// 各区画と構造体全体がキャッシュライン（AECM_CACHE_LINE バイト）境界に揃う。
+typedef struct {
+  size_t instance_bytes; // 1 インスタンスの大きさ（末尾のパディング込み）
+  size_t hot_bytes; // 毎ブロック全体を読み書きするスカラー・65 ビン配列・時間領域バッファ
+  size_t delay_bytes; // 遅延推定器
+  size_t history_bytes; // 遠端スペクトル履歴
+  size_t history_entry_bytes; // 履歴 1 エントリ（1 ブロック分）の大きさ（AECM_COMPACT_HISTORY で変わる）
+  size_t render_bytes; // 再生側の状態と遠端解析結果のキュー
+  size_t stats_bytes; // デバッグ統計の集計
+  int instance_lines; // 1 インスタンスのキャッシュライン数
+  int lines_per_block; // 1 ブロックの処理で触るキャッシュライン数（上限）
+} AecmLayoutReport;
+void GetAecmLayoutReport(AecmLayoutReport* report);
+
 #endif  // AECM_H_
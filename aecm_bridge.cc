@@ -0,0 +1,141 @@
+#include "aecm_bridge.h"
+
+#include <new>
+#include <string.h>
+
+#include "aecm.h"
+#include "aecm_pool.h"
+#include "aecm_state.h"
+
+struct AecmBridge {
+  int num_participants;
+  AecmPool* pool;
+  AecmState** participants; // 参加者ごとのインスタンス（遠端の時間領域バッファは使わない）
+  int16_t* talker_frames; // 話者ごとの直前と今回のブロック（num_participants * PART_LEN2）
+  int32_t* talker_real; // 話者ごとのスペクトル（Q AECM_BRIDGE_SPECTRUM_Q, num_participants * PART_LEN1）
+  int32_t* talker_imag;
+  int32_t mix_real[PART_LEN1]; // 全体のミックスのスペクトル（Q AECM_BRIDGE_SPECTRUM_Q）
+  int32_t mix_imag[PART_LEN1];
+};
+
+AecmBridge* CreateAecmBridge(int num_participants) {
+  if (num_participants < 2 || num_participants > AECM_BRIDGE_MAX_PARTICIPANTS) {
+    return NULL; // 上限を超えるとミックスの 32 ビット和が溢れうる
+  }
+  AecmBridge* bridge = new (std::nothrow) AecmBridge;
+  if (!bridge) {
+    return NULL;
+  }
+  bridge->num_participants = num_participants;
+  bridge->pool = CreateAecmPool(num_participants, 0);
+  bridge->participants = new (std::nothrow) AecmState*[num_participants];
+  bridge->talker_frames = new (std::nothrow) int16_t[num_participants * PART_LEN2];
+  bridge->talker_real = new (std::nothrow) int32_t[num_participants * PART_LEN1];
+  bridge->talker_imag = new (std::nothrow) int32_t[num_participants * PART_LEN1];
+  if (!bridge->pool || !bridge->participants || !bridge->talker_frames || !bridge->talker_real ||
+      !bridge->talker_imag) {
+    DestroyAecmBridge(bridge);
+    return NULL;
+  }
+  for (int p = 0; p < num_participants; p++) {
+    bridge->participants[p] = AecmPoolAcquire(bridge->pool);
+  }
+  InitAecmBridge(bridge);
+  return bridge;
+}
+
+void DestroyAecmBridge(AecmBridge* bridge) {
+  if (!bridge) {
+    return;
+  }
+  DestroyAecmPool(bridge->pool);
+  delete[] bridge->participants;
+  delete[] bridge->talker_frames;
+  delete[] bridge->talker_real;
+  delete[] bridge->talker_imag;
+  delete bridge;
+}
+
+void InitAecmBridge(AecmBridge* bridge) {
+  AecmState* selected = GetSelectedAecm();
+  for (int p = 0; p < bridge->num_participants; p++) {
+    SelectAecm(bridge->participants[p]);
+    InitAecm();
+  }
+  SelectAecm(selected);
+  memset(bridge->talker_frames, 0, sizeof(int16_t) * bridge->num_participants * PART_LEN2);
+  memset(bridge->talker_real, 0, sizeof(int32_t) * bridge->num_participants * PART_LEN1);
+  memset(bridge->talker_imag, 0, sizeof(int32_t) * bridge->num_participants * PART_LEN1);
+  memset(bridge->mix_real, 0, sizeof(bridge->mix_real));
+  memset(bridge->mix_imag, 0, sizeof(bridge->mix_imag));
+}
+
+void AnalyzeBridgeTalkers(AecmBridge* bridge, const int16_t* const* talker) {
+  memset(bridge->mix_real, 0, sizeof(bridge->mix_real));
+  memset(bridge->mix_imag, 0, sizeof(bridge->mix_imag));
+  for (int p = 0; p < bridge->num_participants; p++) {
+    int16_t* frame = bridge->talker_frames + p * PART_LEN2;
+    int32_t* real = bridge->talker_real + p * PART_LEN1;
+    int32_t* imag = bridge->talker_imag + p * PART_LEN1;
+    if (talker[p]) {
+      memcpy(frame + PART_LEN, talker[p], sizeof(int16_t) * PART_LEN);
+    } else {
+      memset(frame + PART_LEN, 0, sizeof(int16_t) * PART_LEN);
+    }
+    // 小さな話者ほど FFT の丸めが相対的に大きく、足し合わせると誤差も積み重なるので、
+    // フレームを 16 ビットいっぱいまで左シフトしてから変換し、共通の Q に戻して足す。
+    const int shift = MIN(NormW16(MaxAbsValueW16(frame, PART_LEN2)), AECM_BRIDGE_SPECTRUM_Q);
+    int16_t scaled[PART_LEN2];
+    for (int i = 0; i < PART_LEN2; i++) {
+      scaled[i] = (int16_t)(frame[i] * (1 << shift));
+    }
+    ComplexInt16 X_freq[PART_LEN2];
+    TransformFarSpectrum(scaled, X_freq); // 話者ごとに 1 回だけ
+    for (int i = 0; i < PART_LEN1; i++) {
+      real[i] = (int32_t)X_freq[i].real * (1 << (AECM_BRIDGE_SPECTRUM_Q - shift));
+      imag[i] = (int32_t)X_freq[i].imag * (1 << (AECM_BRIDGE_SPECTRUM_Q - shift));
+      bridge->mix_real[i] += real[i];
+      bridge->mix_imag[i] += imag[i];
+    }
+    memcpy(frame, frame + PART_LEN, sizeof(int16_t) * PART_LEN);
+  }
+}
+
+int ProcessBridgeParticipant(AecmBridge* bridge, int participant, const int16_t* nearend, int16_t* out) {
+  // mix-minus = 全体 - 自分（Q0 に丸めて 16 ビットに飽和）
+  const int32_t* own_real = bridge->talker_real + participant * PART_LEN1;
+  const int32_t* own_imag = bridge->talker_imag + participant * PART_LEN1;
+  const int32_t round = 1 << (AECM_BRIDGE_SPECTRUM_Q - 1);
+  ComplexInt16 X_freq[PART_LEN2];
+  for (int i = 0; i < PART_LEN1; i++) {
+    X_freq[i].real = SatW32ToW16((bridge->mix_real[i] - own_real[i] + round) >> AECM_BRIDGE_SPECTRUM_Q);
+    X_freq[i].imag = SatW32ToW16((bridge->mix_imag[i] - own_imag[i] + round) >> AECM_BRIDGE_SPECTRUM_Q);
+  }
+  AecmState* selected = GetSelectedAecm();
+  SelectAecm(bridge->participants[participant]);
+  const int ret = ProcessFarSpectrumBlock(X_freq, nearend, out);
+  SelectAecm(selected);
+  return ret;
+}
+
+int ProcessBridgeBlock(AecmBridge* bridge,
+                       const int16_t* const* talker,
+                       const int16_t* const* nearend,
+                       int16_t* const* out) {
+  AnalyzeBridgeTalkers(bridge, talker);
+  int ret = 0;
+  for (int p = 0; p < bridge->num_participants; p++) {
+    if (ProcessBridgeParticipant(bridge, p, nearend[p], out[p]) != 0) {
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+int GetBridgeDelay(const AecmBridge* bridge, int participant) {
+  AecmState* selected = GetSelectedAecm();
+  SelectAecm(bridge->participants[participant]);
+  const int delay = GetLastEstimatedDelay();
+  SelectAecm(selected);
+  return delay;
+}
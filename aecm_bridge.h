@@ -0,0 +1,38 @@
+#ifndef AECM_BRIDGE_H_
+#define AECM_BRIDGE_H_
+
+#include <stdint.h>
+
+#include "aecm_defines.h"
+
+// N 人の会議ブリッジ向けの遠端。参加者 p の遠端は自分以外の全員のミックス（mix-minus）で、
+// それを参加者ごとに時間領域で作って ProcessBlock に渡す代わりに、周波数領域で作ってそのまま AECM に渡す。
+//   1. 話者（ミックスに入れる信号）ごとに窓掛け・FFT を 1 回だけ行う（フレームを正規化してから変換する）
+//   2. 全員の複素スペクトルを足して全体のミックスのスペクトルを作る（32 ビット, Q AECM_BRIDGE_SPECTRUM_Q）
+//   3. 参加者 p の遠端スペクトルは 全体 - 話者 p（16 ビットに飽和）。そこから |X|・2値化・遅延推定以降を参加者ごとのインスタンスで行う
+// 窓掛け・FFT は線形なので、時間領域でミックスしてから変換した場合との差は FFT の丸めと飽和の位置だけ
+// （出力はビット単位では一致しない）。参加者は AECM_BRIDGE_MAX_PARTICIPANTS（256）人まで（32 ビットの加算が溢れない範囲）。
+// 時間領域の mix-minus 信号は作らない（再生用のミックスは呼び出し側で作る）。
+// 選択中のインスタンスは使わず、変えない。統計レベル（SetStatsLevel）などの設定は共通。
+typedef struct AecmBridge AecmBridge;
+
+// num_participants: 参加者数（2 以上 AECM_BRIDGE_MAX_PARTICIPANTS 以下、範囲外なら NULL）。確保できなければ NULL。作成時に初期化済み。
+AecmBridge* CreateAecmBridge(int num_participants);
+void DestroyAecmBridge(AecmBridge* bridge);
+void InitAecmBridge(AecmBridge* bridge);
+
+// 話者ごとの 1 ブロック（talker[p], 各 BLOCK_LEN サンプル, NULL は無音）を変換し、全体のミックスのスペクトルを作る。
+void AnalyzeBridgeTalkers(AecmBridge* bridge, const int16_t* const* talker);
+// 参加者 p の近端 1 ブロックを、直前の AnalyzeBridgeTalkers の mix-minus を遠端として処理する。戻り値は ProcessBlock と同じ。
+// 参加者ごとの処理は互いに独立なので、AnalyzeBridgeTalkers の後で別々のスレッドから呼べる。
+int ProcessBridgeParticipant(AecmBridge* bridge, int participant, const int16_t* nearend, int16_t* out);
+// AnalyzeBridgeTalkers と全参加者の ProcessBridgeParticipant。いずれかの参加者が -1 を返せば -1。
+int ProcessBridgeBlock(AecmBridge* bridge,
+                       const int16_t* const* talker,
+                       const int16_t* const* nearend,
+                       int16_t* const* out);
+
+// 参加者ごとの直近の遅延推定値（GetLastEstimatedDelay と同じ）
+int GetBridgeDelay(const AecmBridge* bridge, int participant);
+
+#endif  // AECM_BRIDGE_H_
@@ -2,24 +2,61 @@
 
 
 // アルゴリズム関連の定数 
-// 教育用にフレームとパーティションを一致させる: 64サンプル固定
-#define BLOCK_LEN 64  // ブロック長（PART_LEN と同じ） 
+// ブロック長とサンプリング周波数はビルド時に選ぶ（既定 64 サンプル / 16 kHz）。
+//   -DAECM_BLOCK_LEN=32  : 低遅延（2 ms）版
+//   -DAECM_BLOCK_LEN=128 : スループット重視のオフライン版
+// 窓やチャネル初期値などのテーブルはこの値から constexpr で生成する。
+#ifndef AECM_BLOCK_LEN
+#define AECM_BLOCK_LEN 64
+#endif
+#ifndef AECM_SAMPLE_RATE_HZ
+#define AECM_SAMPLE_RATE_HZ 16000
+#endif
 
-#define PART_LEN 64      // パーティション長。ブロック単位
-#define PART_LEN_SHIFT 7 // PART_LEN*2 を表すビットシフト量 
+#if AECM_BLOCK_LEN == 32
+#define PART_LEN_SHIFT 6
+#elif AECM_BLOCK_LEN == 64
+#define PART_LEN_SHIFT 7
+#elif AECM_BLOCK_LEN == 128
+#define PART_LEN_SHIFT 8
+#else
+#error "AECM_BLOCK_LEN は 32, 64, 128 のいずれか"
+#endif
+#if AECM_SAMPLE_RATE_HZ != 8000 && AECM_SAMPLE_RATE_HZ != 16000
+#error "AECM_SAMPLE_RATE_HZ は 8000 か 16000"
+#endif
+
+// 教育用にフレームとパーティションを一致させる
+#define BLOCK_LEN AECM_BLOCK_LEN  // ブロック長（PART_LEN と同じ） 
+
+#define PART_LEN AECM_BLOCK_LEN // パーティション長。ブロック単位
+// PART_LEN_SHIFT: PART_LEN*2 を表すビットシフト量（上で決定）
 
 #define PART_LEN1 (PART_LEN + 1)  // FFT のユニークな係数数
 #define PART_LEN2 (PART_LEN << 1) // パーティション長の 2 倍
 #define PART_LEN4 (PART_LEN << 2) // パーティション長の 4 倍
 #define FAR_BUF_LEN PART_LEN4     // 遠端バッファの長さ
-#define MAX_DELAY 100 // 推定可能な最大の遅延。単位はブロック
+#define MAX_DELAY (100 * 64 / BLOCK_LEN) // 推定可能な最大の遅延。単位はブロック（ブロック長によらず 400 ms）
 
+// 遠端スペクトル履歴の形式（ビルド時に選ぶ）。
+//   0: |X| を uint16 のまま MAX_DELAY エントリ保持する（既定）
+//   1: エントリごとの基準オクターブ + uint8 の対数振幅に圧縮し、整列したエントリだけ読み出し時に復号する
+//      （履歴のメモリは約半分。精度は 11 節を参照）
+#ifndef AECM_COMPACT_HISTORY
+#define AECM_COMPACT_HISTORY 0
+#endif
+#if AECM_COMPACT_HISTORY
+#define FAR_HISTORY_ENTRY_LEN (PART_LEN1 + 1) // 履歴 1 エントリの要素数（uint8 の符号 + 基準オクターブ）
+#else
+#define FAR_HISTORY_ENTRY_LEN PART_LEN1 // 履歴 1 エントリの要素数（uint16 の |X|）
+#endif
 
-#define SAMPLE_RATE_HZ 16000 // サンプリング周波数を固定している
+
+#define SAMPLE_RATE_HZ AECM_SAMPLE_RATE_HZ // サンプリング周波数
 
 
 // 起動時のカウンタ関連の定数 
-#define CONV_LEN 512              // 起動時に用いる収束ブロック数
+#define CONV_LEN (512 * 64 / BLOCK_LEN) // 起動時に用いる収束ブロック数（約 2 秒）
 #define CONV_LEN2 (CONV_LEN << 1) // 起動時に使用する 2 倍長
 
 // エネルギー関連の定数 
@@ -51,3 +88,60 @@
 // NLP 関連定数 
 #define NLP_COMP_LOW 3277     // Q14 で 0.2 
 #define NLP_COMP_HIGH ONE_Q14 // Q14 で 1.0 
+
+// 定常雑音の抑圧（SetNoiseSuppression）関連の定数
+#define NS_LEVEL_MAX 3            // 抑圧レベルの最大値
+#define NS_SMOOTH_SHIFT 2         // 近端 |Y| の平滑化（1/4 ずつ追従）
+#define NS_RISE_SHIFT 9           // 雑音推定の上昇速度（1 ブロックに 1/512 倍, 16 kHz・64 サンプルで約 4 dB/秒）
+#define NS_OVERSUB_Q8 384         // 雑音推定に掛ける過大評価の係数（Q8 で 1.5。推定は平滑値の最小値を追うので小さめに出る）
+#define NS_GAIN_SMOOTH_SHIFT 1    // 雑音抑圧ゲインの時間方向の平滑化（ミュージカルノイズ対策）
+#define NS_NOISE_UNSET 0xFFFFFFFFu // 雑音推定が未設定（最初のブロックの平滑値で始める）
+
+// 自動利得制御（SetAutoGainControl）関連の定数。レベル・ゲインは LogOfEnergyInQ8 と同じ log2 の Q8（256 で振幅 2 倍 = 約 6 dB）
+#define AGC_TARGET_DBFS_MIN -30     // 目標レベルの下限（dBFS）
+#define AGC_TARGET_DBFS_MAX -3      // 目標レベルの上限（dBFS）
+#define AGC_LOUDNESS_OFFSET_Q8 -157  // 音声のブロックでの sum(|E|) の対数と RMS（dBFS）の差の補正（実測）
+#define AGC_NEAR_ACTIVE_Q8 18176    // 近端の対数エネルギーがこれを超える（約 -50 dBFS）ブロックだけでレベルを測る
+#define AGC_ECHO_MARGIN_Q8 256      // マスク後が近端よりこれ以上小さい（エコーが主）ブロックはレベルを測らない（6 dB）
+#define AGC_NOISE_RISE_SHIFT 9      // 出力の雑音レベルの上昇（差の 1/512 ずつ）
+#define AGC_SPEECH_MARGIN_Q8 384    // 出力が雑音レベルよりこれ以上大きい（約 9 dB）ブロックを話し声とみなす
+#define AGC_LEVEL_SMOOTH_SHIFT 8    // レベルの平滑化（1/256 ずつ, 有音のブロックで約 1 秒）
+#define AGC_GAIN_MIN_Q8 -512        // ゲインの下限（-12 dB）
+#define AGC_GAIN_MAX_Q8 768         // ゲインの上限（+18 dB）
+#define AGC_GAIN_RISE_Q8 1          // 1 ブロックに上げるゲインの上限（約 6 dB/秒）
+#define AGC_GAIN_FALL_Q8 4          // 1 ブロックに下げるゲインの上限（約 24 dB/秒）
+#define AGC_LEVEL_UNSET -32768      // レベル未測定
+#define AGC_UNITY_Q12 (1 << 12)     // 線形ゲインの 1.0（Q12）
+#define AGC_LIMIT_LEVEL 29204       // リミッタのしきい値（-1 dBFS）
+#define AGC_LIMITER_RELEASE_Q14 64  // リミッタのゲインを 1 ブロックに戻す量（Q14, 1/2 から 1 まで約 0.5 秒）
+
+// 負荷軽減（ロードシェディング）関連の定数
+#define LOAD_SHED_LEVEL_MAX 4       // 負荷軽減レベルの最大値
+#define LOAD_SHED_DELAY_INTERVAL 4  // レベル2以上での遅延推定の間隔（ブロック）
+#define LOAD_SHED_MASK_INTERVAL 2   // レベル3以上でのマスク再計算の間隔（ブロック）
+#define LOAD_SHED_HOLD_BLOCKS 50    // レベル変更後、次の変更までに待つブロック数
+
+// ストリーミング API（aecm_stream.h）関連の定数
+#define AECM_STREAM_CAPACITY (BLOCK_LEN * 64) // 遠端・近端・出力の各リングバッファの容量（サンプル, BLOCK_LEN の倍数）
+
+// 複数ブロックの一括処理（ProcessBlocks）関連の定数
+#define AECM_BATCH_BLOCKS 8 // 解析段をまとめて先に行うブロック数
+
+// 再生側・収録側の分割処理（ProcessRenderBlock / ProcessCaptureBlock）関連の定数
+#define AECM_FAR_QUEUE_LEN 16 // 遠端解析結果のキューの長さ（ブロック, 2 のべき乗）。再生側が先行できる量の上限
+
+// オフライン並列処理（ProcessOfflineBlocks）関連の定数
+#define AECM_OFFLINE_SEGMENT_BLOCKS 1024 // 解析・逐次・合成の 3 段をまとめて行うブロック数（作業領域の大きさを決める）
+#define AECM_SEGMENT_CROSSFADE_BLOCKS 32 // 区間並列処理で、境目の前に前後の区間の出力を混ぜるブロック数
+#define AECM_SEGMENT_SNAPSHOT_BLOCKS 256 // 区間並列処理で、先頭の区間を何ブロック処理した状態を他の区間へ引き継ぐか
+
+// チェックポイント（SaveAecmCheckpoint）関連の定数
+#define AECM_CHECKPOINT_MAGIC 0x4B434541u // 見出しの識別子（バイト列で "AECK"）
+#define AECM_CHECKPOINT_VERSION 1 // 書き出す状態の並びを変えたら上げる
+
+// 会議ブリッジ（aecm_bridge.h）関連の定数
+#define AECM_BRIDGE_SPECTRUM_Q 8 // 話者のスペクトルを足し合わせる固定小数の小数ビット数（話者ごとの正規化シフトの上限）
+#define AECM_BRIDGE_MAX_PARTICIPANTS 256 // 会議ブリッジの参加者数の上限（Q AECM_BRIDGE_SPECTRUM_Q の 16 ビット値の 32 ビット和が溢れない数）
+
+// インスタンス配置関連の定数
+#define AECM_CACHE_LINE 64 // キャッシュライン長（バイト）。インスタンス状態の区画の境界に使う
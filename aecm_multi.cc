@@ -0,0 +1,187 @@
+#include "aecm_multi.h"
+
+#include <new>
+
+#include "aecm.h"
+#include "aecm_pool.h"
+#include "aecm_state.h"
+
+struct AecmMultiCapture {
+  int num_render;
+  int num_mics;
+  AecmPool* pool;
+  AecmState** mics; // 再生チャネルが 1 つなら mics[0] が遠端の状態を持つ
+  AecmState** renders; // 再生チャネルが 2 つ以上のとき、チャネルごとの遠端の状態と遅延推定器
+  int* render_delays; // チャネルごとの直近の遅延推定値
+};
+
+// mics[0] 以外を mics[0] の遠端に向ける
+static void ShareMicsFarState(AecmMultiCapture* multi) {
+  AecmState* selected = GetSelectedAecm();
+  for (int mic = 1; mic < multi->num_mics; mic++) {
+    SelectAecm(multi->mics[mic]);
+    ShareFarState(multi->mics[0]);
+  }
+  SelectAecm(selected);
+}
+
+AecmMultiCapture* CreateAecmMultiCapture(int num_mics) {
+  return CreateAecmMultiRender(1, num_mics);
+}
+
+AecmMultiCapture* CreateAecmMultiRender(int num_render, int num_mics) {
+  if (num_render < 1 || num_mics < 1) {
+    return NULL;
+  }
+  AecmMultiCapture* multi = new (std::nothrow) AecmMultiCapture;
+  if (!multi) {
+    return NULL;
+  }
+  const int num_renders = num_render > 1 ? num_render : 0;
+  multi->num_render = num_render;
+  multi->num_mics = num_mics;
+  multi->pool = CreateAecmPool(num_mics + num_renders, 0);
+  multi->mics = new (std::nothrow) AecmState*[num_mics];
+  multi->renders = new (std::nothrow) AecmState*[num_renders + 1];
+  multi->render_delays = new (std::nothrow) int[num_render];
+  if (!multi->pool || !multi->mics || !multi->renders || !multi->render_delays) {
+    DestroyAecmMultiCapture(multi);
+    return NULL;
+  }
+  for (int mic = 0; mic < num_mics; mic++) {
+    multi->mics[mic] = AecmPoolAcquire(multi->pool);
+  }
+  for (int ch = 0; ch < num_renders; ch++) {
+    multi->renders[ch] = AecmPoolAcquire(multi->pool);
+  }
+  for (int ch = 0; ch < num_render; ch++) {
+    multi->render_delays[ch] = -2;
+  }
+  if (num_render == 1) {
+    ShareMicsFarState(multi);
+  }
+  return multi;
+}
+
+void DestroyAecmMultiCapture(AecmMultiCapture* multi) {
+  if (!multi) {
+    return;
+  }
+  DestroyAecmPool(multi->pool);
+  delete[] multi->mics;
+  delete[] multi->renders;
+  delete[] multi->render_delays;
+  delete multi;
+}
+
+void InitAecmMultiCapture(AecmMultiCapture* multi) {
+  AecmState* selected = GetSelectedAecm();
+  for (int mic = 0; mic < multi->num_mics; mic++) {
+    SelectAecm(multi->mics[mic]);
+    InitAecm();
+  }
+  for (int ch = 0; multi->num_render > 1 && ch < multi->num_render; ch++) {
+    SelectAecm(multi->renders[ch]);
+    InitAecm();
+  }
+  for (int ch = 0; ch < multi->num_render; ch++) {
+    multi->render_delays[ch] = -2;
+  }
+  SelectAecm(selected);
+  if (multi->num_render == 1) {
+    ShareMicsFarState(multi);
+  }
+}
+
+int ProcessMultiCaptureBlock(AecmMultiCapture* multi,
+                             const int16_t* farend,
+                             const int16_t* const* nearend,
+                             int16_t* const* out) {
+  AecmState* selected = GetSelectedAecm();
+  int ret = 0;
+  // マイク 0 が遠端の解析と履歴への追加を行い、他のマイクはその履歴を読む
+  SelectAecm(multi->mics[0]);
+  if (ProcessBlock(farend, nearend[0], out[0]) != 0) {
+    ret = -1;
+  }
+  for (int mic = 1; mic < multi->num_mics; mic++) {
+    SelectAecm(multi->mics[mic]);
+    if (ProcessSharedFarBlock(nearend[mic], out[mic]) != 0) {
+      ret = -1;
+    }
+  }
+  SelectAecm(selected);
+  return ret;
+}
+
+int GetMultiCaptureDelay(const AecmMultiCapture* multi, int mic) {
+  AecmState* selected = GetSelectedAecm();
+  SelectAecm(multi->mics[mic]);
+  const int delay = GetLastEstimatedDelay();
+  SelectAecm(selected);
+  return delay;
+}
+
+int ProcessMultiRenderBlock(AecmMultiCapture* multi,
+                            const int16_t* const* farend,
+                            const int16_t* const* nearend,
+                            int16_t* const* out) {
+  if (multi->num_render == 1) {
+    return ProcessMultiCaptureBlock(multi, farend[0], nearend, out);
+  }
+  AecmState* selected = GetSelectedAecm();
+  int ret = 0;
+  // 基準のマイク（マイク 0）の近端を先に変換し、再生チャネルごとの遅延推定に使う
+  AecmNearBlock near;
+  SelectAecm(multi->mics[0]);
+  AnalyzeCaptureBlock(nearend[0], &near);
+
+  // 再生チャネルごとに 1 回だけ解析・遅延推定・整列し、整列した |X| を足し合わせる
+  uint32_t X_sum[PART_LEN1] = {0};
+  for (int ch = 0; ch < multi->num_render; ch++) {
+    uint16_t X_mag_aligned[PART_LEN1];
+    SelectAecm(multi->renders[ch]);
+    const int delay = AnalyzeRenderChannel(farend[ch], near.Y_mag, X_mag_aligned);
+    if (delay < 0) {
+      ret = -1;
+    }
+    multi->render_delays[ch] = GetLastEstimatedDelay();
+    for (int i = 0; i < PART_LEN1; i++) {
+      X_sum[i] += X_mag_aligned[i];
+    }
+  }
+  // 和が 16 ビットを超えるブロックは、帯域ごとに飽和させず全帯域を同じだけ右シフトしてスペクトルの形を保つ
+  uint32_t X_max = 0;
+  for (int i = 0; i < PART_LEN1; i++) {
+    X_max = MAX(X_max, X_sum[i]);
+  }
+  int shift = 0;
+  while ((X_max >> shift) > UINT16_MAX) {
+    shift++;
+  }
+  uint16_t X_joint[PART_LEN1];
+  for (int i = 0; i < PART_LEN1; i++) {
+    X_joint[i] = (uint16_t)(X_sum[i] >> shift);
+  }
+
+  // 全マイクが同じ |X| と遅延を使う（マイクごとの遅延推定はしない。マイク間の遅延差は整列の誤差になる）
+  const int delay = multi->render_delays[0] >= 0 ? multi->render_delays[0] : 0;
+  for (int mic = 0; mic < multi->num_mics; mic++) {
+    SelectAecm(multi->mics[mic]);
+    if (mic > 0) {
+      AnalyzeCaptureBlock(nearend[mic], &near);
+    }
+    if (ProcessAlignedBlock(X_joint, delay, &near, out[mic]) != 0) {
+      ret = -1;
+    }
+  }
+  SelectAecm(selected);
+  return ret;
+}
+
+int GetMultiRenderDelay(const AecmMultiCapture* multi, int channel) {
+  if (multi->num_render == 1) {
+    return GetMultiCaptureDelay(multi, 0);
+  }
+  return multi->render_delays[channel];
+}
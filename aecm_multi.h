@@ -0,0 +1,49 @@
+#ifndef AECM_MULTI_H_
+#define AECM_MULTI_H_
+
+#include <stdint.h>
+
+#include "aecm_defines.h"
+
+// 1 つのスピーカーと複数のマイクを持つ機器向けのマルチマイク処理。
+// マイクごとにインスタンスを持つが、遠端の窓掛け・FFT・|X|・2値化、遠端スペクトル履歴、遅延推定器の遠端側
+// （2値スペクトル履歴）はマイク 0 のインスタンスだけが持ち、他のマイクはそれを読む。
+// 近端側の遅延推定器・チャネル・抑圧の状態はマイクごと。
+// 各マイクの出力は、そのマイクと同じ遠端を 1 つのインスタンスで ProcessBlock した場合とビット単位で一致する。
+// 選択中のインスタンスは使わず、変えない。統計レベル（SetStatsLevel）などの設定は共通。
+typedef struct AecmMultiCapture AecmMultiCapture;
+
+// num_mics: マイク数（1 以上）。確保できなければ NULL。作成時に初期化済み。
+AecmMultiCapture* CreateAecmMultiCapture(int num_mics);
+void DestroyAecmMultiCapture(AecmMultiCapture* multi);
+void InitAecmMultiCapture(AecmMultiCapture* multi);
+
+// 遠端 1 ブロックと、マイクごとの近端 1 ブロック（nearend[mic], 各 BLOCK_LEN サンプル）を処理し、
+// out[mic] に出力する。いずれかのマイクが -1 を返せば -1。
+int ProcessMultiCaptureBlock(AecmMultiCapture* multi,
+                             const int16_t* farend,
+                             const int16_t* const* nearend,
+                             int16_t* const* out);
+
+// マイクごとの直近の遅延推定値（GetLastEstimatedDelay と同じ）
+int GetMultiCaptureDelay(const AecmMultiCapture* multi, int mic);
+
+// 複数スピーカー（再生チャネル num_render 個）。再生チャネルごとに遠端の解析・履歴・遅延推定器を 1 つずつ持ち、
+// 遅延はマイク 0 の近端との比較でチャネルごとに推定する。チャネルごとに整列した |X| の和を 1 つの遠端とみなし、
+// 全マイクで共有する（エコーパスはマイクごとに 1 本で、和に対して推定する）。
+// 制限: 遅延はマイク 0 に対してだけ推定し、他のマイクも同じ遅延で整列した同じ和を使う。マイクとスピーカーの
+// 距離の差で遅延がマイクごとに 1 ブロック以上ずれる配置や、チャネル間の音量比がマイクごとに大きく違う配置では
+// マイク 0 以外の消去量が落ちる。その場合は遠端をチャネルごとに分けず、マイクごとに ProcessBlock で処理する。
+// 和が 16 ビットを超えるブロックは、全帯域を同じだけ右シフトして収める（帯域ごとには飽和させない）。
+// 1 ブロックの処理量は 再生チャネル数 + マイク数 に比例する。num_render が 1 なら CreateAecmMultiCapture と同じ。
+// InitAecmMultiCapture / DestroyAecmMultiCapture はそのまま使える。
+AecmMultiCapture* CreateAecmMultiRender(int num_render, int num_mics);
+// farend[ch]: 再生チャネルごとの遠端 1 ブロック。ProcessMultiCaptureBlock と同じく out[mic] に出力する。
+int ProcessMultiRenderBlock(AecmMultiCapture* multi,
+                            const int16_t* const* farend,
+                            const int16_t* const* nearend,
+                            int16_t* const* out);
+// 再生チャネルごとの直近の遅延推定値（num_render が 1 ならマイク 0 の値）
+int GetMultiRenderDelay(const AecmMultiCapture* multi, int channel);
+
+#endif  // AECM_MULTI_H_
@@ -0,0 +1,416 @@
+#include "aecm_offline.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <string.h>
+
+#include "aecm.h"
+#include "aecm_pool.h"
+#include "aecm_state.h"
+
+#define OFFLINE_CHUNK_BLOCKS 16 // スレッドが 1 回に取る仕事の大きさ（ブロック）
+
+// 1 ブロック分の作業領域
+struct OfflineBlock {
+  AecmFarBlock far;
+  const uint16_t* X_mag; // |X|（非圧縮形式では far.entry、圧縮形式では X_mag_buf を指す）
+  uint16_t X_mag_buf[PART_LEN1];
+  AecmNearBlock near;
+  AecmOutputBlock output;
+};
+
+typedef void (*OfflineJob)(AecmOfflineEngine* engine, int begin, int end);
+
+struct AecmOfflineEngine {
+  // スレッドプール。呼び出し元も仕事をするので、workers は threads - 1 本。
+  int threads;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  uint64_t generation = 0; // 仕事を出すたびに増やす
+  int pending = 0; // 仕事を終えていない worker の数
+  bool quit = false;
+
+  // 実行中の仕事
+  OfflineJob job = NULL;
+  int job_count = 0;
+  int job_chunk = 0; // 1 回に取る仕事の数
+  std::atomic<int> next{0};
+
+  // 処理中の区間
+  const int16_t* farend = NULL;
+  const int16_t* nearend = NULL;
+  int first = 0; // 区間の先頭ブロックの番号（呼び出し全体での）
+  int16_t first_x_frame[PART_LEN2]; // 呼び出し全体の先頭ブロックの窓（直前のブロックはインスタンスから）
+  int16_t first_y_frame[PART_LEN2];
+
+  // 区間並列処理（ProcessSegmentedBlocks）
+  int16_t* out = NULL;
+  int nblocks = 0;
+  int segments = 0;
+  int overlap_blocks = 0;
+  bool warm_start = false;
+  AecmState** instances = NULL;
+  AecmState* snapshot = NULL; // 先頭の区間を先頭部分まで処理した時点の状態の複製
+  bool snapshot_ready = false; // mutex で保護
+  std::condition_variable snapshot_cv;
+  std::atomic<bool> segment_error{false};
+  int16_t* crossfade = NULL; // 区間ごとに、境目の前の出力（AECM_SEGMENT_CROSSFADE_BLOCKS ブロック）
+
+  AecmOfflineStats stats;
+  OfflineBlock blocks[AECM_OFFLINE_SEGMENT_BLOCKS];
+};
+
+static void RunJobChunks(AecmOfflineEngine* engine) {
+  for (;;) {
+    const int begin = engine->next.fetch_add(engine->job_chunk, std::memory_order_relaxed);
+    if (begin >= engine->job_count) {
+      return;
+    }
+    const int end = MIN(begin + engine->job_chunk, engine->job_count);
+    engine->job(engine, begin, end);
+  }
+}
+
+static void WorkerMain(AecmOfflineEngine* engine) {
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(engine->mutex);
+      engine->start_cv.wait(lock, [&] { return engine->quit || engine->generation != seen; });
+      if (engine->quit) {
+        return;
+      }
+      seen = engine->generation;
+    }
+    RunJobChunks(engine);
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    if (--engine->pending == 0) {
+      engine->done_cv.notify_one();
+    }
+  }
+}
+
+// job を [0, count) について chunk 個ずつ全スレッドで実行し、終わるまで待つ。
+// 仕事は番号順に取られるので、後の番号の仕事が前の番号の仕事の途中経過を待ってもよい。
+static void RunParallel(AecmOfflineEngine* engine, OfflineJob job, int count, int chunk) {
+  engine->job = job;
+  engine->job_count = count;
+  engine->job_chunk = chunk;
+  engine->next.store(0, std::memory_order_relaxed);
+  if (!engine->workers.empty()) {
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    engine->pending = (int)engine->workers.size();
+    engine->generation++;
+  }
+  engine->start_cv.notify_all();
+  RunJobChunks(engine);
+  std::unique_lock<std::mutex> lock(engine->mutex);
+  engine->done_cv.wait(lock, [&] { return engine->pending == 0; });
+}
+
+// 1. 解析: 遠端・近端の窓掛け・FFT・振幅。窓は直前と今回のブロックにまたがるので入力配列から直接変換する。
+static void AnalyzeJob(AecmOfflineEngine* engine, int begin, int end) {
+  for (int k = begin; k < end; k++) {
+    const int n = engine->first + k;
+    OfflineBlock* block = &engine->blocks[k];
+    const int16_t* x_frame = n == 0 ? engine->first_x_frame : engine->farend + (n - 1) * BLOCK_LEN;
+    const int16_t* y_frame = n == 0 ? engine->first_y_frame : engine->nearend + (n - 1) * BLOCK_LEN;
+    block->X_mag = TransformFarFrame(x_frame, &block->far, block->X_mag_buf);
+    AnalyzeNearBlock(y_frame, &block->near);
+  }
+}
+
+// 3. 合成: IFFT・合成窓
+static void SynthesizeJob(AecmOfflineEngine* engine, int begin, int end) {
+  for (int k = begin; k < end; k++) {
+    SynthesizeOutputBlock(&engine->blocks[k].output);
+  }
+}
+
+// 区間並列処理: 区間 k は [SegmentStart(k), SegmentStart(k + 1)) のブロックを出力する。
+static int SegmentStart(const AecmOfflineEngine* engine, int k) {
+  return (int)((int64_t)engine->nblocks * k / engine->segments);
+}
+
+// 区間 k の前に処理して状態を慣らすブロック数（出力しない）
+static int SegmentPrimeBlocks(const AecmOfflineEngine* engine, int k) {
+  return k == 0 ? 0 : MIN(engine->overlap_blocks, SegmentStart(engine, k));
+}
+
+// 区間 k の境目の前で前の区間の出力と混ぜるブロック数（慣らす区間の末尾, 前の区間に収まる長さ）
+static int SegmentCrossfadeBlocks(const AecmOfflineEngine* engine, int k) {
+  if (k == 0) {
+    return 0;
+  }
+  const int previous = SegmentStart(engine, k) - SegmentStart(engine, k - 1);
+  return MIN(MIN(AECM_SEGMENT_CROSSFADE_BLOCKS, SegmentPrimeBlocks(engine, k)), previous);
+}
+
+// 先頭の区間を何ブロック処理した時点の状態を他の区間へ引き継ぐか
+static int SegmentSnapshotBlocks(const AecmOfflineEngine* engine) {
+  return MIN(AECM_SEGMENT_SNAPSHOT_BLOCKS, SegmentStart(engine, 1));
+}
+
+// 区間数以上のスレッドがあるときに、最後の区間が終わるまでに順に処理するブロック数。
+// 区間 k（k > 0）は先頭の区間の複製を待つだけなので、区間数が増えても長くならない。
+static int SegmentCriticalPath(const AecmOfflineEngine* engine) {
+  int critical = 0;
+  for (int k = 0; k < engine->segments; k++) {
+    const int start = (k > 0 && engine->warm_start) ? SegmentSnapshotBlocks(engine) : 0;
+    const int length = SegmentStart(engine, k + 1) - SegmentStart(engine, k);
+    critical = MAX(critical, start + SegmentPrimeBlocks(engine, k) + length);
+  }
+  return critical;
+}
+
+static void ProcessSegment(AecmOfflineEngine* engine, int k) {
+  const int begin = SegmentStart(engine, k);
+  const int end = SegmentStart(engine, k + 1);
+  const int fade_begin = begin - SegmentCrossfadeBlocks(engine, k);
+  const bool publish = engine->warm_start && k == 0 && engine->segments > 1;
+  int16_t* crossfade = engine->crossfade + (size_t)k * AECM_SEGMENT_CROSSFADE_BLOCKS * BLOCK_LEN;
+  int16_t discard[BLOCK_LEN];
+
+  AecmState* selected = GetSelectedAecm();
+  SelectAecm(engine->instances[k]);
+  if (k > 0 && engine->warm_start) {
+    // 先頭の区間を先頭部分まで処理した状態から始める（前の区間を待つと、待ちが区間数に比例して連なる）。
+    // 時間領域バッファは別の時刻のものなので空にする。
+    {
+      std::unique_lock<std::mutex> lock(engine->mutex);
+      engine->snapshot_cv.wait(lock, [&] { return engine->snapshot_ready; });
+    }
+    AecmState* aecm = engine->instances[k];
+    CopyAecmState(aecm, engine->snapshot);
+    memset(aecm->xBuf, 0, sizeof(aecm->xBuf));
+    memset(aecm->yBuf, 0, sizeof(aecm->yBuf));
+    memset(aecm->eOverlapBuf, 0, sizeof(aecm->eOverlapBuf));
+  }
+  for (int n = begin - SegmentPrimeBlocks(engine, k); n < end; n++) {
+    int16_t* e_block = discard;
+    if (n >= begin) {
+      e_block = engine->out + (size_t)n * BLOCK_LEN;
+    } else if (n >= fade_begin) {
+      e_block = crossfade + (n - fade_begin) * BLOCK_LEN;
+    }
+    if (ProcessBlock(engine->farend + (size_t)n * BLOCK_LEN, engine->nearend + (size_t)n * BLOCK_LEN, e_block) != 0) {
+      engine->segment_error.store(true, std::memory_order_relaxed);
+    }
+    if (publish && n + 1 == SegmentSnapshotBlocks(engine)) {
+      CopyAecmState(engine->snapshot, engine->instances[k]);
+      {
+        std::lock_guard<std::mutex> lock(engine->mutex);
+        engine->snapshot_ready = true;
+      }
+      engine->snapshot_cv.notify_all();
+    }
+  }
+  SelectAecm(selected);
+}
+
+static void SegmentJob(AecmOfflineEngine* engine, int begin, int end) {
+  for (int k = begin; k < end; k++) {
+    ProcessSegment(engine, k);
+  }
+}
+
+// 境目の前の区間で、前の区間の出力から次の区間の出力へ直線的に移す
+static void StitchSegments(AecmOfflineEngine* engine) {
+  for (int k = 1; k < engine->segments; k++) {
+    const int length = SegmentCrossfadeBlocks(engine, k) * BLOCK_LEN;
+    const int16_t* next = engine->crossfade + (size_t)k * AECM_SEGMENT_CROSSFADE_BLOCKS * BLOCK_LEN;
+    int16_t* out = engine->out + (size_t)SegmentStart(engine, k) * BLOCK_LEN - length;
+    for (int i = 0; i < length; i++) {
+      const int32_t w = i + 1;
+      out[i] = (int16_t)((out[i] * (length + 1 - w) + next[i] * w) / (length + 1));
+    }
+  }
+}
+
+static double ElapsedMs(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+AecmOfflineEngine* CreateAecmOfflineEngine(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = (int)std::thread::hardware_concurrency();
+    if (num_threads <= 0) {
+      num_threads = 1;
+    }
+  }
+  AecmOfflineEngine* engine = new (std::nothrow) AecmOfflineEngine;
+  if (!engine) {
+    return NULL;
+  }
+  engine->threads = num_threads;
+  memset(&engine->stats, 0, sizeof(engine->stats));
+  engine->stats.threads = num_threads;
+  for (int i = 1; i < num_threads; i++) {
+    engine->workers.emplace_back(WorkerMain, engine);
+  }
+  return engine;
+}
+
+void DestroyAecmOfflineEngine(AecmOfflineEngine* engine) {
+  if (!engine) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    engine->quit = true;
+  }
+  engine->start_cv.notify_all();
+  for (std::thread& worker : engine->workers) {
+    worker.join();
+  }
+  delete engine;
+}
+
+int ProcessOfflineBlocks(AecmOfflineEngine* engine,
+                         const int16_t* farend,
+                         const int16_t* nearend,
+                         int16_t* out,
+                         int nblocks) {
+  if (nblocks <= 0) {
+    return 0;
+  }
+  AecmState* aecm = GetSelectedAecm();
+  const bool defer = CanDeferOutput();
+  engine->farend = farend;
+  engine->nearend = nearend;
+  memset(&engine->stats, 0, sizeof(engine->stats));
+  engine->stats.threads = engine->threads;
+  engine->stats.deferred_synthesis = defer ? 1 : 0;
+
+  // 先頭ブロックの窓の前半は、前回の呼び出し（または ProcessBlock）の最後のブロック
+  memcpy(engine->first_x_frame, aecm->xBuf, sizeof(int16_t) * PART_LEN);
+  memcpy(engine->first_x_frame + PART_LEN, farend, sizeof(int16_t) * PART_LEN);
+  memcpy(engine->first_y_frame, aecm->yBuf, sizeof(int16_t) * PART_LEN);
+  memcpy(engine->first_y_frame + PART_LEN, nearend, sizeof(int16_t) * PART_LEN);
+
+  int ret = 0;
+  for (int first = 0; first < nblocks; first += AECM_OFFLINE_SEGMENT_BLOCKS) {
+    const int count = MIN(AECM_OFFLINE_SEGMENT_BLOCKS, nblocks - first);
+    engine->first = first;
+
+    auto t0 = std::chrono::steady_clock::now();
+    RunParallel(engine, AnalyzeJob, count, OFFLINE_CHUNK_BLOCKS);
+    engine->stats.analysis_ms += ElapsedMs(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < count; k++) {
+      const int n = first + k;
+      OfflineBlock* block = &engine->blocks[k];
+      AecmOutputBlock* deferred = defer ? &block->output : NULL;
+      if (ProcessTransformedBlock(&block->far, block->X_mag, &block->near, nearend + n * BLOCK_LEN,
+                                  out + n * BLOCK_LEN, deferred) != 0) {
+        ret = -1;
+        if (deferred) {
+          // 出力を作らなかったブロックは無音とし、オーバーラップも切る
+          deferred->needs_ifft = false;
+          memset(deferred->current, 0, sizeof(deferred->current));
+          memset(deferred->overlap, 0, sizeof(deferred->overlap));
+        }
+      }
+    }
+    engine->stats.sequential_ms += ElapsedMs(t0);
+
+    if (defer) {
+      t0 = std::chrono::steady_clock::now();
+      RunParallel(engine, SynthesizeJob, count, OFFLINE_CHUNK_BLOCKS);
+      // オーバーラップ加算はブロック順に（1 ブロック PART_LEN 回の加算と、自動利得制御のリミッタだけ）
+      for (int k = 0; k < count; k++) {
+        OverlapAddOutputBlock(&engine->blocks[k].output, out + (first + k) * BLOCK_LEN);
+      }
+      engine->stats.synthesis_ms += ElapsedMs(t0);
+    }
+  }
+
+  // 遠端の時間領域バッファを ProcessBlock で処理した場合と同じ状態にする
+  memcpy(aecm->xBuf, farend + (nblocks - 1) * BLOCK_LEN, sizeof(int16_t) * PART_LEN);
+  memcpy(aecm->xBuf + PART_LEN, farend + (nblocks - 1) * BLOCK_LEN, sizeof(int16_t) * PART_LEN);
+  return ret;
+}
+
+int ProcessSegmentedBlocks(AecmOfflineEngine* engine,
+                           const int16_t* farend,
+                           const int16_t* nearend,
+                           int16_t* out,
+                           int nblocks,
+                           int segments,
+                           int overlap_blocks,
+                           int warm_start) {
+  if (nblocks <= 0) {
+    return 0;
+  }
+  if (segments <= 0) {
+    segments = engine->threads;
+  }
+  engine->nblocks = nblocks;
+  engine->segments = MIN(segments, nblocks);
+  engine->overlap_blocks = MAX(overlap_blocks, 0);
+  engine->warm_start = warm_start != 0;
+  if (SegmentCriticalPath(engine) >= nblocks) {
+    // 分けても逐次処理より速くならない（録音が慣らしと引き継ぎに比べて短い）ので、1 区間で処理する
+    engine->segments = 1;
+  }
+  segments = engine->segments;
+  AecmPool* pool = CreateAecmPool(segments + 1, 0);
+  if (!pool) {
+    return -1;
+  }
+  std::vector<AecmState*> instances(segments);
+  // 負荷軽減レベルは呼び出し側で選択中のインスタンスのものを引き継ぐ
+  const int16_t load_shed_level = (int16_t)GetLoadShedLevel();
+  for (int k = 0; k < segments; k++) {
+    instances[k] = AecmPoolAcquire(pool);
+    instances[k]->loadShedLevel = load_shed_level;
+  }
+  AecmState* snapshot = AecmPoolAcquire(pool);
+  std::vector<int16_t> crossfade((size_t)segments * AECM_SEGMENT_CROSSFADE_BLOCKS * BLOCK_LEN);
+
+  engine->farend = farend;
+  engine->nearend = nearend;
+  engine->out = out;
+  engine->instances = instances.data();
+  engine->snapshot = snapshot;
+  engine->snapshot_ready = false;
+  engine->crossfade = crossfade.data();
+  engine->segment_error.store(false, std::memory_order_relaxed);
+
+  const auto t0 = std::chrono::steady_clock::now();
+  RunParallel(engine, SegmentJob, segments, 1);
+  StitchSegments(engine);
+
+  memset(&engine->stats, 0, sizeof(engine->stats));
+  engine->stats.threads = engine->threads;
+  engine->stats.segments = segments;
+  engine->stats.segment_ms = ElapsedMs(t0);
+  engine->stats.critical_path_blocks = SegmentCriticalPath(engine);
+  for (int k = 0; k < segments; k++) {
+    engine->stats.warm_starts += (k > 0 && engine->warm_start) ? 1 : 0;
+    engine->stats.overhead_blocks += SegmentPrimeBlocks(engine, k);
+  }
+
+  for (int k = 0; k < segments; k++) {
+    AecmPoolRelease(pool, instances[k]);
+  }
+  AecmPoolRelease(pool, snapshot);
+  DestroyAecmPool(pool);
+  engine->instances = NULL;
+  engine->snapshot = NULL;
+  engine->crossfade = NULL;
+  return engine->segment_error.load(std::memory_order_relaxed) ? -1 : 0;
+}
+
+void GetAecmOfflineStats(const AecmOfflineEngine* engine, AecmOfflineStats* stats) {
+  *stats = engine->stats;
+}
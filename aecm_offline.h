@@ -0,0 +1,66 @@
+#ifndef AECM_OFFLINE_H_
+#define AECM_OFFLINE_H_
+
+#include <stdint.h>
+
+#include "aecm_defines.h"
+
+// 入力がすべて手元にある場合（ファイル処理など）の並列処理エンジン。処理の分け方は 2 通り。
+//   ProcessOfflineBlocks: 1 つのインスタンスの処理を段に分ける。出力は逐次処理と同じ。
+//   ProcessSegmentedBlocks: 録音を区間に分け、区間ごとのインスタンスで処理する。長い録音向け。
+// ProcessOfflineBlocks: 1 ブロックの処理のうち、窓掛け・FFT・|X|・|Y| と、IFFT・合成窓は入力サンプル（と抑圧後のスペクトル）だけで決まる。
+// そこで AECM_OFFLINE_SEGMENT_BLOCKS ブロックごとに次の 3 段で処理する。
+//   1. 解析: 全ブロックの遠端・近端の変換をスレッドプールで並列に行う
+//   2. 逐次: 遠端の2値化・遅延推定・整列・NLMS・マスクをブロック順に行う（呼び出したスレッド）
+//   3. 合成: IFFT・合成窓を並列に行い、オーバーラップ加算をブロック順に行う
+// 出力は ProcessBlock をブロックごとに呼んだ場合とビット単位で一致する。
+// 統計レベル 2（SetStatsLevel）では抑圧量の集計が出力を使うため、3 の合成も 2 の中で逐次に行う。
+// 処理するのは呼び出したスレッドで SelectAecm したインスタンス。
+typedef struct AecmOfflineEngine AecmOfflineEngine;
+
+// num_threads: 呼び出し元を含めたスレッド数（0 なら CPU 数）。確保できなければ NULL。
+AecmOfflineEngine* CreateAecmOfflineEngine(int num_threads);
+void DestroyAecmOfflineEngine(AecmOfflineEngine* engine);
+
+// nblocks ブロック分（各配列 nblocks * BLOCK_LEN サンプル）を処理する。戻り値は ProcessBlocks と同じ。
+int ProcessOfflineBlocks(AecmOfflineEngine* engine,
+                         const int16_t* farend,
+                         const int16_t* nearend,
+                         int16_t* out,
+                         int nblocks);
+
+// 長い録音の区間並列処理。nblocks ブロックを segments 個の区間（0 ならスレッド数）に分け、区間ごとに別のインスタンスで
+// 並列に処理する。区間 k（k > 0）は直前の overlap_blocks ブロックを先に処理して状態を慣らし、自分の区間だけを出力する。
+// 境目の前 AECM_SEGMENT_CROSSFADE_BLOCKS ブロックは、前の区間の出力から慣らしの出力へクロスフェードする。
+// warm_start が非0なら、区間 k は先頭の区間を AECM_SEGMENT_SNAPSHOT_BLOCKS ブロック処理した時点の
+// インスタンスの複製（チャネル・トラッカ・遅延推定器）から始める。待つのは先頭の区間のそこまでだけで、区間どうしは連ならない。
+// 分けても順に処理するブロック数（critical_path_blocks）が nblocks を下回らないときは 1 区間で処理する。
+// 出力は先頭の区間を除いて ProcessBlock での逐次処理とは一致しない。統計レベル（SetStatsLevel）などの設定は共通。
+// 選択中のインスタンスは使わず、変えない。戻り値は ProcessBlocks と同じ（インスタンスを確保できなければ -1）。
+int ProcessSegmentedBlocks(AecmOfflineEngine* engine,
+                           const int16_t* farend,
+                           const int16_t* nearend,
+                           int16_t* out,
+                           int nblocks,
+                           int segments,
+                           int overlap_blocks,
+                           int warm_start);
+
+// 直近の ProcessOfflineBlocks / ProcessSegmentedBlocks の内訳（ミリ秒）
+typedef struct {
+  int threads; // 呼び出し元を含めたスレッド数
+  // ProcessOfflineBlocks
+  int deferred_synthesis; // 1: 合成を並列に行った, 0: 逐次段の中で行った（統計レベル 2）
+  double analysis_ms; // 1. 解析
+  double sequential_ms; // 2. 逐次
+  double synthesis_ms; // 3. 合成
+  // ProcessSegmentedBlocks
+  int segments; // 区間数（分けても速くならないときは 1）
+  int warm_starts; // 前の区間の状態から始めた区間の数
+  int overhead_blocks; // 状態を慣らすために余分に処理したブロック数
+  int critical_path_blocks; // 区間数以上のスレッドがあるときに、最後の区間が終わるまでに順に処理するブロック数
+  double segment_ms; // 全体
+} AecmOfflineStats;
+void GetAecmOfflineStats(const AecmOfflineEngine* engine, AecmOfflineStats* stats);
+
+#endif  // AECM_OFFLINE_H_
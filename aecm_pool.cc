@@ -0,0 +1,202 @@
+#include "aecm_pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <new>
+
+#include "aecm_state.h"
+
+#define AECM_POOL_HUGE_PAGE (2 * 1024 * 1024) // MAP_HUGETLB で確保するときの切り上げ単位
+
+// 空いている枠は先頭に次の空き枠へのポインタを置いて連結する。
+struct FreeSlot {
+  FreeSlot* next;
+};
+
+// 領域の先頭に置く管理情報。続いてインスタンス本体の枠、休止状態の枠が並ぶ。
+struct alignas(AECM_CACHE_LINE) AecmPool {
+  size_t reserved_bytes;
+  int huge_pages;
+  int max_instances;
+  int max_sleeping;
+  int active;
+  int sleeping;
+  int peak_active;
+  int peak_sleeping;
+  int populated; // 1: ページを先に割り当てた（MAP_POPULATE）
+  FreeSlot* free_instances;
+  FreeSlot* free_sleeping;
+  AecmState* instances;
+  AecmSleepState* sleep_states;
+};
+
+// 大きなページでの確保を試み、できなければ通常のページで確保して透過的な大きなページを勧める。
+// どちらの場合もページは先に割り当てておき、取得時にページフォールトが起きないようにする。
+static void* MapPoolMemory(size_t bytes, size_t* reserved_bytes, int* huge_pages, int* populated) {
+  int populate = 0;
+#ifdef MAP_POPULATE
+  populate = MAP_POPULATE;
+#endif
+  *populated = (populate != 0);
+#ifdef MAP_HUGETLB
+  const size_t huge_bytes = (bytes + AECM_POOL_HUGE_PAGE - 1) / AECM_POOL_HUGE_PAGE * AECM_POOL_HUGE_PAGE;
+  void* huge = mmap(NULL, huge_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+  if (huge != MAP_FAILED) {
+    *reserved_bytes = huge_bytes;
+    *huge_pages = 1;
+    return huge;
+  }
+#endif
+  void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+  *reserved_bytes = bytes;
+  *huge_pages = 0;
+  return p;
+}
+
+AecmPool* CreateAecmPool(int max_instances, int max_sleeping) {
+  if (max_instances <= 0 || max_sleeping < 0) {
+    return NULL;
+  }
+  const size_t bytes = sizeof(AecmPool) + sizeof(AecmState) * (size_t)max_instances +
+                       sizeof(AecmSleepState) * (size_t)max_sleeping;
+  size_t reserved_bytes = 0;
+  int huge_pages = 0;
+  int populated = 0;
+  uint8_t* base = (uint8_t*)MapPoolMemory(bytes, &reserved_bytes, &huge_pages, &populated);
+  if (!base) {
+    return NULL;
+  }
+
+  AecmPool* pool = (AecmPool*)base;
+  memset(pool, 0, sizeof(AecmPool));
+  pool->reserved_bytes = reserved_bytes;
+  pool->huge_pages = huge_pages;
+  pool->populated = populated;
+  pool->max_instances = max_instances;
+  pool->max_sleeping = max_sleeping;
+  pool->instances = (AecmState*)(base + sizeof(AecmPool));
+  pool->sleep_states = (AecmSleepState*)(base + sizeof(AecmPool) + sizeof(AecmState) * (size_t)max_instances);
+
+  // 先頭の枠から順に取り出されるよう、後ろから連結する
+  for (int i = max_instances - 1; i >= 0; i--) {
+    pool->free_instances = new (&pool->instances[i]) FreeSlot{pool->free_instances};
+  }
+  for (int i = max_sleeping - 1; i >= 0; i--) {
+    pool->free_sleeping = new (&pool->sleep_states[i]) FreeSlot{pool->free_sleeping};
+  }
+  return pool;
+}
+
+void DestroyAecmPool(AecmPool* pool) {
+  if (!pool) {
+    return;
+  }
+  munmap(pool, pool->reserved_bytes);
+}
+
+// 空き枠に本体を構築して取り出す。AecmState はキューの位置（std::atomic）を含むので、
+// mmap した領域をそのまま使わず placement new で構築する（値初期化で全体を 0 にする）。
+// InitAecm はまだ呼ばない。
+static AecmState* PopInstance(AecmPool* pool) {
+  FreeSlot* slot = pool->free_instances;
+  if (!slot) {
+    return NULL;
+  }
+  pool->free_instances = slot->next;
+  pool->active++;
+  if (pool->active > pool->peak_active) {
+    pool->peak_active = pool->active;
+  }
+  return new (slot) AecmState();
+}
+
+// 本体を破棄して空き枠に戻す
+static void PushInstance(AecmPool* pool, AecmState* aecm) {
+  aecm->~AecmState();
+  pool->free_instances = new (aecm) FreeSlot{pool->free_instances};
+  pool->active--;
+}
+
+AecmState* AecmPoolAcquire(AecmPool* pool) {
+  AecmState* aecm = PopInstance(pool);
+  if (!aecm) {
+    return NULL;
+  }
+  AecmState* selected = GetSelectedAecm();
+  SelectAecm(aecm);
+  InitAecm();
+  SelectAecm(selected);
+  return aecm;
+}
+
+void AecmPoolRelease(AecmPool* pool, AecmState* aecm) {
+  if (aecm == GetSelectedAecm()) {
+    SelectAecm(NULL);
+  }
+  PushInstance(pool, aecm);
+}
+
+AecmSleepState* AecmPoolHibernate(AecmPool* pool, AecmState* aecm) {
+  FreeSlot* slot = pool->free_sleeping;
+  if (!slot) {
+    return NULL;
+  }
+  pool->free_sleeping = slot->next;
+  pool->sleeping++;
+  if (pool->sleeping > pool->peak_sleeping) {
+    pool->peak_sleeping = pool->sleeping;
+  }
+
+  AecmSleepState* sleep = (AecmSleepState*)slot;
+  AecmState* selected = GetSelectedAecm();
+  SelectAecm(aecm);
+  HibernateAecm(sleep);
+  SelectAecm(selected == aecm ? NULL : selected);
+  PushInstance(pool, aecm);
+  return sleep;
+}
+
+AecmState* AecmPoolResume(AecmPool* pool, AecmSleepState* sleep) {
+  AecmState* aecm = PopInstance(pool);
+  if (!aecm) {
+    return NULL;
+  }
+  AecmState* selected = GetSelectedAecm();
+  SelectAecm(aecm);
+  ResumeAecm(sleep);
+  SelectAecm(selected);
+
+  FreeSlot* slot = (FreeSlot*)sleep;
+  slot->next = pool->free_sleeping;
+  pool->free_sleeping = slot;
+  pool->sleeping--;
+  return aecm;
+}
+
+void GetAecmPoolStats(const AecmPool* pool, AecmPoolStats* stats) {
+  stats->reserved_bytes = pool->reserved_bytes;
+  stats->instance_bytes = sizeof(AecmState);
+  stats->sleep_bytes = sizeof(AecmSleepState);
+  stats->used_bytes = sizeof(AecmState) * (size_t)pool->active + sizeof(AecmSleepState) * (size_t)pool->sleeping;
+  // 空き枠は後入れ先出しなので、一度でも使った枠は先頭から peak_active / peak_sleeping 個に限られる
+  stats->resident_bytes = pool->populated ? pool->reserved_bytes
+                                          : sizeof(AecmPool) + sizeof(AecmState) * (size_t)pool->peak_active +
+                                                sizeof(AecmSleepState) * (size_t)pool->peak_sleeping;
+  stats->max_instances = pool->max_instances;
+  stats->max_sleeping = pool->max_sleeping;
+  stats->active = pool->active;
+  stats->sleeping = pool->sleeping;
+  stats->peak_active = pool->peak_active;
+  stats->peak_sleeping = pool->peak_sleeping;
+  stats->huge_pages = pool->huge_pages;
+}
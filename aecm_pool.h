@@ -0,0 +1,51 @@
+#ifndef AECM_POOL_H_
+#define AECM_POOL_H_
+
+#include <stddef.h>
+
+#include "aecm.h"
+
+// AECM インスタンスのプール。作成時に 1 回だけ大きな領域を確保し（可能なら大きなページ）、
+// 以降のインスタンスの取得・返却・休止・再開では malloc もシステムコールも行わない。
+// 休止 (hibernate) は通話の保留・ミュートなどで処理を止めたインスタンスを最小限の状態
+// （保存チャネル・遅延の確定値・エネルギートラッカ, AecmSleepState）に要約し、本体の枠をプールへ返す。
+// 再開 (resume) は空いている本体に初期化と状態の書き戻しを行う（数マイクロ秒）。
+// 空いた枠のページは OS に返さない（再開でページフォールトやシステムコールを起こさないため）。
+// 休止で減るのはプール内の使用量 (used_bytes) で、プロセスの常駐量 (resident_bytes) は減らない。
+// 同じプールを複数のスレッドから操作するときは呼び出し側で排他すること。
+typedef struct AecmPool AecmPool;
+typedef struct AecmSleepState AecmSleepState;
+
+// max_instances: 同時に処理できるインスタンス数, max_sleeping: 同時に休止できるインスタンス数。
+// 確保できなければ NULL。
+AecmPool* CreateAecmPool(int max_instances, int max_sleeping);
+void DestroyAecmPool(AecmPool* pool);
+
+// 初期化済みのインスタンスを取り出す（選択中のインスタンスは変えない）。空きがなければ NULL。
+AecmState* AecmPoolAcquire(AecmPool* pool);
+void AecmPoolRelease(AecmPool* pool, AecmState* aecm);
+
+// aecm を休止状態に要約して本体をプールへ返す。休止枠に空きがなければ NULL（aecm はそのまま）。
+AecmSleepState* AecmPoolHibernate(AecmPool* pool, AecmState* aecm);
+// 休止状態から本体を取り出して再開する。本体に空きがなければ NULL（sleep はそのまま）。
+AecmState* AecmPoolResume(AecmPool* pool, AecmSleepState* sleep);
+
+// プールのメモリ使用状況
+typedef struct {
+  size_t reserved_bytes; // 確保した領域全体（大きなページのときはその境界への切り上げ込み）
+  size_t instance_bytes; // インスタンス 1 つの大きさ
+  size_t sleep_bytes; // 休止状態 1 つの大きさ
+  size_t used_bytes; // 使用中のインスタンスと休止状態の合計
+  size_t resident_bytes; // 物理メモリに載っている量。先に割り当てたとき（MAP_POPULATE）は reserved_bytes、
+                         // そうでなければ一度でも使った枠の合計（ページ単位の切り上げは含まない）
+  int max_instances;
+  int max_sleeping;
+  int active; // 使用中のインスタンス数
+  int sleeping; // 休止中のインスタンス数
+  int peak_active; // active の最大値
+  int peak_sleeping; // sleeping の最大値
+  int huge_pages; // 1: 大きなページ（MAP_HUGETLB）で確保できた, 0: 通常のページ
+} AecmPoolStats;
+void GetAecmPoolStats(const AecmPool* pool, AecmPoolStats* stats);
+
+#endif  // AECM_POOL_H_
@@ -0,0 +1,233 @@
+#ifndef AECM_STATE_H_
+#define AECM_STATE_H_
+
+#include <stdint.h>
+
+#include "aecm.h"
+#include "aecm_defines.h"
+#include "delay_estimator.h"
+#include "util.h"
+
+// 遠端スペクトル履歴の要素の型
+#if AECM_COMPACT_HISTORY
+typedef uint8_t FarHistoryWord; // 圧縮形式: PART_LEN1 個の対数振幅の符号 + 基準オクターブ 1 バイト
+#else
+typedef uint16_t FarHistoryWord; // |X|
+#endif
+
+// 遠端 1 ブロックの解析結果。再生側（窓掛け・FFT・2値化）で作り、収録側が履歴と遅延推定器に積む。
+struct AecmFarBlock {
+  FarHistoryWord entry[FAR_HISTORY_ENTRY_LEN]; // 遠端スペクトル履歴のエントリ
+  uint32_t binary; // 遅延推定用の2値スペクトル
+};
+
+// 近端 1 ブロックの解析結果。窓掛け・FFT の入力は直前と今回の 2 ブロック分の近端サンプルだけで決まり、
+// インスタンスの状態を読み書きしない。
+struct AecmNearBlock {
+  ComplexInt16 Y_freq[PART_LEN2]; // Y の周波数領域表現
+  uint16_t Y_mag[PART_LEN1]; // |Y| Yの絶対値スペクトル
+  uint32_t Y_mag_sum; // sum(|Y|)
+};
+
+// 出力の合成（IFFT・合成窓・オーバーラップ加算）を後回しにするときの 1 ブロック分。
+// current / overlap がそろえば、出力は SAT(current + 前のブロックの overlap)。
+struct AecmOutputBlock {
+  bool needs_ifft; // true: E を IFFT して current / overlap を求める。false: current / overlap は計算済み
+  ComplexInt16 E[PART_LEN1]; // 抑圧後のスペクトル
+  int16_t current[PART_LEN]; // 今回のブロックの前半（オーバーラップ加算前）
+  int16_t overlap[PART_LEN]; // 次のブロックへ足すオーバーラップ分
+  AecmSpectrumBlock* spectrum; // NULL でなければ合成の材料を作らず、周波数領域の出力をここへ書く（ProcessBlockSpectrum）
+};
+
+// ProcessBlock のデバッグ統計（SetStatsLevel, 100 ブロックごとに stderr へ出力）の集計。
+// パイプライン構成を切り替えても集計が続くよう、InitAecm では消さない。
+struct AecmDebugStats {
+  int dbg_sup_counter; // 抑圧量を集計したブロック数
+  int dbg_ss_counter; // 状態ログのブロック数
+  int initialized; // best_gain / best_db が今回の区間で設定済みか
+  int pending_suppression_log; // 次の出力後に抑圧量のログを出す
+  double best_gain; // 区間内で最小の平均マスク
+  double best_db; // 上記の dB 値
+  double suppression_freq_input_energy; // 周波数領域での入力エネルギー
+  double suppression_freq_mask_removed; // マスクで除いたエネルギー
+  double suppression_freq_nlp_removed; // NLP で除いたエネルギー
+  double suppression_freq_actual_energy; // 実際に残ったエネルギー
+  double suppression_freq_switch_energy; // 最小ゲインを全ビンに掛けた場合に残るエネルギー
+  double suppression_input_energy; // 時間領域での入力エネルギー
+  double suppression_output_energy; // 時間領域での出力エネルギー
+};
+
+// AECM 1 インスタンス分の状態。1 回の確保で連続した領域に置く。
+// 区画はアクセス頻度で分け、それぞれキャッシュライン境界から始める。
+//   hot     : 毎ブロック読み書きするスカラー・65 ビン配列・時間領域バッファ（L1 に載せたい部分）
+//   delay   : 遅延推定器（遅延候補ごとの配列を毎ブロック走査する）
+//   history : 遠端スペクトル履歴（大きいが、1 ブロックで書く・読むのは 1 エントリずつ）
+//   render  : 再生側だけが書く状態（遠端の時間領域バッファ）と、再生側から収録側への遠端解析結果のキュー
+//             （SpscRingBuffer。書き込み位置と読み出し位置は別のラインにあり、2 つのスレッドが同じラインを書かない）
+//   stats   : デバッグ統計の集計（統計レベル 1 以上のときだけ触る）
+// 構造体全体もキャッシュライン境界に揃うので、インスタンスを配列に並べて別々のコアで
+// 処理しても隣のインスタンスとラインを共有しない（false sharing が起きない）。
+struct alignas(AECM_CACHE_LINE) AecmState {
+  // ---- hot ----
+  // 毎ブロック更新するスカラー（先頭の 1 ラインに収める）
+  uint32_t totCount; // 処理済みブロック数のカウンタ
+  int32_t mseAdaptOld; // 適応チャネルの過去 MSE
+  int32_t mseStoredOld; // 保存チャネルの過去 MSE
+  int32_t mseThreshold; // MSE ベースのしきい値（可変）
+  int xHistoryPos; // 遠端スペクトル履歴の書き込みインデックス
+  int last_estimated_delay_blocks; // 直近の遅延推定結果。単位は BLOCK_LEN サンプル（1 ブロック）
+
+  // dfa: Dynamic Fixed-point Alignment
+  int16_t dfaCleanQDomain; // クリーン成分の Q-domain 推定値
+  int16_t dfaCleanQDomainOld; // 上記の1ブロック前の値
+  int16_t dfaNoisyQDomain; // 雑音成分の Q-domain 推定値
+  int16_t dfaNoisyQDomainOld; // 雑音 Q-domain の1ブロック前の値
+
+  int16_t farLogEnergy; // 遠端信号の対数エネルギー最新値
+  int16_t farEnergyMin; // 遠端エネルギーの最小値トラッカ
+  int16_t farEnergyMax; // 遠端エネルギーの最大値トラッカ
+  int16_t farEnergyMaxMin; // 遠端エネルギーのレンジ指標
+  int16_t farEnergyVAD; // 遠端 VAD 用エネルギーしきい値
+  int16_t farEnergyMSEThres; // MSE 判定をするための遠端エネルギー基準値
+  int16_t vadUpdateCount; // VAD 関連の更新カウンタ
+  int16_t startupState; // 起動フェーズの状態
+  int16_t mseChannelCount; // MSE 判定でのチャネル更新回数
+  int16_t supGain; // 現在の抑圧ゲイン（Q8）
+  int16_t supGainOld; // 直前の抑圧ゲイン（Q8）
+  int16_t numPosCoefPrev; // GMaskPrev の非0係数の数
+  int16_t agcLevel; // 自動利得制御: マスク後の出力レベルの平滑値（log2 の Q8, AGC_LEVEL_UNSET で未測定）
+  int16_t agcNoiseLevel; // 自動利得制御: マスク後の出力の雑音レベル（log2 の Q8, 最小値を追う）
+  int16_t agcGain; // 自動利得制御: 現在のゲイン（log2 の Q8）
+  int16_t agcLimiterGain; // 自動利得制御: 出力リミッタのゲイン（Q14）
+  bool currentVAD; // 近端 VAD の現在のフラグ。声があるならtrue
+  bool firstVAD; // VAD 初回検出フラグ。検出済みならtrue
+  uint32_t farQueueUnderruns; // 遠端解析結果のキューが空で遠端を無音とみなしたブロック数
+  int32_t loadShedBudgetUs; // 負荷軽減: 1 ブロックの処理時間予算（マイクロ秒, 0 で自動制御なし）
+  int32_t loadShedAvgUs; // 負荷軽減: 処理時間の平滑値（マイクロ秒）
+  int16_t loadShedLevel; // 負荷軽減レベル（0..LOAD_SHED_LEVEL_MAX）。InitAecm をまたいで保持する
+  int16_t loadShedHold; // 負荷軽減: 次のレベル変更までの残りブロック数
+
+  // 65 ビン配列（32 ビット → 16 ビットの順に詰める）
+  int32_t HAdapt32[PART_LEN1]; // 適応エコーパス係数（拡張Q31）
+  int32_t sMagSmooth[PART_LEN1]; // 推定エコー振幅の平滑値
+  uint32_t nsYMagSmooth[PART_LEN1]; // 雑音抑圧用の近端 |Y| の平滑値（Q8）
+  uint32_t nsNoiseMag[PART_LEN1]; // 定常雑音の振幅の推定値（Q8, 平滑値の最小値を追う）
+  int16_t HStored[PART_LEN1]; // 保存エコーパス係数（Q15）
+  int16_t HAdapt16[PART_LEN1]; // 適応エコーパス係数（Q15）
+  int16_t yMagSmooth[PART_LEN1]; // 近端スペクトル振幅の平滑値
+  int16_t GMaskPrev[PART_LEN1]; // 前回計算したマスク（NLP 前, Q14）
+  int16_t nsGain[PART_LEN1]; // 雑音抑圧ゲイン（Q14, 平滑化後）
+
+  // 対数エネルギー履歴（毎ブロック 1 つずらす）
+  int16_t nearLogEnergy[MAX_LOG_LEN]; // 近端信号の対数エネルギー履歴
+  int16_t echoAdaptLogEnergy[MAX_LOG_LEN]; // 適応エコーパスによる対数エネルギー履歴
+  int16_t echoStoredLogEnergy[MAX_LOG_LEN]; // 保存エコーパスによる対数エネルギー履歴
+
+  // 時間領域バッファ
+  int16_t yBuf[PART_LEN2]; // 近端時間領域バッファ（FFT入力）
+  int16_t eOverlapBuf[PART_LEN]; // IFFT のオーバーラップ保存領域
+  int16_t farTrackerHold; // 遠端エネルギーのトラッカを止めておく残りブロック数（再開直後、遠端スペクトル履歴が埋まるまで）
+  const AecmState* farSource; // NULL 以外: 遠端スペクトル履歴と2値スペクトル履歴はこのインスタンスのものを読む（マルチマイク）
+
+  // ---- delay ----
+  alignas(AECM_CACHE_LINE) DelayEstimatorFarend delay_farend; // 遠端側（2値スペクトル履歴）
+  DelayEstimator delay_near; // 近端側（平滑化ビット数・ヒストグラム）
+
+  // ---- history ----
+  // 遠端スペクトル履歴（遅延候補ごと, 1 エントリ FAR_HISTORY_ENTRY_LEN 要素）
+  alignas(AECM_CACHE_LINE) FarHistoryWord xHistory[FAR_HISTORY_ENTRY_LEN * MAX_DELAY];
+
+  // ---- render ----
+  alignas(AECM_CACHE_LINE) int16_t xBuf[PART_LEN2]; // 遠端時間領域バッファ（FFT入力）
+  uint32_t farQueueOverflows; // キューが満杯で捨てた遠端ブロック数（再生側が書く）
+  AecmFarBlock farQueueData[AECM_FAR_QUEUE_LEN]; // 遠端解析結果のキューの格納先
+  SpscRingBuffer farQueue; // 遠端解析結果のキュー（書き込み位置・読み出し位置はそれぞれ別のライン）
+
+  // ---- stats ----
+  alignas(AECM_CACHE_LINE) AecmDebugStats stats; // ProcessBlock のデバッグ統計（インスタンスごとに集計する）
+};
+
+static_assert(sizeof(AecmState) % AECM_CACHE_LINE == 0, "AecmState がキャッシュライン長の倍数ではありません");
+static_assert((AECM_FAR_QUEUE_LEN & (AECM_FAR_QUEUE_LEN - 1)) == 0, "AECM_FAR_QUEUE_LEN は 2 のべき乗にしてください");
+static_assert(std::atomic<size_t>::is_always_lock_free, "キューの位置の更新がロックフリーではありません");
+
+// 休止中のインスタンスが保持する最小限の状態（保存チャネル・遅延の確定値・エネルギートラッカ）。
+// 時間領域バッファ・スペクトル履歴・適応チャネル・平滑値は持たず、再開時は保存チャネルから作り直す。
+struct alignas(AECM_CACHE_LINE) AecmSleepState {
+  int16_t HStored[PART_LEN1]; // 保存エコーパス係数（Q15）
+  int16_t farEnergyMin;
+  int16_t farEnergyMax;
+  int16_t farEnergyMaxMin;
+  int16_t farEnergyVAD;
+  int16_t farEnergyMSEThres;
+  int16_t supGain;
+  int16_t startupState;
+  int32_t mseThreshold;
+  uint32_t totCount;
+  int last_estimated_delay_blocks;
+  // 遅延推定器が確定している遅延と、その信頼度
+  int last_delay;
+  int32_t last_delay_probability;
+  int32_t minimum_probability;
+  float last_delay_histogram;
+  float delay_histogram; // histogram[last_delay]
+  const AecmState* farSource; // 遠端を共有していたインスタンス（ShareFarState, NULL で自分の遠端）
+};
+
+// ---- ProcessOfflineBlocks（aecm_offline.cc）が使う処理段 ----
+// 入力サンプルだけで決まる変換。x_frame / y_frame は直前と今回のブロックを並べた PART_LEN2 サンプル。
+// インスタンスの状態を読み書きしないので、別スレッドから同時に呼べる。TransformFarFrame は |X| を返す。
+const uint16_t* TransformFarFrame(const int16_t* x_frame, AecmFarBlock* far, uint16_t* X_mag_buf);
+void AnalyzeNearBlock(const int16_t* y_frame, AecmNearBlock* near);
+// TransformFarFrame を 2 段に分けたもの。x_frame の窓掛け・FFT（X_freq は PART_LEN1 ビン）と、
+// X_freq から |X| と履歴のエントリを求める段（DC とナイキストの虚部を 0 にする）。どちらもインスタンスの状態を読み書きしない。
+void TransformFarSpectrum(const int16_t* x_frame, ComplexInt16* X_freq);
+const uint16_t* FarSpectrumToEntry(ComplexInt16* X_freq, AecmFarBlock* far, uint16_t* X_mag_buf);
+// 変換済みの 1 ブロックを選択中のインスタンスで処理する（遠端の2値化から）。ProcessBlock と同じ結果になる。
+// deferred が NULL でなければ出力の合成を行わずに deferred へ残す（e_block も eOverlapBuf も書かない）。
+int ProcessTransformedBlock(AecmFarBlock* far, const uint16_t* X_mag, const AecmNearBlock* near,
+                            const int16_t* y_block, int16_t* e_block, AecmOutputBlock* deferred);
+// 合成を後回しにできるか（抑圧量の集計は出力を使うので、統計レベル 2 では後回しにできない）。
+bool CanDeferOutput();
+// 後回しにした合成の IFFT・合成窓。別スレッドから同時に呼べる。
+void SynthesizeOutputBlock(AecmOutputBlock* deferred);
+// 後回しにした合成の current / overlap を、選択中のインスタンスでブロック順にオーバーラップ加算して out に書く。
+// 自動利得制御が有効ならリミッタを通す（無効なら SAT(current + eOverlapBuf)）。
+void OverlapAddOutputBlock(const AecmOutputBlock* output, int16_t* out);
+
+// ---- AecmMultiCapture（aecm_multi.cc）が使う遠端の共有 ----
+// 選択中のインスタンスの遠端スペクトル履歴・遅延推定器の2値スペクトル履歴の代わりに source のものを読むようにする
+// （NULL で自分のものに戻す）。InitAecm すると自分のものに戻る。
+void ShareFarState(const AecmState* source);
+// 遠端を共有しているインスタンスで近端 1 ブロックを処理する。同じブロックの遠端は source 側の ProcessBlock で
+// 処理済みであること。出力は、同じ遠端を自分で処理するインスタンスの ProcessBlock とビット単位で一致する。
+int ProcessSharedFarBlock(const int16_t* nearend, int16_t* out);
+
+// ---- 複数スピーカー（aecm_multi.cc）が使う処理段 ----
+// 近端 1 ブロックを時間領域バッファに置いて変換する（ProcessAlignedBlock の前に呼ぶ）。
+void AnalyzeCaptureBlock(const int16_t* nearend, AecmNearBlock* near);
+// 選択中のインスタンスを 1 つの再生チャネルとして使い、遠端 1 ブロックを解析して履歴に積み、
+// Y_mag（基準のマイクの |Y|）との比較で遅延を推定して、整列した |X| を X_mag_aligned に書く。
+// 戻り値は遅延（ブロック）。推定器のエラーなら -1 で、X_mag_aligned は 0。
+int AnalyzeRenderChannel(const int16_t* farend, const uint16_t* Y_mag, uint16_t* X_mag_aligned);
+// 整列済みの遠端 |X| で近端 1 ブロック（AnalyzeCaptureBlock 済み）を処理する。delay は遅延の推定値として記録する。
+int ProcessAlignedBlock(const uint16_t* X_mag_aligned, int delay, const AecmNearBlock* near, int16_t* out);
+
+// ---- 会議ブリッジ（aecm_bridge.cc）が使う周波数領域の遠端 ----
+// 遠端を時間領域の代わりに周波数領域（TransformFarSpectrum と同じ形式）で受け取り、近端 1 ブロックを処理する。
+// 遠端の時間領域バッファ（xBuf）は使わない。X_freq は書き換える（FarSpectrumToEntry）。戻り値は ProcessBlock と同じ。
+int ProcessFarSpectrumBlock(ComplexInt16* X_freq, const int16_t* nearend, int16_t* out);
+
+// 選択中のインスタンスの定常雑音の推定を近端 |Y| で 1 ブロック進め、雑音抑圧ゲイン（Q14）を G_ns に書く。
+// 抑圧レベル（SetNoiseSuppression）が 0 ならゲインは 1。
+void UpdateNoiseSuppressionGain(const uint16_t* Y_mag, int16_t* G_ns);
+
+// dst を src の複製にする（遠端解析結果のキューは空にする）。どちらも選択中でなくてよい。
+void CopyAecmState(AecmState* dst, const AecmState* src);
+
+// 選択中のインスタンスを休止状態へ要約する。
+void HibernateAecm(AecmSleepState* sleep);
+// 選択中のインスタンスを初期化し、休止状態から再開する。遠端を共有していたなら共有も戻す（共有元は再開時にも有効であること）。
+void ResumeAecm(const AecmSleepState* sleep);
+
+#endif  // AECM_STATE_H_
@@ -0,0 +1,109 @@
+#include "aecm_stream.h"
+
+#include <string.h>
+
+#include "aecm.h"
+
+// 最大公約数（先に入れておく無音の長さの計算用）
+static int Gcd(int a, int b) {
+  while (b != 0) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// リング先頭の 1 ブロックを指すポインタを返す。容量とブロックの読み出しが BLOCK_LEN 単位なので
+// ブロックは連続しているが、末尾ちょうどで止まっている場合は 2 つ目の領域が先頭になる。
+static const int16_t* PeekBlock(RingBuffer* ring) {
+  void* ptr_1;
+  void* ptr_2;
+  size_t bytes_1;
+  size_t bytes_2;
+  GetBufferReadRegions(ring, BLOCK_LEN, &ptr_1, &bytes_1, &ptr_2, &bytes_2);
+  return (const int16_t*)(bytes_1 > 0 ? ptr_1 : ptr_2);
+}
+
+// 出力リングの書き込み位置の 1 ブロックを指すポインタを返す（同じ理由で連続している）。
+static int16_t* ReserveBlock(RingBuffer* ring) {
+  void* ptr_1;
+  void* ptr_2;
+  size_t bytes_1;
+  size_t bytes_2;
+  GetBufferWriteRegions(ring, BLOCK_LEN, &ptr_1, &bytes_1, &ptr_2, &bytes_2);
+  return (int16_t*)(bytes_1 > 0 ? ptr_1 : ptr_2);
+}
+
+void InitAecmStream(AecmStream* stream, int frame_len) {
+  static_assert(AECM_STREAM_CAPACITY % BLOCK_LEN == 0, "AECM_STREAM_CAPACITY は BLOCK_LEN の倍数");
+  InitBufferWith(&stream->far, stream->far_data, AECM_STREAM_CAPACITY, sizeof(int16_t));
+  InitBufferWith(&stream->near, stream->near_data, AECM_STREAM_CAPACITY, sizeof(int16_t));
+  InitBufferWith(&stream->out, stream->out_data, AECM_STREAM_CAPACITY, sizeof(int16_t));
+
+  // 各呼び出しの終わりにたまる近端の端数は最大で BLOCK_LEN - gcd(frame_len, BLOCK_LEN)。
+  // その分の無音を出力に先行させておけば、毎回 frame_len サンプルを返せる。
+  stream->latency_samples = frame_len > 0 ? BLOCK_LEN - Gcd(frame_len, BLOCK_LEN) : BLOCK_LEN - 1;
+  stream->underruns = 0;
+  // 読み出し位置を戻して、リング末尾（InitBuffer でゼロクリア済み）を無音として読ませる。
+  // 書き込み位置は 0 のままなので、出力ブロックもリング上で連続する。
+  MoveReadPtr(&stream->out, -stream->latency_samples);
+}
+
+void AecmStreamFar(AecmStream* stream, const int16_t* far, size_t samples) {
+  if (samples > AECM_STREAM_CAPACITY) {
+    far += samples - AECM_STREAM_CAPACITY;
+    samples = AECM_STREAM_CAPACITY;
+  }
+  const size_t free_samples = available_write(&stream->far);
+  if (samples > free_samples) {
+    // 捨てる量をブロック単位に切り上げて、読み出し位置をブロック境界に保つ（ブロックがリング末尾で分かれないように）。
+    // たまっている分より多くなるなら全部捨て、リングを先頭から使い直す。
+    const size_t drop = (samples - free_samples + BLOCK_LEN - 1) / BLOCK_LEN * BLOCK_LEN;
+    if (drop >= available_read(&stream->far)) {
+      InitBuffer(&stream->far);
+    } else {
+      MoveReadPtr(&stream->far, (int)drop);
+    }
+  }
+  WriteBuffer(&stream->far, far, samples);
+}
+
+// 近端リングにたまったブロックをすべて処理し、結果を出力リングへ書く。
+static void ProcessStreamBlocks(AecmStream* stream) {
+  static const int16_t kSilence[BLOCK_LEN] = {0};
+  while (available_read(&stream->near) >= BLOCK_LEN && available_write(&stream->out) >= BLOCK_LEN) {
+    const bool has_far = available_read(&stream->far) >= BLOCK_LEN;
+    const int16_t* far_block = has_far ? PeekBlock(&stream->far) : kSilence;
+    ProcessBlock(far_block, PeekBlock(&stream->near), ReserveBlock(&stream->out));
+    MoveWritePtr(&stream->out, BLOCK_LEN);
+    MoveReadPtr(&stream->near, BLOCK_LEN);
+    if (has_far) {
+      MoveReadPtr(&stream->far, BLOCK_LEN);
+    }
+  }
+}
+
+void AecmStreamNear(AecmStream* stream, const int16_t* near, int16_t* out, size_t samples) {
+  size_t in_done = 0;
+  size_t out_done = 0;
+  while (in_done < samples) {
+    const size_t written = WriteBuffer(&stream->near, near + in_done, samples - in_done);
+    in_done += written;
+    ProcessStreamBlocks(stream);
+    out_done += ReadBuffer(&stream->out, NULL, out + out_done, samples - out_done);
+    if (written == 0) {
+      break; // 出力リングが詰まって処理が進まない（通常は起きない）
+    }
+  }
+  if (out_done < samples) {
+    // 出力が足りない: 無音で埋め、以降の出力はその分だけ遅れる
+    memset(out + out_done, 0, sizeof(int16_t) * (samples - out_done));
+    stream->latency_samples += (int)(samples - out_done);
+    stream->underruns++;
+  }
+}
+
+int GetAecmStreamLatency(const AecmStream* stream) {
+  return stream->latency_samples;
+}
@@ -0,0 +1,43 @@
+#ifndef AECM_STREAM_H_
+#define AECM_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aecm_defines.h"
+#include "util.h"
+
+// 任意のフレーム長で使えるストリーミング API。遠端（再生）と近端（録音）を別々の長さで渡してよく、
+// 内部のリングバッファ（util.h の RingBuffer）にためて BLOCK_LEN ごとに ProcessBlock を呼ぶ。
+// リングの容量は BLOCK_LEN の倍数で、ブロックは常にリング上で連続するため、
+// ProcessBlock はリング内の遠端・近端を直接読み、出力リングへ直接書く（コピーしない）。
+// 処理するのは SelectAecm で選んだインスタンス。
+typedef struct AecmStream {
+  RingBuffer far;
+  RingBuffer near;
+  RingBuffer out;
+  int latency_samples; // 近端入力から出力までに加わる遅延（サンプル）
+  int underruns; // 出力が足りず無音を挟んだ回数
+  int16_t far_data[AECM_STREAM_CAPACITY];
+  int16_t near_data[AECM_STREAM_CAPACITY];
+  int16_t out_data[AECM_STREAM_CAPACITY];
+} AecmStream;
+
+// frame_len: 近端を渡すときの 1 回のサンプル数（10 ms なら 160 など）。0 なら呼び出しごとに変わってよい。
+// 出力を毎回 frame_len サンプル返せるよう、BLOCK_LEN - gcd(frame_len, BLOCK_LEN) サンプル
+// （frame_len が 0 なら BLOCK_LEN - 1）の無音を先に出力リングへ入れておく。これが加わる遅延になる。
+void InitAecmStream(AecmStream* stream, int frame_len);
+
+// 遠端（スピーカへ出す信号）を渡す。容量を超えた分は古い方から BLOCK_LEN 単位で捨てる（ブロックを連続に保つため、
+// 必要より最大 BLOCK_LEN - 1 サンプル多く捨てる）。
+void AecmStreamFar(AecmStream* stream, const int16_t* far, size_t samples);
+
+// 近端を渡し、同じ数のエコー除去済みサンプルを out に返す。
+// 近端がブロックにたまった時点で遠端が足りなければ、遠端は無音として処理する。
+// 出力が足りないとき（frame_len と違う長さで呼んだ場合など）は足りない分を無音で埋め、その分だけ遅延が増える。
+void AecmStreamNear(AecmStream* stream, const int16_t* near, int16_t* out, size_t samples);
+
+// 現在の加算遅延（サンプル）。InitAecmStream 時の値に、無音で埋めた分が加わる。
+int GetAecmStreamLatency(const AecmStream* stream);
+
+#endif  // AECM_STREAM_H_
@@ -0,0 +1,65 @@
+// RingBuffer と SpscRingBuffer の読み書きの速さ（make bench）。
+// 1 スレッドで書いてすぐ読む 1 回あたりの時間（ns）を、64 サンプル（1 ブロック）と 1 サンプルで測る。
+// 1 回目はキャッシュを温めるためで、2 回目の値を見る。
+#include <chrono>
+#include <cstdio>
+
+#include "util.h"
+
+#define BENCH_CAPACITY 4096 // キューの要素数（2 のべき乗）
+#define BENCH_BLOCK_ROUNDS 20000000 // 64 サンプルの読み書きの回数
+#define BENCH_SAMPLE_ROUNDS 100000000 // 1 サンプルの読み書きの回数
+
+static int16_t g_ring_backing[BENCH_CAPACITY];
+static int16_t g_spsc_backing[BENCH_CAPACITY];
+
+static double Now() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main() {
+  RingBuffer ring;
+  SpscRingBuffer spsc;
+  InitBufferWith(&ring, g_ring_backing, BENCH_CAPACITY, sizeof(int16_t));
+  InitSpscBufferWith(&spsc, g_spsc_backing, BENCH_CAPACITY, sizeof(int16_t));
+  int16_t block[64] = {1};
+  int16_t out[64];
+  long sum = 0; // 読み出しを最適化で消されないようにする
+
+  for (int pass = 0; pass < 2; pass++) {
+    const double t0 = Now();
+    for (int i = 0; i < BENCH_BLOCK_ROUNDS; i++) {
+      WriteBuffer(&ring, block, 64);
+      ReadBuffer(&ring, NULL, out, 64);
+      sum += out[0];
+    }
+    const double t1 = Now();
+    for (int i = 0; i < BENCH_BLOCK_ROUNDS; i++) {
+      WriteSpscBuffer(&spsc, block, 64);
+      ReadSpscBuffer(&spsc, out, 64);
+      sum += out[0];
+    }
+    const double t2 = Now();
+    printf("64-sample write+read: RingBuffer %.1f ns, SpscRingBuffer %.1f ns\n",
+           (t1 - t0) / BENCH_BLOCK_ROUNDS * 1e9, (t2 - t1) / BENCH_BLOCK_ROUNDS * 1e9);
+  }
+
+  const int16_t v = 3;
+  int16_t o = 0;
+  const double t0 = Now();
+  for (int i = 0; i < BENCH_SAMPLE_ROUNDS; i++) {
+    WriteBuffer(&ring, &v, 1);
+    ReadBuffer(&ring, NULL, &o, 1);
+    sum += o;
+  }
+  const double t1 = Now();
+  for (int i = 0; i < BENCH_SAMPLE_ROUNDS; i++) {
+    WriteSpscBuffer(&spsc, &v, 1);
+    ReadSpscBuffer(&spsc, &o, 1);
+    sum += o;
+  }
+  const double t2 = Now();
+  printf("1-sample write+read: RingBuffer %.1f ns, SpscRingBuffer %.1f ns\n",
+         (t1 - t0) / BENCH_SAMPLE_ROUNDS * 1e9, (t2 - t1) / BENCH_SAMPLE_ROUNDS * 1e9);
+  return sum == 0; // sum は正なので常に 0
+}
@@ -5,9 +5,26 @@
 #include <string>
 #include <fstream>
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "aecm.h"
 #include "aecm_defines.h"
+#include "aecm_offline.h"
+#include "aecm_pool.h"
 
 struct Wav {
   // モノラル16kHz固定。sr/chは保持しない。
@@ -17,35 +34,680 @@ struct Wav {
 uint32_t rd32le(const uint8_t* p){ return p[0] | (p[1]<<8) | (p[2]<<16) | (p[3]<<24); }
 uint16_t rd16le(const uint8_t* p){ return p[0] | (p[1]<<8); }
 
-bool read_wav_pcm16_mono16k(const std::string& path, Wav* out){
-  std::ifstream f(path, std::ios::binary);
-  if (!f) return false;
-  std::vector<uint8_t> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
-  if (buf.size() < 44) return false;
-  if (std::memcmp(buf.data(), "RIFF",4) || std::memcmp(buf.data()+8,"WAVE",4)) return false;
-  size_t pos = 12; int sr=0,ch=0,bps=0; size_t data_off=0,data_size=0;
-  while (pos + 8 <= buf.size()){
+// RIFF/WAVE ヘッダを解析して data チャンクの位置と大きさを返す（16bit PCM・16k・モノラルのみ）。
+// data の大きさが 0 か 0xFFFFFFFF（パイプで長さが決まっていない）なら *data_size は SIZE_MAX。
+bool parse_wav_header(const uint8_t* buf, size_t size, size_t* data_off, size_t* data_size){
+  if (size < 12) return false;
+  if (std::memcmp(buf, "RIFF",4) || std::memcmp(buf+8,"WAVE",4)) return false;
+  size_t pos = 12; int sr=0,ch=0,bps=0; *data_off=0;
+  while (pos + 8 <= size){
     uint32_t id = rd32le(&buf[pos]); pos+=4; uint32_t sz = rd32le(&buf[pos]); pos+=4; size_t start=pos;
     if (id == 0x20746d66){ // 'fmt '
+      if (start + 16 > size) return false;
       uint16_t fmt = rd16le(&buf[start+0]); ch = rd16le(&buf[start+2]); sr = rd32le(&buf[start+4]); bps = rd16le(&buf[start+14]);
       if (fmt != 1 || bps != 16) return false;
     } else if (id == 0x61746164){ // 'data'
-      data_off = start; data_size = sz; break;
+      *data_off = start; *data_size = (sz == 0 || sz == 0xFFFFFFFFu) ? SIZE_MAX : sz; break;
     }
     pos = start + sz;
   }
-  if (!data_off || !data_size) return false;
+  if (!*data_off) return false;
   if (sr != 16000 || ch != 1) return false; // 16k/mono固定
+  return true;
+}
+
+bool read_wav_pcm16_mono16k(const std::string& path, Wav* out){
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  std::vector<uint8_t> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  if (buf.size() < 44) return false;
+  size_t data_off=0,data_size=0;
+  if (!parse_wav_header(buf.data(), buf.size(), &data_off, &data_size)) return false;
+  if (data_size > buf.size() - data_off) data_size = buf.size() - data_off;
+  if (!data_size) return false;
   size_t ns = data_size/2; out->samples.resize(ns);
   const int16_t* p = reinterpret_cast<const int16_t*>(&buf[data_off]);
   for (size_t i=0;i<ns;i++) out->samples[i] = p[i];
   return true;
 }
 
+// PCM16 mono 16kHz の WAV ヘッダ（44 バイト）を書く
+static const long kWavHeaderBytes = 44;
+void write_wav_header(FILE* f, uint32_t data_bytes){
+  const uint32_t sr = SAMPLE_RATE_HZ;
+  const uint16_t ch = 1;
+  const uint16_t bps = 16;
+  const uint32_t byte_rate = sr * ch * (bps/8);
+  const uint16_t block_align = ch * (bps/8);
+  // RIFF header
+  std::fwrite("RIFF",1,4,f);
+  uint32_t file_size_minus_8 = 36 + data_bytes; std::fwrite(&file_size_minus_8,4,1,f);
+  std::fwrite("WAVE",1,4,f);
+  // fmt chunk
+  std::fwrite("fmt ",1,4,f);
+  uint32_t fmt_size = 16; std::fwrite(&fmt_size,4,1,f);
+  uint16_t audio_format = 1; std::fwrite(&audio_format,2,1,f);
+  std::fwrite(&ch,2,1,f);
+  std::fwrite(&sr,4,1,f);
+  std::fwrite(&byte_rate,4,1,f);
+  std::fwrite(&block_align,2,1,f);
+  std::fwrite(&bps,2,1,f);
+  // data chunk
+  std::fwrite("data",1,4,f);
+  std::fwrite(&data_bytes,4,1,f);
+}
+
+// ========================
+// ストリーミング処理（--stream）
+// ========================
+// 入力を少しずつ読み、STREAM_CHUNK_BLOCKS ブロックずつ処理して書き出す。メモリは入力の長さによらない。
+
+static const int STREAM_CHUNK_BLOCKS = 256; // 1 回に処理するブロック数
+
+// n バイト読めるまで read を繰り返す。戻り値は読めたバイト数（EOF・エラーで n 未満）。
+static size_t read_full(int fd, void* dst, size_t n){
+  size_t got = 0;
+  while (got < n){
+    ssize_t r = read(fd, (uint8_t*)dst + got, n - got);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) break;
+    got += (size_t)r;
+  }
+  return got;
+}
+
+// ストリーミング入力。通常ファイルは mmap して data チャンクを直接読み、読み終えたページは捨てる。
+// パイプ（"-" は標準入力）は read で読む。raw なら先頭からヘッダなしの s16le。
+struct PcmInput {
+  int fd = -1;
+  uint8_t* map = NULL;
+  size_t map_bytes = 0;
+  size_t data_off = 0; // map 内の data チャンクの位置
+  size_t released = 0; // 捨てたページの末尾（map の先頭からのバイト数）
+  size_t total = SIZE_MAX; // 全サンプル数（分からなければ SIZE_MAX）
+  size_t pos = 0; // 読んだサンプル数
+  bool odd_tail = false; // data が奇数バイトで、最後の 1 バイトを捨てた
+  std::vector<int16_t> buf; // read で読むときの受け皿
+};
+
+static void close_input(PcmInput* in){
+  if (in->map) munmap(in->map, in->map_bytes);
+  if (in->fd > STDIN_FILENO) close(in->fd);
+  in->map = NULL;
+  in->fd = -1;
+}
+
+static bool open_input_impl(const char* path, bool raw, PcmInput* in){
+  in->fd = std::strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+  if (in->fd < 0) return false;
+  struct stat st;
+  if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map != MAP_FAILED){
+      in->map = (uint8_t*)map;
+      in->map_bytes = (size_t)st.st_size;
+      madvise(map, in->map_bytes, MADV_SEQUENTIAL);
+      size_t data_size = in->map_bytes;
+      if (!raw && !parse_wav_header(in->map, in->map_bytes, &in->data_off, &data_size)) return false;
+      if (data_size > in->map_bytes - in->data_off) data_size = in->map_bytes - in->data_off;
+      in->total = data_size / 2;
+      in->odd_tail = (data_size & 1) != 0;
+      return true;
+    }
+  }
+  if (raw) return true;
+  // パイプの WAV: チャンク見出しを 1 つずつ読み、data の見出しの直後で止める
+  std::vector<uint8_t> hdr(12);
+  if (read_full(in->fd, hdr.data(), 12) != 12) return false;
+  for (;;){
+    size_t at = hdr.size();
+    hdr.resize(at + 8);
+    if (read_full(in->fd, &hdr[at], 8) != 8) return false;
+    if (rd32le(&hdr[at]) == 0x61746164) break; // 'data'
+    uint32_t sz = rd32le(&hdr[at + 4]);
+    if (hdr.size() + sz > 65536) return false;
+    hdr.resize(at + 8 + sz);
+    if (read_full(in->fd, &hdr[at + 8], sz) != sz) return false;
+  }
+  size_t data_off = 0, data_size = 0;
+  if (!parse_wav_header(hdr.data(), hdr.size(), &data_off, &data_size)) return false;
+  in->total = data_size == SIZE_MAX ? SIZE_MAX : data_size / 2;
+  return true;
+}
+
+// 失敗したときは開いたファイルと写像を閉じて false を返す
+static bool open_input(const char* path, bool raw, PcmInput* in){
+  if (open_input_impl(path, raw, in)) return true;
+  close_input(in);
+  return false;
+}
+
+// 最大 n サンプルを読み、先頭へのポインタを *samples に返す（mmap ならコピーしない）。戻り値は読めたサンプル数。
+static size_t read_input(PcmInput* in, size_t n, const int16_t** samples){
+  if (n > in->total - in->pos) n = in->total - in->pos;
+  if (in->map){
+    // 前回までに読んだページは処理済みなので捨てる（読み取り専用のファイル写像なので内容は失われない）
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t done = (in->data_off + in->pos * 2) / page * page;
+    if (done > in->released){
+      madvise(in->map + in->released, done - in->released, MADV_DONTNEED);
+      in->released = done;
+    }
+    *samples = reinterpret_cast<const int16_t*>(in->map + in->data_off) + in->pos;
+    in->pos += n;
+    return n;
+  }
+  if (in->buf.size() < n) in->buf.resize(n);
+  // read_full は EOF まで読み続けるので、奇数バイトで終わるのは入力の末尾だけ（半端なサンプルは捨てて知らせる）
+  const size_t bytes = read_full(in->fd, in->buf.data(), n * 2);
+  in->odd_tail |= (bytes & 1) != 0;
+  n = bytes / 2;
+  *samples = in->buf.data();
+  in->pos += n;
+  return n;
+}
+
+// 再開時に、処理済みの n サンプルを読み飛ばす
+static bool skip_input(PcmInput* in, size_t n){
+  while (n > 0){
+    const int16_t* samples;
+    size_t k = read_input(in, n < 65536 ? n : 65536, &samples);
+    if (k == 0) return false;
+    n -= k;
+  }
+  return true;
+}
+
+// 出力。処理は 2 枚のバッファの一方に書き、もう一方を書き出しスレッドが書く。
+// WAV は大きさを 0 にしたヘッダで始め、最後に data の大きさを書き戻す。"-" は標準出力へ raw PCM。
+struct PcmWriter {
+  FILE* f = NULL;
+  bool wav = false;
+  uint64_t data_bytes = 0; // 書き出したバイト数（ヘッダを除く）
+  std::vector<int16_t> buf[2];
+  int fill = 0; // 処理側が書いているバッファ
+  size_t pending = 0; // 書き出し待ちのサンプル数（buf[1 - fill]）
+  bool quit = false;
+  bool error = false;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+static void writer_main(PcmWriter* w){
+  std::unique_lock<std::mutex> lock(w->mutex);
+  for (;;){
+    w->cv.wait(lock, [&]{ return w->pending > 0 || w->quit; });
+    if (w->pending == 0) return;
+    const int16_t* p = w->buf[1 - w->fill].data();
+    const size_t n = w->pending;
+    lock.unlock();
+    const bool ok = std::fwrite(p, sizeof(int16_t), n, w->f) == n;
+    lock.lock();
+    w->error |= !ok;
+    w->data_bytes += n * sizeof(int16_t);
+    w->pending = 0;
+    w->cv.notify_all();
+  }
+}
+
+// resume_bytes > 0 なら既存の出力をその長さに切り詰めて続きから書く
+static bool open_writer(const std::string& path, bool raw, size_t capacity, uint64_t resume_bytes, PcmWriter* w){
+  if (path == "-"){
+    if (resume_bytes > 0) return false; // 標準出力は切り詰めも位置合わせもできない
+    w->f = stdout;
+  } else if (resume_bytes > 0){
+    w->f = std::fopen(path.c_str(), "r+b");
+    w->wav = !raw;
+    const uint64_t header = w->wav ? kWavHeaderBytes : 0;
+    struct stat st;
+    if (!w->f) return false;
+    if (fstat(fileno(w->f), &st) != 0 || (uint64_t)st.st_size < header + resume_bytes ||
+        ftruncate(fileno(w->f), (off_t)(header + resume_bytes)) != 0){
+      std::fclose(w->f);
+      w->f = NULL;
+      return false;
+    }
+    std::fseek(w->f, 0, SEEK_END);
+    w->data_bytes = resume_bytes;
+  } else {
+    w->f = std::fopen(path.c_str(), "wb");
+    w->wav = !raw;
+    if (w->f && w->wav) write_wav_header(w->f, 0);
+  }
+  if (!w->f) return false;
+  w->buf[0].resize(capacity);
+  w->buf[1].resize(capacity);
+  w->thread = std::thread(writer_main, w);
+  return true;
+}
+
+// 処理側が次に書くバッファ
+static int16_t* writer_buffer(PcmWriter* w){
+  return w->buf[w->fill].data();
+}
+
+// writer_buffer に書いた n サンプルを書き出しに回す。前の分の書き出しが終わっていなければ待つ。
+static void writer_submit(PcmWriter* w, size_t n){
+  std::unique_lock<std::mutex> lock(w->mutex);
+  w->cv.wait(lock, [&]{ return w->pending == 0; });
+  w->fill = 1 - w->fill;
+  w->pending = n;
+  w->cv.notify_all();
+}
+
+// 書き出し待ちがなくなるまで待ち、ファイルまで書き込む（チェックポイントの前に呼ぶ）
+static bool writer_sync(PcmWriter* w){
+  std::unique_lock<std::mutex> lock(w->mutex);
+  w->cv.wait(lock, [&]{ return w->pending == 0; });
+  if (std::fflush(w->f) != 0) return false;
+  if (w->f != stdout) fsync(fileno(w->f));
+  return !w->error;
+}
+
+static bool close_writer(PcmWriter* w){
+  bool ok = writer_sync(w);
+  {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->quit = true;
+  }
+  w->cv.notify_all();
+  w->thread.join();
+  if (w->wav){
+    const uint64_t max_bytes = 0xFFFFFFFFu - 36;
+    std::fseek(w->f, 0, SEEK_SET);
+    write_wav_header(w->f, (uint32_t)(w->data_bytes > max_bytes ? max_bytes : w->data_bytes));
+  }
+  if (w->f != stdout) ok &= std::fclose(w->f) == 0;
+  else ok &= std::fflush(w->f) == 0;
+  return ok;
+}
+
+// チェックポイント: 見出し + インスタンスの状態（SaveAecmCheckpoint）。一時ファイルに書いてから置き換える。
+struct CheckpointHeader {
+  char magic[8]; // "AECMCKP1"
+  uint32_t block_len;
+  uint32_t state_bytes;
+  uint64_t blocks; // 処理済みのブロック数（出力も同じ長さまで書けている）
+};
+
+static bool save_checkpoint(const std::string& path, uint64_t blocks){
+  std::vector<uint8_t> state(GetAecmCheckpointSize());
+  SaveAecmCheckpoint(state.data());
+  CheckpointHeader h;
+  std::memcpy(h.magic, "AECMCKP1", 8);
+  h.block_len = BLOCK_LEN;
+  h.state_bytes = (uint32_t)state.size();
+  h.blocks = blocks;
+  const std::string tmp = path + ".tmp";
+  FILE* f = std::fopen(tmp.c_str(), "wb");
+  if (!f) return false;
+  bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 && std::fwrite(state.data(), 1, state.size(), f) == state.size();
+  ok = ok && std::fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok &= std::fclose(f) == 0;
+  return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+static bool load_checkpoint(const std::string& path, uint64_t* blocks){
+  FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) return false;
+  CheckpointHeader h;
+  bool ok = std::fread(&h, sizeof(h), 1, f) == 1 && std::memcmp(h.magic, "AECMCKP1", 8) == 0 &&
+            h.block_len == BLOCK_LEN && h.state_bytes == GetAecmCheckpointSize();
+  std::vector<uint8_t> state(ok ? h.state_bytes : 0);
+  ok = ok && std::fread(state.data(), 1, state.size(), f) == state.size();
+  std::fclose(f);
+  if (!ok || RestoreAecmCheckpoint(state.data(), state.size()) != 0) return false;
+  *blocks = h.blocks;
+  return true;
+}
+
+struct StreamOptions {
+  bool raw = false; // 入出力ともヘッダなしの s16le（SAMPLE_RATE_HZ, mono）
+  std::string out = "processed.wav";
+  std::string checkpoint; // 空ならチェックポイントなし
+  int checkpoint_sec = 60;
+  bool resume = false;
+  AecmOfflineEngine* engine = NULL; // --threads のとき
+};
+
+// 途中で失敗したときに入力を閉じる。戻り値は終了コード 1。
+static int close_inputs(PcmInput* x, PcmInput* y){
+  close_input(x);
+  close_input(y);
+  return 1;
+}
+
+static int run_stream(const char* render_path, const char* capture_path, const StreamOptions& opt){
+  PcmInput x, y;
+  if (!open_input(render_path, opt.raw, &x) || !open_input(capture_path, opt.raw, &y)){
+    std::fprintf(stderr, "Failed to open inputs (16k-mono PCM16)\n");
+    return close_inputs(&x, &y);
+  }
+  InitAecm();
+  uint64_t done = 0;
+  if (opt.resume){
+    if (!load_checkpoint(opt.checkpoint, &done)){
+      std::fprintf(stderr, "Failed to load checkpoint %s\n", opt.checkpoint.c_str());
+      return close_inputs(&x, &y);
+    }
+    if (!skip_input(&x, done * BLOCK_LEN) || !skip_input(&y, done * BLOCK_LEN)){
+      std::fprintf(stderr, "Inputs are shorter than the checkpoint\n");
+      return close_inputs(&x, &y);
+    }
+  }
+  const size_t chunk = (size_t)STREAM_CHUNK_BLOCKS * BLOCK_LEN;
+  PcmWriter w;
+  if (!open_writer(opt.out, opt.raw, chunk, done * BLOCK_LEN * sizeof(int16_t), &w)){
+    std::fprintf(stderr, "Failed to open output %s\n", opt.out.c_str());
+    return close_inputs(&x, &y);
+  }
+  const uint64_t resumed = done;
+  const uint64_t checkpoint_blocks = (uint64_t)opt.checkpoint_sec * SAMPLE_RATE_HZ / BLOCK_LEN;
+  uint64_t next_checkpoint = done + checkpoint_blocks;
+  bool ok = true;
+  const auto t0 = std::chrono::steady_clock::now();
+  for (;;){
+    const int16_t* xs;
+    const int16_t* ys;
+    size_t n = read_input(&x, chunk, &xs);
+    size_t ny = read_input(&y, chunk, &ys);
+    if (ny < n) n = ny;
+    const int nblocks = (int)(n / BLOCK_LEN);
+    if (nblocks == 0) break;
+    int16_t* out = writer_buffer(&w);
+    if (opt.engine) ProcessOfflineBlocks(opt.engine, xs, ys, out, nblocks);
+    else ProcessBlocks(xs, ys, out, nblocks);
+    writer_submit(&w, (size_t)nblocks * BLOCK_LEN);
+    done += nblocks;
+    if (!opt.checkpoint.empty() && done >= next_checkpoint){
+      ok = writer_sync(&w) && save_checkpoint(opt.checkpoint, done);
+      if (!ok) break;
+      next_checkpoint = done + checkpoint_blocks;
+    }
+    if ((size_t)nblocks * BLOCK_LEN < chunk) break; // どちらかの入力の終わり
+  }
+  ok &= close_writer(&w);
+  if (x.odd_tail) std::fprintf(stderr, "Warning: %s ends with an odd byte (dropped)\n", render_path);
+  if (y.odd_tail) std::fprintf(stderr, "Warning: %s ends with an odd byte (dropped)\n", capture_path);
+  close_input(&x);
+  close_input(&y);
+  if (!ok){
+    std::fprintf(stderr, "Failed to write output or checkpoint\n");
+    return 1;
+  }
+  if (!opt.checkpoint.empty()) std::remove(opt.checkpoint.c_str()); // 最後まで処理できたので不要
+  const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  const double audio_sec = (double)(done - resumed) * BLOCK_LEN / SAMPLE_RATE_HZ;
+  std::fprintf(stderr, "[Stream] blocks=%llu (resumed at %llu) audio=%.1fs wall=%.2fs (%.0fx realtime)\n",
+               (unsigned long long)done, (unsigned long long)resumed, audio_sec, sec, sec > 0 ? audio_sec / sec : 0.0);
+  return 0;
+}
+
+// ========================
+// バッチ処理（--batch）
+// ========================
+// マニフェストの 1 行 = 1 ジョブ（render capture output を空白区切り。# 以降と空行は無視）。
+// ジョブごとにプールのインスタンスを 1 つ使い、スレッドごとのジョブ列から取り出して処理する。
+// 自分の列が空になったスレッドは他のスレッドの列の末尾から取る（ワークスティーリング）。
+
+struct BatchJob {
+  std::string render, capture, out;
+  size_t bytes = 0; // capture の大きさ（長いジョブから配る）
+  uint64_t blocks = 0; // 処理したブロック数
+  std::string error; // 空なら成功
+};
+
+struct BatchQueue {
+  std::mutex mutex;
+  std::deque<int> jobs;
+};
+
+struct BatchRun {
+  std::vector<BatchJob>* jobs;
+  std::vector<BatchQueue> queues;
+  AecmPool* pool;
+  std::mutex pool_mutex; // プールの操作は呼び出し側で排他する
+  std::atomic<int> steals{0};
+  std::vector<double> cpu_sec; // スレッドごとの CPU 時間
+};
+
+static bool read_manifest(const char* path, std::vector<BatchJob>* jobs){
+  std::ifstream f(path);
+  if (!f) return false;
+  std::string line;
+  while (std::getline(f, line)){
+    line = line.substr(0, line.find('#'));
+    char render[4096], capture[4096], out[4096];
+    if (std::sscanf(line.c_str(), "%4095s %4095s %4095s", render, capture, out) != 3) continue;
+    BatchJob job;
+    job.render = render; job.capture = capture; job.out = out;
+    struct stat st;
+    if (stat(capture, &st) == 0) job.bytes = (size_t)st.st_size;
+    jobs->push_back(job);
+  }
+  return true;
+}
+
+// 選択中のインスタンスで 1 組を処理する。失敗なら job->error に理由を入れる。
+static void batch_process(BatchJob* job){
+  PcmInput x, y;
+  FILE* f = NULL;
+  if (!open_input(job->render.c_str(), false, &x) || !open_input(job->capture.c_str(), false, &y)){
+    job->error = "cannot read inputs (16k-mono PCM16 WAV)";
+  } else if (!(f = std::fopen(job->out.c_str(), "wb"))){
+    job->error = "cannot open output";
+  } else {
+    const size_t chunk = (size_t)STREAM_CHUNK_BLOCKS * BLOCK_LEN;
+    std::vector<int16_t> out(chunk);
+    write_wav_header(f, 0);
+    bool ok = true;
+    for (;;){
+      const int16_t* xs;
+      const int16_t* ys;
+      size_t n = read_input(&x, chunk, &xs);
+      size_t ny = read_input(&y, chunk, &ys);
+      if (ny < n) n = ny;
+      const int nblocks = (int)(n / BLOCK_LEN);
+      if (nblocks == 0) break;
+      ProcessBlocks(xs, ys, out.data(), nblocks);
+      ok &= std::fwrite(out.data(), sizeof(int16_t), (size_t)nblocks * BLOCK_LEN, f) == (size_t)nblocks * BLOCK_LEN;
+      job->blocks += nblocks;
+      if (!ok || (size_t)nblocks * BLOCK_LEN < chunk) break;
+    }
+    std::fseek(f, 0, SEEK_SET);
+    write_wav_header(f, (uint32_t)(job->blocks * BLOCK_LEN * sizeof(int16_t)));
+    ok &= std::fclose(f) == 0;
+    if (!ok) job->error = "write failed";
+    else if (job->blocks == 0) job->error = "inputs shorter than one block";
+  }
+  close_input(&x);
+  close_input(&y);
+}
+
+// 自分の列の先頭、なければ他の列の末尾から 1 つ取る。残っていなければ -1。
+static int batch_next(BatchRun* run, int self){
+  const int n = (int)run->queues.size();
+  for (int k = 0; k < n; k++){
+    BatchQueue* q = &run->queues[(self + k) % n];
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (q->jobs.empty()) continue;
+    int job;
+    if (k == 0){ job = q->jobs.front(); q->jobs.pop_front(); }
+    else { job = q->jobs.back(); q->jobs.pop_back(); run->steals++; }
+    return job;
+  }
+  return -1;
+}
+
+static void batch_worker(BatchRun* run, int self){
+  timespec t0, t1;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+  for (int j; (j = batch_next(run, self)) >= 0;){
+    BatchJob* job = &(*run->jobs)[j];
+    AecmState* aecm;
+    {
+      std::lock_guard<std::mutex> lock(run->pool_mutex);
+      aecm = AecmPoolAcquire(run->pool);
+    }
+    if (!aecm){ job->error = "no free instance"; continue; }
+    SelectAecm(aecm);
+    batch_process(job);
+    SelectAecm(NULL);
+    std::lock_guard<std::mutex> lock(run->pool_mutex);
+    AecmPoolRelease(run->pool, aecm);
+  }
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+  run->cpu_sec[self] = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+}
+
+// threads スレッドで全ジョブを 1 回処理し、集計を 1 行出す。戻り値は失敗したジョブ数。
+static int run_batch(std::vector<BatchJob>* jobs, int threads){
+  BatchRun run;
+  run.jobs = jobs;
+  run.queues = std::vector<BatchQueue>(threads);
+  run.cpu_sec.assign(threads, 0.0);
+  run.pool = CreateAecmPool(threads, 0);
+  if (!run.pool){
+    std::fprintf(stderr, "Failed to create instance pool\n");
+    return (int)jobs->size();
+  }
+  std::vector<int> order(jobs->size());
+  for (size_t j = 0; j < order.size(); j++){
+    order[j] = (int)j;
+    (*jobs)[j].blocks = 0;
+    (*jobs)[j].error.clear();
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b){ return (*jobs)[a].bytes > (*jobs)[b].bytes; });
+  for (size_t k = 0; k < order.size(); k++) run.queues[k % threads].jobs.push_back(order[k]);
+  const auto t0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++) workers.emplace_back(batch_worker, &run, t);
+  batch_worker(&run, 0);
+  for (std::thread& w : workers) w.join();
+  const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  DestroyAecmPool(run.pool);
+  int failed = 0;
+  uint64_t blocks = 0;
+  double cpu = 0;
+  for (const BatchJob& job : *jobs){
+    failed += !job.error.empty();
+    blocks += job.blocks;
+  }
+  for (double c : run.cpu_sec) cpu += c;
+  const double audio = (double)blocks * BLOCK_LEN / SAMPLE_RATE_HZ;
+  std::fprintf(stderr, "[Batch] threads=%d jobs=%zu failed=%d audio=%.1fs wall=%.2fs realtime=%.0fx (%.0fx per thread, %.0fx per cpu-second) steals=%d\n",
+               threads, jobs->size(), failed, audio, wall, wall > 0 ? audio / wall : 0.0,
+               wall > 0 ? audio / wall / threads : 0.0, cpu > 0 ? audio / cpu : 0.0, run.steals.load());
+  return failed;
+}
+
+// --batch: threads スレッド（0 なら CPU 数）で処理する。scaling なら 1, 2, 4, ... threads スレッドで順に処理して比べる。
+static int batch_main(const char* manifest, int threads, bool scaling){
+  std::vector<BatchJob> jobs;
+  if (!read_manifest(manifest, &jobs)){
+    std::fprintf(stderr, "Failed to read manifest %s\n", manifest);
+    return 1;
+  }
+  if (threads <= 0) threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  // ジョブごとの状態ログは混ざるので出さない
+  SetStatsLevel(0);
+  int failed = 0;
+  for (int t = scaling ? 1 : threads; ; t = std::min(t * 2, threads)){
+    failed = run_batch(&jobs, t);
+    if (t == threads) break;
+  }
+  for (const BatchJob& job : jobs){
+    if (!job.error.empty()) std::fprintf(stderr, "[Batch] FAILED %s %s -> %s: %s\n",
+                                         job.render.c_str(), job.capture.c_str(), job.out.c_str(), job.error.c_str());
+  }
+  return failed ? 1 : 0;
+}
+
 int main(int argc, char** argv){
-  if (argc < 3){ std::fprintf(stderr, "Usage: %s <render.wav> <capture.wav>\n", argv[0]); return 1; }
+  if (argc >= 2 && std::strcmp(argv[1], "--layout") == 0){
+    // インスタンス状態の配置を表示
+    AecmLayoutReport r;
+    GetAecmLayoutReport(&r);
+    std::printf("instance: %zu bytes (%d lines)\n", r.instance_bytes, r.instance_lines);
+    std::printf("  hot: %zu bytes, delay: %zu bytes, history: %zu bytes (%zu bytes/entry), render: %zu bytes, stats: %zu bytes\n",
+                r.hot_bytes, r.delay_bytes, r.history_bytes, r.history_entry_bytes, r.render_bytes, r.stats_bytes);
+    std::printf("lines touched per block: %d\n", r.lines_per_block);
+    return 0;
+  }
+  // --threads N: ブロック間で独立な変換を N スレッドで並列に行う（0 なら CPU 数）。
+  // 合成も並列にするため統計レベルを 1 に下げる（抑圧量の集計は出ない。出力は同じ）。
+  // --segments N: 録音を N 区間に分けて区間ごとのインスタンスで並列に処理する（長い録音向け。出力は逐次処理と変わる）。
+  // --overlap-ms M: 各区間の前に状態を慣らす長さ（既定 2000 ms）。
+  // --out PATH: 出力先（既定 processed.wav）。
+  // --stream: 入力を少しずつ読みながら処理し、出力も書き出しスレッドで少しずつ書く（長さの上限なし。出力は同じ）。
+  //   入力に "-" を指定すると標準入力から読み、--out - なら標準出力へ raw PCM を書く。
+  //   --raw: 入出力をヘッダなしの s16le にする（sox/ffmpeg とのパイプ用）。
+  //   --checkpoint FILE: --checkpoint-sec 秒（既定 60）ごとに状態を保存し、--resume でその続きから処理する。
+  //   --raw / "-" / --checkpoint は --stream を含む。
+  // --ns LEVEL: 定常雑音の抑圧（0: なし, 1〜3: 下限 -6 / -10 / -15 dB）を AECM の中で行う。
+  // --agc DBFS: 自動利得制御（話し声の目標レベル -30 .. -3 dBFS, 0: なし）を AECM の中で行う。
+  // --batch MANIFEST: マニフェストの組を --threads N スレッド（既定 CPU 数）で処理する。--scaling で 1〜N スレッドを比べる。
+  int threads = -1;
+  int segments = 0;
+  int overlap_ms = 2000;
+  bool stream = false;
+  StreamOptions sopt;
+  int arg = 1;
+  bool bad = false;
+  const char* manifest = NULL;
+  bool scaling = false;
+  while (arg < argc && std::strncmp(argv[arg], "--", 2) == 0){
+    const char* opt = argv[arg++];
+    const char* val = arg < argc ? argv[arg] : NULL;
+    if (std::strcmp(opt, "--stream") == 0) stream = true;
+    else if (std::strcmp(opt, "--raw") == 0) sopt.raw = stream = true;
+    else if (std::strcmp(opt, "--resume") == 0) sopt.resume = stream = true;
+    else if (std::strcmp(opt, "--scaling") == 0) scaling = true;
+    else if (!val) bad = true;
+    else if (std::strcmp(opt, "--threads") == 0) threads = std::atoi(argv[arg++]);
+    else if (std::strcmp(opt, "--segments") == 0) segments = std::atoi(argv[arg++]);
+    else if (std::strcmp(opt, "--overlap-ms") == 0) overlap_ms = std::atoi(argv[arg++]);
+    else if (std::strcmp(opt, "--out") == 0) sopt.out = argv[arg++];
+    else if (std::strcmp(opt, "--checkpoint") == 0){ sopt.checkpoint = argv[arg++]; stream = true; }
+    else if (std::strcmp(opt, "--checkpoint-sec") == 0) sopt.checkpoint_sec = std::atoi(argv[arg++]);
+    else if (std::strcmp(opt, "--batch") == 0) manifest = argv[arg++];
+    else if (std::strcmp(opt, "--ns") == 0) SetNoiseSuppression(std::atoi(argv[arg++]));
+    else if (std::strcmp(opt, "--agc") == 0) SetAutoGainControl(std::atoi(argv[arg++]));
+    else bad = true;
+    if (bad) break;
+  }
+  if (manifest && !bad && arg == argc) return batch_main(manifest, threads, scaling);
+  if (!bad && sopt.resume && sopt.out == "-"){
+    std::fprintf(stderr, "--resume cannot continue standard output (--out -); write to a file instead\n");
+    return 1;
+  }
+  if (bad || manifest || argc - arg != 2 || (sopt.resume && sopt.checkpoint.empty())){
+    std::fprintf(stderr, "Usage: %s [--layout] [--threads N] [--segments N [--overlap-ms M]] [--out PATH] [--ns LEVEL] [--agc DBFS]\n"
+                         "       [--stream] [--raw] [--checkpoint FILE [--checkpoint-sec S] [--resume]] <render.wav> <capture.wav>\n"
+                         "       --batch MANIFEST [--threads N] [--scaling]\n", argv[0]);
+    return 1;
+  }
+  stream |= std::strcmp(argv[arg], "-") == 0 || std::strcmp(argv[arg + 1], "-") == 0 || sopt.out == "-";
+  if (stream){
+    if (segments > 0){
+      std::fprintf(stderr, "--segments needs whole inputs and cannot be combined with streaming\n");
+      return 1;
+    }
+    if (threads >= 0){
+      SetStatsLevel(1);
+      sopt.engine = CreateAecmOfflineEngine(threads);
+      if (!sopt.engine){
+        std::fprintf(stderr, "Failed to create offline engine\n");
+        return 1;
+      }
+    }
+    int ret = run_stream(argv[arg], argv[arg + 1], sopt);
+    if (sopt.engine) DestroyAecmOfflineEngine(sopt.engine);
+    return ret;
+  }
   Wav x, y;
-  if (!read_wav_pcm16_mono16k(argv[1], &x) || !read_wav_pcm16_mono16k(argv[2], &y)){
+  if (!read_wav_pcm16_mono16k(argv[arg], &x) || !read_wav_pcm16_mono16k(argv[arg + 1], &y)){
     std::fprintf(stderr, "Failed to read 16k-mono wavs\n");
     return 1;
   }
@@ -53,38 +715,48 @@ int main(int argc, char** argv){
   InitAecm();
   std::vector<int16_t> processed;
   processed.resize(N * BLOCK_LEN);
-  for (size_t n=0;n<N;n++){
-    // Farend/render と Nearend/capture を同一ブロックで処理
-    ProcessBlock(&x.samples[n * BLOCK_LEN],
-                 &y.samples[n * BLOCK_LEN],
-                 &processed[n * BLOCK_LEN]);
+  // Farend/render と Nearend/capture を同一ブロックで処理（ファイル全体をまとめて渡す）
+  if (segments > 0){
+    // 区間ごとの状態ログは混ざるので出さない
+    SetStatsLevel(0);
+    AecmOfflineEngine* engine = CreateAecmOfflineEngine(threads >= 0 ? threads : segments);
+    if (!engine){
+      std::fprintf(stderr, "Failed to create offline engine\n");
+      return 1;
+    }
+    const int overlap_blocks = (int)((int64_t)overlap_ms * SAMPLE_RATE_HZ / 1000 / BLOCK_LEN);
+    ProcessSegmentedBlocks(engine, x.samples.data(), y.samples.data(), processed.data(), (int)N, segments, overlap_blocks, 1);
+    AecmOfflineStats st;
+    GetAecmOfflineStats(engine, &st);
+    if (st.segments < segments){
+      std::fprintf(stderr, "Warning: input too short to split into %d segments; processed sequentially\n", segments);
+    }
+    std::fprintf(stderr, "[Offline] threads=%d segments=%d overhead=%d blocks critical_path=%d/%zu blocks total=%.1fms\n",
+                 st.threads, st.segments, st.overhead_blocks, st.critical_path_blocks, N, st.segment_ms);
+    DestroyAecmOfflineEngine(engine);
+  } else if (threads >= 0){
+    SetStatsLevel(1);
+    AecmOfflineEngine* engine = CreateAecmOfflineEngine(threads);
+    if (!engine){
+      std::fprintf(stderr, "Failed to create offline engine\n");
+      return 1;
+    }
+    ProcessOfflineBlocks(engine, x.samples.data(), y.samples.data(), processed.data(), (int)N);
+    AecmOfflineStats st;
+    GetAecmOfflineStats(engine, &st);
+    std::fprintf(stderr, "[Offline] threads=%d analysis=%.1fms sequential=%.1fms synthesis=%.1fms\n",
+                 st.threads, st.analysis_ms, st.sequential_ms, st.synthesis_ms);
+    DestroyAecmOfflineEngine(engine);
+  } else {
+    ProcessBlocks(x.samples.data(), y.samples.data(), processed.data(), (int)N);
   }
-  // Save processed signal as processed.wav (PCM16 mono 16kHz)
-  const uint32_t sr = SAMPLE_RATE_HZ;
-  const uint16_t ch = 1;
-  const uint16_t bps = 16;
+  // Save processed signal (PCM16 mono 16kHz)
   const uint32_t data_bytes = static_cast<uint32_t>(processed.size() * sizeof(int16_t));
-  const uint32_t byte_rate = sr * ch * (bps/8);
-  const uint16_t block_align = ch * (bps/8);
-  std::ofstream wf("processed.wav", std::ios::binary);
+  FILE* wf = std::fopen(sopt.out.c_str(), "wb");
   if (wf){
-    // RIFF header
-    wf.write("RIFF",4);
-    uint32_t file_size_minus_8 = 36 + data_bytes; wf.write(reinterpret_cast<const char*>(&file_size_minus_8),4);
-    wf.write("WAVE",4);
-    // fmt chunk
-    wf.write("fmt ",4);
-    uint32_t fmt_size = 16; wf.write(reinterpret_cast<const char*>(&fmt_size),4);
-    uint16_t audio_format = 1; wf.write(reinterpret_cast<const char*>(&audio_format),2);
-    wf.write(reinterpret_cast<const char*>(&ch),2);
-    wf.write(reinterpret_cast<const char*>(&sr),4);
-    wf.write(reinterpret_cast<const char*>(&byte_rate),4);
-    wf.write(reinterpret_cast<const char*>(&block_align),2);
-    wf.write(reinterpret_cast<const char*>(&bps),2);
-    // data chunk
-    wf.write("data",4);
-    wf.write(reinterpret_cast<const char*>(&data_bytes),4);
-    wf.write(reinterpret_cast<const char*>(processed.data()), data_bytes);
+    write_wav_header(wf, data_bytes);
+    std::fwrite(processed.data(), 1, data_bytes, wf);
+    std::fclose(wf);
   }
   return 0;
 }
@@ -5,10 +5,17 @@
 #include <stdio.h>
 
 #include <algorithm>
+#include <atomic>
 
+#include "kernels.h"
 
-constexpr int kBandFirst = 12;
-constexpr int kBandLast = 43;
+static const int32_t kMaxBitCountsQ9 = (32 << 9);  // Q9表現での一致ビット数（最大32）。
+
+// 2値スペクトルに使う帯域（約 1.5 kHz〜5.4 kHz）。ビン番号に換算し、
+// 32 ビットに収まるよう kBandStep ビンおきに使う。
+constexpr int kBandFirst = 1500 * PART_LEN2 / SAMPLE_RATE_HZ;
+constexpr int kBandLast = std::min(5375 * PART_LEN2 / SAMPLE_RATE_HZ, PART_LEN);
+constexpr int kBandStep = (kBandLast - kBandFirst) / 32 + 1;
 
 inline uint32_t SetBit(uint32_t in, int pos) {
   const uint32_t mask = (1u << pos);
@@ -18,8 +25,10 @@ inline uint32_t SetBit(uint32_t in, int pos) {
 
 
 
-DelayEstimatorFarend g_delay_farend;
-DelayEstimator g_delay_instance;
+// 処理中のインスタンスの遅延推定器状態（スレッドごと, SetDelayEstimatorState で切り替える）。
+static thread_local DelayEstimatorFarend* g_delay_farend;
+static thread_local DelayEstimator* g_delay_instance;
+static std::atomic<int> g_logging_enabled{1}; // [DelayEstimator] デバッグ出力の有無
 
 
 
@@ -57,29 +66,6 @@ int BitCount(uint32_t u32) {
   return ((int)tmp);
 }
 
-// `binary_vector` を `binary_matrix` の各行と比較し、
-// 行ごとに一致するビット数を数える。
-//
-// 入力:
-//      - binary_vector     : binary "vector" stored in a long
-//      - binary_matrix     : binary "matrix" stored as a vector of long
-//      - matrix_size       : size of binary "matrix"
-//
-// 出力:
-//      - bit_counts        : "Vector" stored as a long, containing for each
-//                            row the number of times the matrix row and the
-//                            input vector have the same value
-//
-void BitCountComparison(uint32_t binary_vector,
-                        const uint32_t* binary_matrix,
-                        int matrix_size,
-                        int32_t* bit_counts) {
-  // `binary_vector` を各行と比較
-  for (int n = 0; n < matrix_size; n++) {
-    bit_counts[n] = (int32_t)BitCount(binary_vector ^ binary_matrix[n]);
-  }
-}
-
 // HistogramBasedValidation() に必要な統計量を更新する。
 // この関数は HistogramBasedValidation() より先に呼び出す必要がある。
 // 更新される統計量は以下の通り。
@@ -243,7 +229,7 @@ int RobustValidation(const BinaryDelayEstimator* estimator_state,
 }
 
 void InitBinaryDelayEstimatorFarend() {
-  BinaryDelayEstimatorFarend& farend = g_delay_farend.binary_farend;
+  BinaryDelayEstimatorFarend& farend = g_delay_farend->binary_farend;
   memset(farend.binary_far_history, 0, sizeof(farend.binary_far_history));
   memset(farend.far_bit_counts, 0, sizeof(farend.far_bit_counts));
 }
@@ -251,7 +237,7 @@ void InitBinaryDelayEstimatorFarend() {
 
 
 void AddBinaryFarSpectrum(uint32_t binary_far_spectrum) {
-  BinaryDelayEstimatorFarend& farend = g_delay_farend.binary_farend;
+  BinaryDelayEstimatorFarend& farend = g_delay_farend->binary_farend;
   // バイナリスペクトル履歴をシフトし、現在の `binary_far_spectrum` を追加。
   memmove(&(farend.binary_far_history[1]), &(farend.binary_far_history[0]), (MAX_DELAY - 1) * sizeof(uint32_t));
   farend.binary_far_history[0] = binary_far_spectrum;
@@ -262,8 +248,8 @@ void AddBinaryFarSpectrum(uint32_t binary_far_spectrum) {
   farend.far_bit_counts[0] = BitCount(binary_far_spectrum);
 }
 void InitBinaryDelayEstimator() {
-  BinaryDelayEstimator& estimator = g_delay_instance.binary_handle;
-  estimator.farend = &g_delay_farend.binary_farend;
+  BinaryDelayEstimator& estimator = g_delay_instance->binary_handle;
+  estimator.farend = &g_delay_farend->binary_farend;
   memset(estimator.bit_counts, 0, sizeof(estimator.bit_counts));
   memset(estimator.binary_near_history, 0, sizeof(estimator.binary_near_history));
   for (int i = 0; i <= MAX_DELAY; ++i) {
@@ -300,7 +286,7 @@ void MeanEstimator(int32_t new_value,
 
 
 int ProcessBinarySpectrum(uint32_t binary_near_spectrum) {
-  BinaryDelayEstimator& estimator = g_delay_instance.binary_handle;
+  BinaryDelayEstimator& estimator = g_delay_instance->binary_handle;
 
   int candidate_delay = -1;
   int valid_candidate = 0;
@@ -315,7 +301,7 @@ int ProcessBinarySpectrum(uint32_t binary_near_spectrum) {
   estimator.binary_near_history[0] = binary_near_spectrum;
 
   // 遅延ごとのスペクトルと比較し、`bit_counts` に格納。
-  BitCountComparison(binary_near_spectrum, estimator.farend->binary_far_history, MAX_DELAY, estimator.bit_counts);
+  g_kernels.bit_count_comparison(binary_near_spectrum, estimator.farend->binary_far_history, MAX_DELAY, estimator.bit_counts);
 
   // `bit_counts` を平滑化した `mean_bit_counts` を更新。
   for (int i = 0; i < MAX_DELAY; i++) {
@@ -432,8 +418,8 @@ int ProcessBinarySpectrum(uint32_t binary_near_spectrum) {
 
   // 100 回ごとに候補やヒストグラム値などをデバッグ出力。
   // 
-  {
-    static int dbg_counter = 0;
+  if (g_logging_enabled) {
+    int& dbg_counter = g_delay_instance->dbg_counter;
     dbg_counter++;
     if (dbg_counter % 100 == 0) {
       float hist_val = 0.f;
@@ -459,7 +445,7 @@ static uint32_t BinarySpectrum(const uint16_t* spectrum,
   uint32_t out = 0;
 
   if (!(*threshold_initialized)) {
-    for (int i = kBandFirst; i <= kBandLast; i++) {
+    for (int i = kBandFirst; i <= kBandLast; i += kBandStep) {
       if (spectrum[i] > 0) {
         const int32_t spectrum_q15 = static_cast<int32_t>(spectrum[i]) << 15;
         threshold_spectrum[i] = (spectrum_q15 >> 1);
@@ -467,41 +453,56 @@ static uint32_t BinarySpectrum(const uint16_t* spectrum,
       }
     }
   }
-  for (int i = kBandFirst; i <= kBandLast; i++) {
+  for (int i = kBandFirst; i <= kBandLast; i += kBandStep) {
     const int32_t spectrum_q15 = static_cast<int32_t>(spectrum[i]) << 15;
     MeanEstimator(spectrum_q15, 6, &(threshold_spectrum[i]));
     if (spectrum_q15 > threshold_spectrum[i]) {
-      out = SetBit(out, i - kBandFirst);
+      out = SetBit(out, (i - kBandFirst) / kBandStep);
     }
   }
 
   return out;
 }
 
+void SetDelayEstimatorState(DelayEstimatorFarend* farend, DelayEstimator* instance) {
+  g_delay_farend = farend;
+  g_delay_instance = instance;
+}
+
+void SetDelayEstimatorLogging(int enable) {
+  g_logging_enabled = (enable != 0);
+}
+
 void InitDelayEstimatorFarend() {
   InitBinaryDelayEstimatorFarend();
 
-  memset(g_delay_farend.mean_far_spectrum, 0, sizeof(g_delay_farend.mean_far_spectrum));
-  g_delay_farend.far_spectrum_initialized = 0;
+  memset(g_delay_farend->mean_far_spectrum, 0, sizeof(g_delay_farend->mean_far_spectrum));
+  g_delay_farend->far_spectrum_initialized = 0;
+}
+
+uint32_t BinarizeFarSpectrum(const uint16_t* far_spectrum) {
+  return BinarySpectrum(far_spectrum, g_delay_farend->mean_far_spectrum,
+                        &(g_delay_farend->far_spectrum_initialized));
 }
 
 void AddFarSpectrum(const uint16_t* far_spectrum) {
-  const uint32_t binary_spectrum = BinarySpectrum(
-      far_spectrum, g_delay_farend.mean_far_spectrum,
-      &(g_delay_farend.far_spectrum_initialized));
-  AddBinaryFarSpectrum(binary_spectrum);
+  AddBinaryFarSpectrum(BinarizeFarSpectrum(far_spectrum));
 }
 
 void InitDelayEstimator() {
   InitBinaryDelayEstimator();
 
-  memset(g_delay_instance.mean_near_spectrum, 0, sizeof(g_delay_instance.mean_near_spectrum));
-  g_delay_instance.near_spectrum_initialized = 0;
+  memset(g_delay_instance->mean_near_spectrum, 0, sizeof(g_delay_instance->mean_near_spectrum));
+  g_delay_instance->near_spectrum_initialized = 0;
 }
 
 // 3の遅延推定を行う入り口
-int DelayEstimatorProcess(const uint16_t* near_spectrum, const uint16_t* far_spectrum) {
-  AddFarSpectrum(far_spectrum); // 
-  const uint32_t binary_spectrum = BinarySpectrum( near_spectrum, g_delay_instance.mean_near_spectrum, &(g_delay_instance.near_spectrum_initialized));
+int DelayEstimatorProcess(const uint16_t* near_spectrum, uint32_t binary_far_spectrum) {
+  AddBinaryFarSpectrum(binary_far_spectrum);
+  return DelayEstimatorProcessNear(near_spectrum);
+}
+
+int DelayEstimatorProcessNear(const uint16_t* near_spectrum) {
+  const uint32_t binary_spectrum = BinarySpectrum( near_spectrum, g_delay_instance->mean_near_spectrum, &(g_delay_instance->near_spectrum_initialized));
   return ProcessBinarySpectrum(binary_spectrum);
 }
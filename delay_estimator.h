@@ -1,10 +1,9 @@
+#ifndef DELAY_ESTIMATOR_H_
+#define DELAY_ESTIMATOR_H_
+
 #include <stdint.h>
 #include "aecm_defines.h"
 
- 
-
-static const int32_t kMaxBitCountsQ9 = (32 << 9);  // Q9表現での一致ビット数（最大32）。
-
 typedef struct {
   // 固定長履歴（MAX_DELAY固定）。
   int far_bit_counts[MAX_DELAY];
@@ -36,20 +35,26 @@ typedef struct {
 } BinaryDelayEstimator;
 
 typedef struct {
+  // 2値化のしきい値（BinarizeFarSpectrum だけが更新する。再生側・収録側の分割処理では再生側が持つ）
   int32_t mean_far_spectrum[PART_LEN1];
   int far_spectrum_initialized;
 
-  BinaryDelayEstimatorFarend binary_farend;
+  // 2値スペクトル履歴（収録側が持つ）。上とはキャッシュラインを分ける
+  alignas(AECM_CACHE_LINE) BinaryDelayEstimatorFarend binary_farend;
 } DelayEstimatorFarend;
 
 typedef struct {
   int32_t mean_near_spectrum[PART_LEN1];
   int near_spectrum_initialized;
+  int dbg_counter; // [DelayEstimator] デバッグ出力の間隔を数えるカウンタ（InitDelayEstimator では消さない）
 
   BinaryDelayEstimator binary_handle;
 } DelayEstimator;
 
-// 動的確保APIは削除（固定長・単一インスタンス前提）。
+// 動的確保APIは削除（固定長）。状態の実体は各 AECM インスタンス（aecm_state.h）が持つ。
+
+// 以降の関数が処理する遅延推定器の状態を切り替える（AECM がインスタンスを選ぶときに呼ぶ）。
+void SetDelayEstimatorState(DelayEstimatorFarend* farend, DelayEstimator* instance);
 
 // 遅延推定器の遠端状態を初期化する。
 void InitBinaryDelayEstimatorFarend();
@@ -72,11 +77,19 @@ void InitBinaryDelayEstimator();
 int ProcessBinarySpectrum(uint32_t binary_near_spectrum);
 
 
-// 遠端側の単一インスタンス遅延推定器状態を初期化する。
+// 遠端側の遅延推定器状態を初期化する。
 void InitDelayEstimatorFarend();
-// 近端側の単一インスタンス遅延推定器状態を初期化する。
+// 遠端スペクトルを2値化する（しきい値を更新し、履歴には追加しない）。
+uint32_t BinarizeFarSpectrum(const uint16_t* far_spectrum);
+// 遠端スペクトルを2値化して履歴へ追加する（近端処理は行わない）。
+void AddFarSpectrum(const uint16_t* far_spectrum);
+// 近端側の遅延推定器状態を初期化する。
 void InitDelayEstimator();
-// 最新の近端スペクトルを処理し、推定された遅延を返す。
-int DelayEstimatorProcess(const uint16_t* near_spectrum, const uint16_t* far_spectrum);
-
- 
+// 2値化済みの遠端スペクトルを履歴へ追加してから最新の近端スペクトルを処理し、推定された遅延を返す。
+int DelayEstimatorProcess(const uint16_t* near_spectrum, uint32_t binary_far_spectrum);
+// 近端スペクトルだけを処理して遅延を返す（遠端の2値スペクトル履歴は別のインスタンスが進めている場合）。
+int DelayEstimatorProcessNear(const uint16_t* near_spectrum);
+// [DelayEstimator] デバッグ出力の有効/無効（既定は有効）。
+void SetDelayEstimatorLogging(int enable);
+
+#endif  // DELAY_ESTIMATOR_H_
@@ -0,0 +1,312 @@
+// ホットループのカーネルを命令セット別にコンパイルし、実行時に CPU に合わせて選ぶ。
+#include "kernels.h"
+
+#include <chrono>
+#include <mutex>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "aecm.h"
+#include "kernels_impl.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define AECM_KERNELS_X86 1
+#endif
+
+// 同じカーネル本体を target 属性付きの関数に展開し、その版のカーネル表 kKernels_<suffix> を作る。
+#define AECM_DEFINE_KERNELS(suffix, label, attr)                                          \
+  attr static void WindowAndFFT_##suffix(int16_t* fft, const int16_t* time_signal,       \
+                                         ComplexInt16* freq_signal, int part_len,        \
+                                         const int16_t* sqrt_hanning) {                  \
+    WindowAndFFTKernel(fft, time_signal, freq_signal, part_len, sqrt_hanning);           \
+  }                                                                                       \
+  attr static void InverseFFTOverlapAdd_##suffix(const ComplexInt16* efw,                 \
+                                                 const int16_t* sqrt_hanning,             \
+                                                 int16_t* overlap_buf, int16_t* out) {    \
+    InverseFFTOverlapAddKernel(efw, sqrt_hanning, overlap_buf, out);                      \
+  }                                                                                       \
+  attr static void Magnitude_##suffix(ComplexInt16* freq_signal, uint16_t* freq_signal_abs, \
+                                      uint32_t* freq_signal_sum_abs) {                    \
+    MagnitudeKernel(freq_signal, freq_signal_abs, freq_signal_sum_abs);                   \
+  }                                                                                       \
+  attr static void BitCountComparison_##suffix(uint32_t binary_vector,                    \
+                                               const uint32_t* binary_matrix,             \
+                                               int matrix_size, int32_t* bit_counts) {    \
+    BitCountComparisonKernel(binary_vector, binary_matrix, matrix_size, bit_counts);     \
+  }                                                                                       \
+  attr static void UpdateChannel_##suffix(const uint16_t* X_mag, const uint16_t* Y_mag,   \
+                                          int16_t mu, int16_t dfa_noisy_q_domain,         \
+                                          int32_t* h_adapt32, int16_t* h_adapt16) {       \
+    UpdateChannelKernel(X_mag, Y_mag, mu, dfa_noisy_q_domain, h_adapt32, h_adapt16);     \
+  }                                                                                       \
+  attr static int16_t SuppressionMask_##suffix(const int32_t* S_mag, const uint16_t* Y_mag, \
+                                               int16_t sup_gain, int16_t y_mag_q_domain_diff, \
+                                               int with_ratio, int32_t* s_mag_smooth,     \
+                                               int16_t* y_mag_smooth, int16_t* G_mask) {  \
+    return SuppressionMaskKernel(S_mag, Y_mag, sup_gain, y_mag_q_domain_diff, with_ratio, \
+                                 s_mag_smooth, y_mag_smooth, G_mask);                     \
+  }                                                                                       \
+  static const AecmKernels kKernels_##suffix = {                                          \
+      label,                                                                              \
+      WindowAndFFT_##suffix,                                                              \
+      InverseFFTOverlapAdd_##suffix,                                                      \
+      Magnitude_##suffix,                                                                 \
+      BitCountComparison_##suffix,                                                        \
+      UpdateChannel_##suffix,                                                             \
+      SuppressionMask_##suffix,                                                           \
+  };
+
+// 既定のコンパイルオプションのままの版。ARM64 ではこの時点で NEON が有効なので、別版は持たない。
+AECM_DEFINE_KERNELS(generic, "generic", )
+
+#ifdef AECM_KERNELS_X86
+AECM_DEFINE_KERNELS(sse42, "sse4.2", __attribute__((target("sse4.2,popcnt"))))
+AECM_DEFINE_KERNELS(avx2, "avx2", __attribute__((target("avx2,bmi,bmi2,lzcnt,popcnt"))))
+AECM_DEFINE_KERNELS(avx512, "avx512",
+                    __attribute__((target("avx512f,avx512bw,avx512vl,avx2,bmi,bmi2,lzcnt,popcnt"))))
+#endif
+
+AecmKernels g_kernels = kKernels_generic;
+
+// 最初の InitKernels で 1 回だけ選ぶ（プールから同時にインスタンスを初期化しても選択は 1 回）
+static std::once_flag g_kernelsOnce;
+static std::mutex g_kernelsMutex; // 選択と設定関数の排他
+static bool g_kernelBenchmark = false; // 選択時に実測で版を選ぶか
+static const AecmKernels* g_kernelForced = NULL; // SetKernelVariant で固定された版
+
+// 実行中の CPU で使える版を速いと見込まれる順（先頭が最優先）に並べ、個数を返す。
+static int SupportedKernels(const AecmKernels** out) {
+  int count = 0;
+#ifdef AECM_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("bmi2") &&
+      __builtin_cpu_supports("popcnt")) {
+    out[count++] = &kKernels_avx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") &&
+      __builtin_cpu_supports("popcnt")) {
+    out[count++] = &kKernels_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+    out[count++] = &kKernels_sse42;
+  }
+#endif
+  out[count++] = &kKernels_generic;
+  return count;
+}
+
+// f を数十回ずつ繰り返した時間の最小値（ナノ秒）を返す。
+template <typename F>
+static double MeasureKernelNs(F&& f) {
+  const int kReps = 32;
+  const int kTrials = 5;
+  double best = 1e30;
+  f(); // ウォームアップ
+  for (int t = 0; t < kTrials; ++t) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < kReps; ++r) {
+      f();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    if (ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+// 各カーネルを候補の版すべてで実測し、カーネルごとに最速の版を g_kernels に入れる。
+// 入力は固定シードの擬似乱数。結果は版によらず同じなので、版を混在させてもよい。
+static void BenchmarkKernels(const AecmKernels* const* variants, int count) {
+  int16_t time_signal[PART_LEN2];
+  int16_t window[PART_LEN1];
+  int16_t fft[PART_LEN4 + 2];
+  ComplexInt16 freq[PART_LEN2];
+  ComplexInt16 freq_work[PART_LEN2];
+  uint16_t x_mag[PART_LEN1];
+  uint16_t y_mag[PART_LEN1];
+  int32_t s_mag[PART_LEN1];
+  uint32_t history[MAX_DELAY];
+  int32_t bit_counts[MAX_DELAY];
+  int32_t h_adapt32[PART_LEN1];
+  int16_t h_adapt16[PART_LEN1];
+  int32_t s_mag_smooth[PART_LEN1];
+  int16_t y_mag_smooth[PART_LEN1];
+  int16_t g_mask[PART_LEN1];
+  int16_t current_block[PART_LEN];
+  int16_t overlap_block[PART_LEN];
+  uint32_t sum_abs = 0;
+
+  uint32_t seed = 12345u;
+  auto next = [&seed]() {
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 16;
+  };
+  for (int i = 0; i < PART_LEN2; ++i) {
+    time_signal[i] = (int16_t)(next() & 0x1fff) - 4096;
+  }
+  for (int i = 0; i < PART_LEN1; ++i) {
+    window[i] = (int16_t)(next() & 0x3fff);
+    x_mag[i] = (uint16_t)(next() & 0x0fff);
+    y_mag[i] = (uint16_t)(next() & 0x0fff);
+    s_mag[i] = (int32_t)(next() & 0xffff) << 8;
+  }
+  for (int i = 0; i < MAX_DELAY; ++i) {
+    history[i] = (next() << 16) | next();
+  }
+  WindowAndFFTKernel(fft, time_signal, freq, PART_LEN, window);
+
+  const AecmKernels* best[6];
+  double best_ns[6];
+  for (int k = 0; k < 6; ++k) {
+    best[k] = variants[0];
+    best_ns[k] = 1e30;
+  }
+  for (int v = 0; v < count; ++v) {
+    const AecmKernels* kv = variants[v];
+    double ns[6];
+    ns[0] = MeasureKernelNs([&]() {
+      kv->window_and_fft(fft, time_signal, freq_work, PART_LEN, window);
+    });
+    ns[1] = MeasureKernelNs([&]() {
+      kv->inverse_fft_overlap_add(freq, window, overlap_block, current_block);
+    });
+    ns[2] = MeasureKernelNs([&]() {
+      memcpy(freq_work, freq, sizeof(freq));
+      kv->magnitude(freq_work, y_mag, &sum_abs);
+    });
+    ns[3] = MeasureKernelNs([&]() {
+      kv->bit_count_comparison(history[0], history, MAX_DELAY, bit_counts);
+    });
+    ns[4] = MeasureKernelNs([&]() {
+      for (int i = 0; i < PART_LEN1; ++i) {
+        h_adapt32[i] = (int32_t)2040 << 16;
+        h_adapt16[i] = 2040;
+      }
+      kv->update_channel(x_mag, y_mag, 4, 0, h_adapt32, h_adapt16);
+    });
+    ns[5] = MeasureKernelNs([&]() {
+      memset(s_mag_smooth, 0, sizeof(s_mag_smooth));
+      memset(y_mag_smooth, 0, sizeof(y_mag_smooth));
+      kv->suppression_mask(s_mag, y_mag, SUPGAIN_DEFAULT, 0, 1, s_mag_smooth, y_mag_smooth, g_mask);
+    });
+    for (int k = 0; k < 6; ++k) {
+      if (ns[k] < best_ns[k]) {
+        best_ns[k] = ns[k];
+        best[k] = kv;
+      }
+    }
+  }
+
+  g_kernels.window_and_fft = best[0]->window_and_fft;
+  g_kernels.inverse_fft_overlap_add = best[1]->inverse_fft_overlap_add;
+  g_kernels.magnitude = best[2]->magnitude;
+  g_kernels.bit_count_comparison = best[3]->bit_count_comparison;
+  g_kernels.update_channel = best[4]->update_channel;
+  g_kernels.suppression_mask = best[5]->suppression_mask;
+  g_kernels.name = best[0]->name;
+  for (int k = 1; k < 6; ++k) {
+    if (best[k] != best[0]) {
+      g_kernels.name = "auto";
+    }
+  }
+}
+
+// 現在の設定でカーネル表を選ぶ。g_kernelsMutex を持って呼ぶ。
+static void SelectKernels() {
+  const AecmKernels* variants[4];
+  const int count = SupportedKernels(variants);
+  if (g_kernelForced) {
+    g_kernels = *g_kernelForced;
+  } else if (g_kernelBenchmark && count > 1) {
+    BenchmarkKernels(variants, count);
+  } else {
+    g_kernels = *variants[0];
+  }
+}
+
+void InitKernels() {
+  std::call_once(g_kernelsOnce, [] {
+    std::lock_guard<std::mutex> lock(g_kernelsMutex);
+    SelectKernels();
+  });
+}
+
+// 設定関数はその場で選び直す。先に 1 回目の選択を済ませたことにして、後の InitKernels で上書きされないようにする
+// （call_once は g_kernelsMutex を取る前に呼ぶ。逆順だと初回の選択と待ち合って止まる）。
+void SetKernelBenchmark(int enable) {
+  std::call_once(g_kernelsOnce, [] {});
+  std::lock_guard<std::mutex> lock(g_kernelsMutex);
+  g_kernelBenchmark = (enable != 0);
+  SelectKernels();
+}
+
+int SetKernelVariant(const char* name) {
+  std::call_once(g_kernelsOnce, [] {});
+  std::lock_guard<std::mutex> lock(g_kernelsMutex);
+  int ret = 0;
+  g_kernelForced = NULL;
+  if (name != NULL) {
+    const AecmKernels* variants[4];
+    const int count = SupportedKernels(variants);
+    ret = -1;
+    for (int v = 0; v < count; ++v) {
+      if (strcmp(variants[v]->name, name) == 0) {
+        g_kernelForced = variants[v];
+        ret = 0;
+        break;
+      }
+    }
+  }
+  SelectKernels();
+  return ret;
+}
+
+const char* GetKernelVariant() {
+  return g_kernels.name;
+}
+
+// util.h の FFT・窓関数 API。カーネル本体を既定の版でそのまま呼ぶ。
+void ComplexBitReverse(int16_t* __restrict complex_data, int stages) {
+  (void)stages;
+  ComplexBitReverseKernel(complex_data);
+}
+
+int ComplexFFT(int16_t frfi[], int stages, int mode) {
+  (void)mode;
+  return ComplexFFTKernel(frfi, stages);
+}
+
+int ComplexIFFT(int16_t frfi[], int stages, int mode) {
+  (void)mode;
+  return ComplexIFFTKernel(frfi, stages);
+}
+
+int RealForwardFFT(const int16_t* real_data_in, int16_t* complex_data_out) {
+  return RealForwardFFTKernel(real_data_in, complex_data_out);
+}
+
+int RealInverseFFT(const int16_t* complex_data_in, int16_t* real_data_out) {
+  return RealInverseFFTKernel(complex_data_in, real_data_out);
+}
+
+void InverseFFTAndWindow(int16_t* fft,
+                         ComplexInt16* efw,
+                         int part_len,
+                         int part_len2,
+                         const int16_t* sqrt_hanning,
+                         int16_t* current_block,
+                         int16_t* overlap_block) {
+  InverseFFTAndWindowKernel(fft, efw, part_len, part_len2, sqrt_hanning, current_block, overlap_block);
+}
+
+void WindowAndFFT(int16_t* fft,
+                  const int16_t* time_signal,
+                  ComplexInt16* freq_signal,
+                  int part_len,
+                  const int16_t* sqrt_hanning) {
+  WindowAndFFTKernel(fft, time_signal, freq_signal, part_len, sqrt_hanning);
+}
@@ -0,0 +1,58 @@
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <stdint.h>
+
+#include "util.h"
+
+// ホットループのカーネル表。InitAecm 時に CPU の対応命令（x86 は cpuid）から最速の版を選んで埋める。
+// どの版も同じソースを別の命令セット向けにコンパイルしたもので、結果はビット単位で一致する。
+typedef struct AecmKernels {
+  const char* name; // 選ばれた版の名前（ベンチマークで版を混在させた場合は "auto"）
+
+  // 解析窓 + 実数 FFT（TimeToFrequencyDomain）
+  void (*window_and_fft)(int16_t* fft,
+                         const int16_t* time_signal,
+                         ComplexInt16* freq_signal,
+                         int part_len,
+                         const int16_t* sqrt_hanning);
+  // 逆 FFT + 合成窓 + オーバーラップ加算（ProcessBlock の 13）。
+  // out = SAT(今回の前半 + overlap_buf)、overlap_buf は今回の後半で置き換える。
+  void (*inverse_fft_overlap_add)(const ComplexInt16* efw,
+                                  const int16_t* sqrt_hanning,
+                                  int16_t* overlap_buf,
+                                  int16_t* out);
+  // 振幅スペクトル |X| と総和
+  void (*magnitude)(ComplexInt16* freq_signal,
+                    uint16_t* freq_signal_abs,
+                    uint32_t* freq_signal_sum_abs);
+  // 遅延推定の 2 値スペクトル比較
+  void (*bit_count_comparison)(uint32_t binary_vector,
+                               const uint32_t* binary_matrix,
+                               int matrix_size,
+                               int32_t* bit_counts);
+  // NLMS による適応チャネル更新
+  void (*update_channel)(const uint16_t* X_mag,
+                         const uint16_t* Y_mag,
+                         int16_t mu,
+                         int16_t dfa_noisy_q_domain,
+                         int32_t* h_adapt32,
+                         int16_t* h_adapt16);
+  // 抑圧マスク生成（平滑化・比率・2 乗・高域の上限）
+  int16_t (*suppression_mask)(const int32_t* S_mag,
+                              const uint16_t* Y_mag,
+                              int16_t sup_gain,
+                              int16_t y_mag_q_domain_diff,
+                              int with_ratio,
+                              int32_t* s_mag_smooth,
+                              int16_t* y_mag_smooth,
+                              int16_t* G_mask);
+} AecmKernels;
+
+extern AecmKernels g_kernels; // 現在使用中のカーネル表
+
+// カーネル表を埋める。最初の 1 回だけ（std::call_once）CPU 判定・ベンチマークを行い、以降は何もしない。
+// 複数のスレッドから同時に呼べる。
+void InitKernels();
+
+#endif  // KERNELS_H_
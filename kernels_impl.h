@@ -0,0 +1,644 @@
+// ホットループのカーネル本体。
+// kernels.cc が命令セットごとのラッパー関数の中へ展開するため、すべて強制インラインにする。
+// 同じソースを別の target 属性でコンパイルするだけなので、どの版も結果はビット単位で一致する。
+// kernels.cc 以外から include しないこと。
+#ifndef KERNELS_IMPL_H_
+#define KERNELS_IMPL_H_
+
+#include <string.h>
+
+#include "util.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AECM_KERNEL_INLINE static inline __attribute__((always_inline))
+#else
+#define AECM_KERNEL_INLINE static inline
+#endif
+
+// 1 のビット数。GCC/Clang ではビルトイン（popcnt のある版では 1 命令）、それ以外と -DUTIL_HAS_BUILTINS=0 ではビット並列の加算。
+AECM_KERNEL_INLINE int BitCount32(uint32_t v) {
+#if UTIL_HAS_BUILTINS
+  return __builtin_popcount(v);
+#else
+  v = v - ((v >> 1) & 0x55555555u);
+  v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+  v = (v + (v >> 4)) & 0x0F0F0F0Fu;
+  return (int)((v * 0x01010101u) >> 24);
+#endif
+}
+
+// FFT の回転因子に使う 1 周期 1024 点の正弦表（Q15, 0 方向への切り捨て）。
+struct SinTable1024 {
+  int16_t v[1024];
+};
+
+static constexpr SinTable1024 MakeSinTable1024() {
+  SinTable1024 table{};
+  for (int i = 0; i < 1024; ++i) {
+    table.v[i] = (int16_t)(32767.0 * ConstexprSin2Pi(i, 1024));
+  }
+  return table;
+}
+
+static constexpr SinTable1024 kSinTable1024Data = MakeSinTable1024();
+static constexpr const int16_t* kSinTable1024 = kSinTable1024Data.v;
+static_assert(kSinTable1024Data.v[7] == 1406 && kSinTable1024Data.v[256] == 32767 &&
+              kSinTable1024Data.v[768] == -32767, "正弦表の生成結果が従来の表と一致しない");
+
+#define CFFTSFT 14
+#define CFFTRND 1
+#define CFFTRND2 16384
+
+#define CIFFTSFT 14
+#define CIFFTRND 1
+
+// kRealFftOrder 段の FFT 用ビット反転テーブル。i < rev(i) となる組 (i, rev(i)) を i の昇順に並べる。
+constexpr int BitReverse(int i, int order) {
+  int r = 0;
+  for (int b = 0; b < order; ++b) {
+    r = (r << 1) | ((i >> b) & 1);
+  }
+  return r;
+}
+
+constexpr int CountBitReversePairs(int order) {
+  int pairs = 0;
+  for (int i = 0; i < (1 << order); ++i) {
+    pairs += (i < BitReverse(i, order));
+  }
+  return pairs;
+}
+
+constexpr int kBitReverseLen = 2 * CountBitReversePairs(kRealFftOrder);
+
+struct BitReverseIndexTable {
+  int16_t v[kBitReverseLen];
+};
+
+static constexpr BitReverseIndexTable MakeBitReverseIndex() {
+  BitReverseIndexTable table{};
+  int m = 0;
+  for (int i = 0; i < (1 << kRealFftOrder); ++i) {
+    const int r = BitReverse(i, kRealFftOrder);
+    if (i < r) {
+      table.v[m++] = (int16_t)i;
+      table.v[m++] = (int16_t)r;
+    }
+  }
+  return table;
+}
+
+static constexpr BitReverseIndexTable kBitReverseIndex = MakeBitReverseIndex();
+
+// 固定長のビット反転テーブルを用い、複素配列をビット反転順に並べ替える。
+// FFT の前処理として、バタフライ演算を正しいペア順に整列させる。
+AECM_KERNEL_INLINE void ComplexBitReverseKernel(int16_t* __restrict complex_data) {
+  int32_t* ptr = reinterpret_cast<int32_t*>(complex_data);
+  for (int m = 0; m < kBitReverseLen; m += 2) {
+    int32_t swapped_pair = ptr[kBitReverseIndex.v[m]];
+    ptr[kBitReverseIndex.v[m]] = ptr[kBitReverseIndex.v[m + 1]];
+    ptr[kBitReverseIndex.v[m + 1]] = swapped_pair;
+  }
+}
+
+// 1024ポイントまでの複素FFTを実装したルーチン。
+// 周波数領域での解析や畳み込み前処理として利用する。
+AECM_KERNEL_INLINE int ComplexFFTKernel(int16_t frfi[], int stages) {
+  const int n = 1 << stages;
+  if (n > 1024) {
+    return -1;
+  }
+
+  int l = 1;
+  int k = 10 - 1;
+
+  while (l < n) {
+    int istep = l << 1;
+    for (int m = 0; m < l; ++m) {
+      int j = m << k;
+      int16_t wr = kSinTable1024[j + 256];
+      int16_t wi = -kSinTable1024[j];
+
+      for (int i = m; i < n; i += istep) {
+        j = i + l;
+
+        int32_t tr32 = wr * frfi[2 * j] - wi * frfi[2 * j + 1] + CFFTRND;
+        int32_t ti32 = wr * frfi[2 * j + 1] + wi * frfi[2 * j] + CFFTRND;
+
+        tr32 >>= 15 - CFFTSFT;
+        ti32 >>= 15 - CFFTSFT;
+
+        int32_t qr32 = ((int32_t)frfi[2 * i]) * (1 << CFFTSFT);
+        int32_t qi32 = ((int32_t)frfi[2 * i + 1]) * (1 << CFFTSFT);
+
+        frfi[2 * j] = (int16_t)((qr32 - tr32 + CFFTRND2) >> (1 + CFFTSFT));
+        frfi[2 * j + 1] = (int16_t)((qi32 - ti32 + CFFTRND2) >> (1 + CFFTSFT));
+        frfi[2 * i] = (int16_t)((qr32 + tr32 + CFFTRND2) >> (1 + CFFTSFT));
+        frfi[2 * i + 1] = (int16_t)((qi32 + ti32 + CFFTRND2) >> (1 + CFFTSFT));
+      }
+    }
+    --k;
+    l = istep;
+  }
+  return 0;
+}
+
+// 複素周波数データを時間領域に戻すIFFTを行い、必要なスケーリング量を返す。
+// 周波数領域処理後の再構成やオーバーラップアドに欠かせないコア処理。
+AECM_KERNEL_INLINE int ComplexIFFTKernel(int16_t frfi[], int stages) {
+  const size_t n = ((size_t)1) << stages;
+  if (n > 1024) {
+    return -1;
+  }
+
+  int scale = 0;
+  size_t l = 1;
+  int k = 10 - 1;
+
+  while (l < n) {
+    int shift = 0;
+    int32_t round2 = 8192;
+
+    int32_t max_abs_value = MaxAbsValueW16(frfi, 2 * n);
+    if (max_abs_value > 13573) {
+      ++shift;
+      ++scale;
+      round2 <<= 1;
+    }
+    if (max_abs_value > 27146) {
+      ++shift;
+      ++scale;
+      round2 <<= 1;
+    }
+
+    size_t istep = l << 1;
+    for (size_t m = 0; m < l; ++m) {
+      size_t j = m << k;
+      int16_t wr = kSinTable1024[j + 256];
+      int16_t wi = kSinTable1024[j];
+
+      for (size_t i = m; i < n; i += istep) {
+        j = i + l;
+
+        int32_t tr32 = wr * frfi[2 * j] - wi * frfi[2 * j + 1] + CIFFTRND;
+        int32_t ti32 = wr * frfi[2 * j + 1] + wi * frfi[2 * j] + CIFFTRND;
+
+        tr32 >>= 15 - CIFFTSFT;
+        ti32 >>= 15 - CIFFTSFT;
+
+        int32_t qr32 = ((int32_t)frfi[2 * i]) * (1 << CIFFTSFT);
+        int32_t qi32 = ((int32_t)frfi[2 * i + 1]) * (1 << CIFFTSFT);
+
+        frfi[2 * j] = (int16_t)((qr32 - tr32 + round2) >> (shift + CIFFTSFT));
+        frfi[2 * j + 1] = (int16_t)((qi32 - ti32 + round2) >> (shift + CIFFTSFT));
+        frfi[2 * i] = (int16_t)((qr32 + tr32 + round2) >> (shift + CIFFTSFT));
+        frfi[2 * i + 1] = (int16_t)((qi32 + ti32 + round2) >> (shift + CIFFTSFT));
+      }
+    }
+    --k;
+    l = istep;
+  }
+  return scale;
+}
+
+// 実数波形を複素スペクトルへ変換し、DC〜Nyquist成分を取得する。
+// 実信号ベースのAECM処理が周波数領域に移行する前段として利用。
+AECM_KERNEL_INLINE int RealForwardFFTKernel(const int16_t* real_data_in,
+                                            int16_t* complex_data_out) {
+  const int n = 1 << kRealFftOrder;
+  int16_t complex_buffer[2 << kRealFftOrder];
+
+  for (int i = 0, j = 0; i < n; ++i, j += 2) {
+    complex_buffer[j] = real_data_in[i];
+    complex_buffer[j + 1] = 0;
+  }
+
+  ComplexBitReverseKernel(complex_buffer);
+  int result = ComplexFFTKernel(complex_buffer, kRealFftOrder);
+
+  memcpy(complex_data_out, complex_buffer, sizeof(int16_t) * (n + 2));
+  return result;
+}
+
+// 実数スペクトルを逆変換し、時間領域のサンプル列へ復元する。
+// 周波数領域処理後のブロックを時間波形に戻して合成する工程で使用。
+AECM_KERNEL_INLINE int RealInverseFFTKernel(const int16_t* complex_data_in,
+                                            int16_t* real_data_out) {
+  const int n = 1 << kRealFftOrder;
+  int16_t complex_buffer[2 << kRealFftOrder];
+
+  memcpy(complex_buffer, complex_data_in, sizeof(int16_t) * (n + 2));
+  for (int i = n + 2; i < 2 * n; i += 2) {
+    complex_buffer[i] = complex_data_in[2 * n - i];
+    complex_buffer[i + 1] = -complex_data_in[2 * n - i + 1];
+  }
+
+  ComplexBitReverseKernel(complex_buffer);
+  int result = ComplexIFFTKernel(complex_buffer, kRealFftOrder);
+
+  for (int i = 0, j = 0; i < n; ++i, j += 2) {
+    real_data_out[i] = complex_buffer[j];
+  }
+
+  return result;
+}
+
+// kRealFftOrder 段の FFT の入力位置 i をビット反転した位置の表。
+// 窓掛けや共役パッキングの書き込み先に使い、ビット反転の並べ替えを別パスで行わずに済ませる。
+struct BitReversePermTable {
+  int16_t v[1 << kRealFftOrder];
+};
+
+static constexpr BitReversePermTable MakeBitReversePerm() {
+  BitReversePermTable table{};
+  for (int i = 0; i < (1 << kRealFftOrder); ++i) {
+    table.v[i] = (int16_t)BitReverse(i, kRealFftOrder);
+  }
+  return table;
+}
+
+static constexpr BitReversePermTable kBitReversePerm = MakeBitReversePerm();
+
+// 解析窓。time_signal (PART_LEN2 サンプル) に √ハニング窓を掛け、前半は w[i]、後半は逆順の w[PART_LEN - i] を使う。
+// 逆順アクセスを含む 2 本の連続ループなので、各命令セットの版でベクトル化される。
+AECM_KERNEL_INLINE void AnalysisWindowKernel(const int16_t* __restrict time_signal,
+                                             const int16_t* __restrict sqrt_hanning,
+                                             int16_t* __restrict windowed) {
+  for (int i = 0; i < PART_LEN; ++i) {
+    windowed[i] = (int16_t)((time_signal[i] * sqrt_hanning[i]) >> 14);
+  }
+  for (int i = 0; i < PART_LEN; ++i) {
+    windowed[PART_LEN + i] = (int16_t)((time_signal[PART_LEN + i] * sqrt_hanning[PART_LEN - i]) >> 14);
+  }
+}
+
+// 窓掛け済みの実数列を、虚部 0 の複素数としてビット反転位置へ直接書き込む
+// （従来の「実数→複素の詰め替え」と「ビット反転の入れ替え」を 1 パスにまとめたもの）。
+AECM_KERNEL_INLINE void PackRealBitReversedKernel(const int16_t* __restrict windowed,
+                                                  ComplexInt16* __restrict buf) {
+  for (int i = 0; i < PART_LEN2; ++i) {
+    buf[kBitReversePerm.v[i]].real = windowed[i];
+    buf[kBitReversePerm.v[i]].imag = 0;
+  }
+}
+
+// 逆 FFT 前の共役パッキング。efw (0..PART_LEN) の共役を下半分に、その鏡像を上半分に置いて
+// 共役対称な複素列を作り、ビット反転位置へ直接書き込む。
+// 従来の「共役をとって詰める」「上半分を鏡像で埋める」「ビット反転」の 3 パスを 1 パスにまとめたもの。
+AECM_KERNEL_INLINE void ConjugatePackBitReversedKernel(const ComplexInt16* __restrict efw,
+                                                       ComplexInt16* __restrict buf) {
+  for (int k = 0; k <= PART_LEN; ++k) {
+    buf[kBitReversePerm.v[k]].real = efw[k].real;
+    buf[kBitReversePerm.v[k]].imag = (int16_t)-efw[k].imag;
+  }
+  for (int k = PART_LEN + 1; k < PART_LEN2; ++k) {
+    buf[kBitReversePerm.v[k]].real = efw[PART_LEN2 - k].real;
+    buf[kBitReversePerm.v[k]].imag = efw[PART_LEN2 - k].imag;
+  }
+}
+
+// 合成窓。IFFT 結果（複素列の実部）に √ハニング窓を掛け、IFFT のスケール outCFFT を戻して
+// 16 ビットへ飽和させる。前半は今回のブロック、後半は次のブロックとのオーバーラップ分。
+AECM_KERNEL_INLINE void SynthesisWindowKernel(const ComplexInt16* __restrict buf,
+                                              const int16_t* __restrict sqrt_hanning,
+                                              int outCFFT,
+                                              int16_t* __restrict current_block,
+                                              int16_t* __restrict overlap_block) {
+  for (int i = 0; i < PART_LEN; ++i) {
+    int16_t windowed = (int16_t)MUL_16_16_RSFT_WITH_ROUND(buf[i].real, sqrt_hanning[i], 14);
+    int32_t windowed_sample_q31 = SHIFT_W32((int32_t)windowed, outCFFT);
+    current_block[i] = SatW32ToW16(windowed_sample_q31);
+
+    windowed_sample_q31 = (buf[PART_LEN + i].real * sqrt_hanning[PART_LEN - i]) >> 14;
+    windowed_sample_q31 = SHIFT_W32(windowed_sample_q31, outCFFT);
+    overlap_block[i] = SatW32ToW16(windowed_sample_q31);
+  }
+}
+
+// 合成窓とオーバーラップ加算を 1 パスで行う。
+// out = SAT(今回ブロックの前半 + 前回の後半)、overlap_buf には今回の後半を残す。
+AECM_KERNEL_INLINE void SynthesisWindowOverlapAddKernel(const ComplexInt16* __restrict buf,
+                                                        const int16_t* __restrict sqrt_hanning,
+                                                        int outCFFT,
+                                                        int16_t* __restrict overlap_buf,
+                                                        int16_t* __restrict out) {
+  for (int i = 0; i < PART_LEN; ++i) {
+    int16_t windowed = (int16_t)MUL_16_16_RSFT_WITH_ROUND(buf[i].real, sqrt_hanning[i], 14);
+    int32_t current = SatW32ToW16(SHIFT_W32((int32_t)windowed, outCFFT));
+    out[i] = SatW32ToW16(current + overlap_buf[i]);
+
+    int32_t overlap_q31 = (buf[PART_LEN + i].real * sqrt_hanning[PART_LEN - i]) >> 14;
+    overlap_buf[i] = SatW32ToW16(SHIFT_W32(overlap_q31, outCFFT));
+  }
+}
+
+// 共役パッキング（ビット反転込み）+ 複素 IFFT。戻り値は IFFT のスケール outCFFT。
+AECM_KERNEL_INLINE int ConjugatePackAndIFFTKernel(const ComplexInt16* efw, ComplexInt16* buf) {
+  ConjugatePackBitReversedKernel(efw, buf);
+  return ComplexIFFTKernel(reinterpret_cast<int16_t*>(buf), kRealFftOrder);
+}
+
+// part_len / part_len2 は PART_LEN / PART_LEN2 固定（FFT 長は kRealFftOrder で決まる）。
+// fft は使わない（従来の作業領域引数との互換のため残している）。
+AECM_KERNEL_INLINE void InverseFFTAndWindowKernel(int16_t* fft,
+                                                  ComplexInt16* efw,
+                                                  int part_len,
+                                                  int part_len2,
+                                                  const int16_t* sqrt_hanning,
+                                                  int16_t* current_block,
+                                                  int16_t* overlap_block) {
+  (void)fft;
+  (void)part_len;
+  (void)part_len2;
+  ComplexInt16 buf[PART_LEN2];
+  int outCFFT = ConjugatePackAndIFFTKernel(efw, buf);
+  SynthesisWindowKernel(buf, sqrt_hanning, outCFFT, current_block, overlap_block);
+}
+
+// 逆 FFT + 合成窓 + オーバーラップ加算（ProcessBlock の 13）。
+AECM_KERNEL_INLINE void InverseFFTOverlapAddKernel(const ComplexInt16* efw,
+                                                   const int16_t* sqrt_hanning,
+                                                   int16_t* overlap_buf,
+                                                   int16_t* out) {
+  ComplexInt16 buf[PART_LEN2];
+  int outCFFT = ConjugatePackAndIFFTKernel(efw, buf);
+  SynthesisWindowOverlapAddKernel(buf, sqrt_hanning, outCFFT, overlap_buf, out);
+}
+
+// 解析窓 + 実数 FFT。窓掛け結果をビット反転位置へ直接置いて FFT し、
+// 出力の 0..PART_LEN ビンを取り出すときに虚部の符号反転もまとめて行う。
+// fft は窓掛け結果の作業領域（PART_LEN2 要素以上）。part_len は PART_LEN 固定。
+AECM_KERNEL_INLINE void WindowAndFFTKernel(int16_t* fft,
+                                           const int16_t* time_signal,
+                                           ComplexInt16* freq_signal,
+                                           int part_len,
+                                           const int16_t* sqrt_hanning) {
+  (void)part_len;
+  ComplexInt16 buf[PART_LEN2];
+  AnalysisWindowKernel(time_signal, sqrt_hanning, fft);
+  PackRealBitReversedKernel(fft, buf);
+  ComplexFFTKernel(reinterpret_cast<int16_t*>(buf), kRealFftOrder);
+  for (int i = 0; i < PART_LEN; ++i) {
+    freq_signal[i].real = buf[i].real;
+    freq_signal[i].imag = (int16_t)-buf[i].imag;
+  }
+  freq_signal[PART_LEN] = buf[PART_LEN];
+}
+
+// 各ビンの振幅 |X| とその総和を求める。DC とナイキストは虚部を 0 にそろえる。
+AECM_KERNEL_INLINE void MagnitudeKernel(ComplexInt16* freq_signal,
+                                        uint16_t* freq_signal_abs,
+                                        uint32_t* freq_signal_sum_abs) {
+  freq_signal[0].imag = 0;
+  freq_signal[PART_LEN].imag = 0;
+  freq_signal_abs[0] = (uint16_t)ABS_W16(freq_signal[0].real);
+  freq_signal_abs[PART_LEN] = (uint16_t)ABS_W16(freq_signal[PART_LEN].real);
+  (*freq_signal_sum_abs) = (uint32_t)(freq_signal_abs[0]) + (uint32_t)(freq_signal_abs[PART_LEN]);
+
+  for (int i = 1; i < PART_LEN; i++) {
+    if (freq_signal[i].real == 0) {
+      freq_signal_abs[i] = (uint16_t)ABS_W16(freq_signal[i].imag);
+    } else if (freq_signal[i].imag == 0) {
+      freq_signal_abs[i] = (uint16_t)ABS_W16(freq_signal[i].real);
+    } else {
+      int16_t abs_real = ABS_W16(freq_signal[i].real);
+      int16_t abs_imag = ABS_W16(freq_signal[i].imag);
+      int32_t sq_real = abs_real * abs_real;
+      int32_t sq_imag = abs_imag * abs_imag;
+      int32_t sum_sq = AddSatW32(sq_real, sq_imag);
+      int32_t mag = SqrtFloor(sum_sq);
+      freq_signal_abs[i] = (uint16_t)mag;
+    }
+    (*freq_signal_sum_abs) += (uint32_t)freq_signal_abs[i];
+  }
+}
+
+// `binary_vector` を `binary_matrix` の各行と比較し、行ごとに一致するビット数を数える。
+// popcount 命令のある版ではビットカウントが 1 命令になる。
+AECM_KERNEL_INLINE void BitCountComparisonKernel(uint32_t binary_vector,
+                                                 const uint32_t* binary_matrix,
+                                                 int matrix_size,
+                                                 int32_t* bit_counts) {
+  for (int n = 0; n < matrix_size; n++) {
+    bit_counts[n] = (int32_t)BitCount32(binary_vector ^ binary_matrix[n]);
+  }
+}
+
+// 7. エコーチャネル更新。 NLMS法で計算する。
+// 更新するのはHadaptで、以下の式を実行する。
+// ΔH = 2^{-μ} · (|Y| - Hadapt · |X|) · |X|
+// H = H + ΔH
+// dfa_noisy_q_domain: 近端振幅の Q ドメイン、h_adapt32 / h_adapt16: 適応チャネル（更新対象）。
+AECM_KERNEL_INLINE void UpdateChannelKernel(const uint16_t* X_mag,
+                                            const uint16_t* Y_mag,
+                                            int16_t mu,
+                                            int16_t dfa_noisy_q_domain,
+                                            int32_t* h_adapt32,
+                                            int16_t* h_adapt16) {
+  uint32_t channel_far_product_q0, near_mag_q0;
+  int16_t zerosFar, zerosNum, zerosCh, zerosDfa;
+  int16_t shiftChFar, shiftNum, shift2ResChan;
+  int16_t dfa_shift_candidate;
+  int16_t channel_product_q_domain, near_mag_q_domain;
+
+  for (int i = 0; i < PART_LEN1; i++) { // 周波数ビンごとに
+    // オーバーフロー防止のためチャネルと遠端の正規化量を算出
+    zerosCh = NormU32(h_adapt32[i]);
+    zerosFar = NormU32((uint32_t)X_mag[i]);
+    if (zerosCh + zerosFar > 31) {
+      // 乗算しても安全な状態
+      channel_far_product_q0 = UMUL_32_16(h_adapt32[i], X_mag[i]);
+      shiftChFar = 0;
+    } else {
+      // 乗算前にシフトダウンが必要
+      shiftChFar = 32 - zerosCh - zerosFar;
+      // zerosCh==zerosFar==0 なら shiftChFar=32 となり、
+      // 右シフト 32 は未定義なのでチェックする。
+      {
+        uint32_t shifted = (shiftChFar >= 32)
+                                ? 0u
+                                : (uint32_t)(h_adapt32[i] >> shiftChFar);
+        channel_far_product_q0 = shifted * X_mag[i];
+      }
+    }
+    // 分子の Q ドメインを決定
+    zerosNum = NormU32(channel_far_product_q0);
+    if (Y_mag[i]) {
+      zerosDfa = NormU32((uint32_t)Y_mag[i]);
+    } else {
+      zerosDfa = 32;
+    }
+    dfa_shift_candidate = zerosDfa - 2 + dfa_noisy_q_domain - RESOLUTION_CHANNEL32 + shiftChFar;
+    if (zerosNum > dfa_shift_candidate + 1) {
+      channel_product_q_domain = dfa_shift_candidate;
+      near_mag_q_domain = zerosDfa - 2;
+    } else {
+      channel_product_q_domain = zerosNum - 2;
+      near_mag_q_domain = RESOLUTION_CHANNEL32 - dfa_noisy_q_domain - shiftChFar  + channel_product_q_domain;
+    }
+    // 同じ Q ドメインに揃えて加算
+    channel_far_product_q0 = SHIFT_W32(channel_far_product_q0, channel_product_q_domain);
+    near_mag_q0 = SHIFT_W32((uint32_t)Y_mag[i], near_mag_q_domain);
+    // residual = |Y| - Hadapt · |X| これが残差信号
+    int32_t residual_q31 = (int32_t)near_mag_q0 - (int32_t)channel_far_product_q0;
+    zerosNum = NormW32(residual_q31);
+    if (residual_q31 && (X_mag[i] > CHANNEL_VAD)) {
+      // 乗算でオーバーフローしないようにする。
+      int32_t residual_times_far;
+      if (zerosNum + zerosFar > 31) {
+        if (residual_q31 > 0) {
+          residual_times_far = (int32_t)UMUL_32_16(residual_q31, X_mag[i]);
+        } else {
+          residual_times_far = -(int32_t)UMUL_32_16(-residual_q31, X_mag[i]);
+        }
+        shiftNum = 0;
+      } else {
+        shiftNum = 32 - (zerosNum + zerosFar);
+        if (residual_q31 > 0) {
+          residual_times_far = (residual_q31 >> shiftNum) * X_mag[i];
+        } else {
+          residual_times_far = -((-residual_q31 >> shiftNum) * X_mag[i]);
+        }
+      }
+      // residual_times_far が、 残差信号に|X|を掛けたものに対応する。
+      // 周波数ビンに応じて正規化
+      residual_times_far = DivW32W16(residual_times_far, i + 1);
+      // 適切な Q ドメインに揃える。
+      // shift2ResChanはシフト演算の量なので、 muを減算しているのは、1が最大の0.5で10が最小の1/1024であることに注意。
+      // つまり muの減算はμを掛けていることに相当している。
+      shift2ResChan = shiftNum + shiftChFar - channel_product_q_domain - mu - ((30 - zerosFar) << 1);
+      int32_t deltaH_q31;
+      if (NormW32(residual_times_far) < shift2ResChan) {
+        deltaH_q31 = WORD32_MAX;
+      } else {
+        deltaH_q31 = SHIFT_W32(residual_times_far, shift2ResChan);
+      }
+      // ここまでで、ΔHが求まった。ので、Hadaptに加算する。 H = H + ΔH に対応している。
+      h_adapt32[i] = AddSatW32(h_adapt32[i], deltaH_q31);
+      if (h_adapt32[i] < 0) {
+        // チャネル利得が負にならないよう強制
+        h_adapt32[i] = 0;
+      }
+      h_adapt16[i] = (int16_t)(h_adapt32[i] >> 16);
+    }
+  }
+}
+
+// 10. 周波数マスク生成。
+// 平滑化した推定エコー |S| と近端 |Y| の比から Wiener 型のマスク G_mask(Q14) を求める。
+// sup_gain: 抑圧ゲイン（Q8）、y_mag_q_domain_diff: 近端 Q ドメインの前ブロックからの変化、
+// s_mag_smooth / y_mag_smooth: 平滑化の状態（更新対象）。
+// with_ratio が 0 ならマスクは全ビン 1 とし、平滑化の状態更新だけを行う。
+// 戻り値は G_mask の非0係数の数（11 の NLP で使う）。
+AECM_KERNEL_INLINE int16_t SuppressionMaskKernel(const int32_t* S_mag,
+                                                 const uint16_t* Y_mag,
+                                                 int16_t sup_gain,
+                                                 int16_t y_mag_q_domain_diff,
+                                                 int with_ratio,
+                                                 int32_t* s_mag_smooth,
+                                                 int16_t* y_mag_smooth,
+                                                 int16_t* G_mask) {
+  int16_t numPosCoef = 0;
+  for (int i = 0; i < PART_LEN1; i++) {
+    // 推定エコー振幅を更新・平滑化して、最新の抑圧対象エネルギーを取得
+    int32_t smooth_error_q31 = S_mag[i] - s_mag_smooth[i];
+    s_mag_smooth[i] += (int32_t)(((int64_t)smooth_error_q31 * 50) >> 8);
+
+    // エコー推定量と抑圧ゲインのビット幅を調べ、整数演算用のスケーリングを決定
+    int16_t smooth_echo_leading_zeros = NormW32(s_mag_smooth[i]) + 1;
+    int16_t sup_gain_leading_zeros = NormW16(sup_gain) + 1;
+    uint32_t S_magGained;
+    int16_t resolutionDiff;
+    if (smooth_echo_leading_zeros + sup_gain_leading_zeros > 16) {
+      S_magGained = UMUL_32_16((uint32_t)s_mag_smooth[i], (uint16_t)sup_gain);
+      resolutionDiff = 14 - RESOLUTION_CHANNEL16 - RESOLUTION_SUPGAIN;
+    } else {
+      int16_t gain_shift_candidate = 17 - smooth_echo_leading_zeros - sup_gain_leading_zeros;
+      resolutionDiff = 14 + gain_shift_candidate - RESOLUTION_CHANNEL16 - RESOLUTION_SUPGAIN;
+      if (smooth_echo_leading_zeros > gain_shift_candidate) {
+        S_magGained = UMUL_32_16((uint32_t)s_mag_smooth[i], sup_gain >> gain_shift_candidate);
+      } else {
+        S_magGained = (s_mag_smooth[i] >> gain_shift_candidate) * sup_gain;
+      }
+    }
+    // 近端スペクトルの Q ドメインを最新状態にそろえる
+    int16_t smoothed_near_leading_zeros = NormW16(y_mag_smooth[i]);
+    int16_t qDomainDiff;
+    int16_t smoothed_near_mag_q15;
+    int16_t raw_near_mag_q15;
+    if (smoothed_near_leading_zeros < y_mag_q_domain_diff && y_mag_smooth[i]) {
+      smoothed_near_mag_q15 = y_mag_smooth[i] * (1 << smoothed_near_leading_zeros);
+      qDomainDiff = smoothed_near_leading_zeros - y_mag_q_domain_diff;
+      raw_near_mag_q15 = Y_mag[i] >> -qDomainDiff;
+    } else {
+      smoothed_near_mag_q15 = y_mag_q_domain_diff < 0
+                     ? y_mag_smooth[i] >> -y_mag_q_domain_diff
+                     : y_mag_smooth[i] * (1 << y_mag_q_domain_diff);
+      qDomainDiff = 0;
+      raw_near_mag_q15 = Y_mag[i];
+    }
+    // 近端振幅をスムージングしつつ、過剰なスケールにならないよう制限
+    int32_t near_mag_delta_q15 = (int32_t)(raw_near_mag_q15 - smoothed_near_mag_q15);
+    raw_near_mag_q15 = (int16_t)(near_mag_delta_q15 >> 4);
+    raw_near_mag_q15 += smoothed_near_mag_q15;
+    int16_t raw_near_leading_zeros = NormW16(raw_near_mag_q15);
+    if ((raw_near_mag_q15) & (-qDomainDiff > raw_near_leading_zeros)) {
+      y_mag_smooth[i] = WORD16_MAX;
+    } else {
+      y_mag_smooth[i] = qDomainDiff < 0 ? raw_near_mag_q15 * (1 << -qDomainDiff)
+                                        : raw_near_mag_q15 >> qDomainDiff;
+    }
+    // ここまでで、|Y_smooth|が計算できた。固定小数の計算を正しくやるために、かなり長いコードになっている
+
+    // 推定エコー比率を計算し、帯域ごとのマスク値 G(k) を決定
+    if (!with_ratio) {
+      G_mask[i] = ONE_Q14; // マスク無効時は比率の計算自体を省く
+    } else if (S_magGained == 0) {
+      G_mask[i] = ONE_Q14;
+    } else if (y_mag_smooth[i] == 0) {
+      G_mask[i] = 0;
+    } else {
+      S_magGained += (uint32_t)(y_mag_smooth[i] >> 1); // |S_gained|を計算
+      uint32_t echo_ratio_q14 = DivU32U16(S_magGained, (uint16_t)y_mag_smooth[i]);
+
+      int32_t ratio_q14 = (int32_t)SHIFT_W32(echo_ratio_q14, resolutionDiff); //  |S_gained|  /  |Y_smooth|  に相当
+      if (ratio_q14 > ONE_Q14) {
+        G_mask[i] = 0;
+      } else if (ratio_q14 < 0) {
+        G_mask[i] = ONE_Q14;
+      } else {
+        G_mask[i] = ONE_Q14 - (int16_t)ratio_q14; // 1 からratioを引いている
+        if (G_mask[i] < 0) { // 負にならないようにする
+          G_mask[i] = 0;
+        }
+      }
+    }
+    if (G_mask[i]) {
+        numPosCoef++; // G_maskの、0ではない係数を数えておく
+    }
+  }
+  // 抑圧マスクを 2 乗して、強いエコー帯域の減衰をさらに強調する。
+  // この部分を削除してもキャンセルはできるが、キャンセルが効き始める前のハウリングがひどくなる。
+  for (int i = 0; i < PART_LEN1; i++) {
+    G_mask[i] = (int16_t)((G_mask[i] * G_mask[i]) >> 14);
+  }
+
+  // 中域帯域の平均ゲインを求め、残りの帯域が過剰に開かないよう上限値として使う。
+  // この部分を削除してもキャンセルはできるが、キャンセルが効き始める前のハウリングがひどくなる。
+  const int kMinPrefBand = 500 * PART_LEN2 / SAMPLE_RATE_HZ;  // 500 Hz
+  const int kMaxPrefBand = 3000 * PART_LEN2 / SAMPLE_RATE_HZ; // 3 kHz
+  int32_t avgG32 = 0;
+  for (int i = kMinPrefBand; i <= kMaxPrefBand; i++) {
+    avgG32 += (int32_t)G_mask[i];
+  }
+  avgG32 /= (kMaxPrefBand - kMinPrefBand + 1);
+
+  for (int i = kMaxPrefBand; i < PART_LEN1; i++) {
+    if (G_mask[i] > (int16_t)avgG32) {
+      G_mask[i] = (int16_t)avgG32;
+    }
+  }
+  return numPosCoef;
+}
+
+#endif  // KERNELS_IMPL_H_
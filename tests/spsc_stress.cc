@@ -0,0 +1,113 @@
+// SpscRingBuffer のストレステスト（make check / make check-tsan）。
+// 生産者と消費者の 2 スレッドで連番を乱数長で流し、コピーする版（Write/ReadSpscBuffer）と
+// 領域を直接使う版（Get*Regions + Move*Ptr）を混ぜて、欠落・重複・順序の入れ替わりがないことを確かめる。
+// 引数: 流す要素数（既定 5000 万）。失敗なら終了コード 1。
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "util.h"
+
+#define STRESS_CAPACITY 4096 // キューの要素数（2 のべき乗）
+#define STRESS_MAX_CHUNK 1000 // 1 回に読み書きする最大要素数
+
+static uint32_t g_backing[STRESS_CAPACITY];
+
+// 生産者: next から連番を書く
+static void Produce(SpscRingBuffer* q, size_t total, size_t* overfills) {
+  std::vector<uint32_t> tmp(STRESS_MAX_CHUNK);
+  unsigned seed = 1;
+  size_t next = 0;
+  while (next < total) {
+    size_t want = 1 + rand_r(&seed) % STRESS_MAX_CHUNK;
+    if (want > total - next) {
+      want = total - next;
+    }
+    size_t written;
+    if (rand_r(&seed) & 1) {
+      for (size_t i = 0; i < want; i++) {
+        tmp[i] = (uint32_t)(next + i);
+      }
+      written = WriteSpscBuffer(q, tmp.data(), want);
+    } else {
+      void* p1;
+      void* p2;
+      size_t b1, b2;
+      const size_t n = GetSpscBufferWriteRegions(q, want, &p1, &b1, &p2, &b2);
+      uint32_t* a = (uint32_t*)p1;
+      for (size_t i = 0; i < b1 / sizeof(uint32_t); i++) {
+        a[i] = (uint32_t)(next + i);
+      }
+      uint32_t* b = (uint32_t*)p2;
+      for (size_t i = 0; i < b2 / sizeof(uint32_t); i++) {
+        b[i] = (uint32_t)(next + b1 / sizeof(uint32_t) + i);
+      }
+      written = MoveSpscWritePtr(q, n);
+    }
+    if (spsc_available_read(q) > STRESS_CAPACITY) {
+      (*overfills)++;
+    }
+    next += written;
+    if (written == 0) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// 消費者: 0 からの連番が届くことを確かめる。食い違った要素数を返す。
+static size_t Consume(SpscRingBuffer* q, size_t total) {
+  std::vector<uint32_t> tmp(STRESS_MAX_CHUNK);
+  unsigned seed = 7;
+  size_t expect = 0;
+  size_t errors = 0;
+  while (expect < total) {
+    const size_t want = 1 + rand_r(&seed) % STRESS_MAX_CHUNK;
+    size_t read;
+    if (rand_r(&seed) & 1) {
+      read = ReadSpscBuffer(q, tmp.data(), want);
+      for (size_t i = 0; i < read; i++) {
+        errors += tmp[i] != (uint32_t)(expect + i);
+      }
+    } else {
+      void* p1;
+      void* p2;
+      size_t b1, b2;
+      const size_t n = GetSpscBufferReadRegions(q, want, &p1, &b1, &p2, &b2);
+      const uint32_t* a = (const uint32_t*)p1;
+      for (size_t i = 0; i < b1 / sizeof(uint32_t); i++) {
+        errors += a[i] != (uint32_t)(expect + i);
+      }
+      const uint32_t* b = (const uint32_t*)p2;
+      for (size_t i = 0; i < b2 / sizeof(uint32_t); i++) {
+        errors += b[i] != (uint32_t)(expect + b1 / sizeof(uint32_t) + i);
+      }
+      read = MoveSpscReadPtr(q, n);
+    }
+    expect += read;
+    if (read == 0) {
+      std::this_thread::yield();
+    }
+  }
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  const size_t total = argc > 1 ? strtoull(argv[1], NULL, 10) : 50000000;
+  SpscRingBuffer q;
+  if (InitSpscBufferWith(&q, g_backing, STRESS_CAPACITY - 1, sizeof(uint32_t)) != -1) {
+    fprintf(stderr, "FAIL: capacity that is not a power of two was accepted\n");
+    return 1;
+  }
+  if (InitSpscBufferWith(&q, g_backing, STRESS_CAPACITY, sizeof(uint32_t)) != 0) {
+    fprintf(stderr, "FAIL: InitSpscBufferWith\n");
+    return 1;
+  }
+  size_t overfills = 0;
+  std::thread producer(Produce, &q, total, &overfills);
+  const size_t errors = Consume(&q, total);
+  producer.join();
+  const bool ok = errors == 0 && overfills == 0 && spsc_available_read(&q) == 0;
+  printf("%s: %zu elements, %zu mismatches, %zu overfills\n", ok ? "OK" : "FAIL", total, errors, overfills);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+// AecmStream の遠端があふれた後の処理の回帰テスト（make check）。
+// 遠端を容量いっぱいに入れてから半端な長さを足すと、古い方がブロック単位で捨てられ、
+// その後の近端の処理が、残った遠端を ProcessBlock で順に処理した場合とビット単位で一致することを確かめる。
+// 乱数長の遠端・近端を交互に渡し、遠端の読み出し位置が常にブロック境界にあることも確かめる。
+// 失敗なら終了コード 1。
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "aecm.h"
+#include "aecm_stream.h"
+
+static AecmStream g_stream;
+
+static int16_t Noise(unsigned* seed) {
+  return (int16_t)((int)(rand_r(seed) % 16384) - 8192);
+}
+
+// 遠端を容量 + 100 サンプル入れた後の出力を、捨てられずに残った遠端の ProcessBlock と比べる
+static bool CheckOverflowThenNear() {
+  const size_t cap = AECM_STREAM_CAPACITY;
+  const size_t extra = 100;
+  const size_t dropped = (extra + BLOCK_LEN - 1) / BLOCK_LEN * BLOCK_LEN; // 捨てられる古い遠端
+  const size_t nblocks = (cap + extra - dropped) / BLOCK_LEN;
+  unsigned seed = 1;
+  std::vector<int16_t> far(cap + extra);
+  std::vector<int16_t> near(nblocks * BLOCK_LEN);
+  for (size_t i = 0; i < far.size(); i++) {
+    far[i] = Noise(&seed);
+  }
+  for (size_t i = 0; i < near.size(); i++) {
+    near[i] = (int16_t)(far[dropped + i] / 2 + Noise(&seed) / 8);
+  }
+
+  std::vector<int16_t> expected(near.size());
+  InitAecm();
+  for (size_t n = 0; n < nblocks; n++) {
+    ProcessBlock(&far[dropped + n * BLOCK_LEN], &near[n * BLOCK_LEN], &expected[n * BLOCK_LEN]);
+  }
+
+  std::vector<int16_t> out(near.size());
+  InitAecm();
+  InitAecmStream(&g_stream, BLOCK_LEN); // 加わる遅延は 0
+  AecmStreamFar(&g_stream, far.data(), cap);
+  AecmStreamFar(&g_stream, far.data() + cap, extra);
+  if (g_stream.far.read_pos % BLOCK_LEN != 0) {
+    fprintf(stderr, "FAIL: far read position %zu is not block aligned\n", g_stream.far.read_pos);
+    return false;
+  }
+  AecmStreamNear(&g_stream, near.data(), out.data(), near.size());
+  if (out != expected) {
+    fprintf(stderr, "FAIL: output after far overflow differs from ProcessBlock\n");
+    return false;
+  }
+  return true;
+}
+
+// 乱数長で遠端（ときどき容量を超える）と近端を渡し、遠端の読み出し位置がブロック境界からずれないことを確かめる
+static bool CheckRandomOverflow() {
+  unsigned seed = 7;
+  std::vector<int16_t> far(AECM_STREAM_CAPACITY * 2);
+  std::vector<int16_t> near(AECM_STREAM_CAPACITY);
+  std::vector<int16_t> out(AECM_STREAM_CAPACITY);
+  for (size_t i = 0; i < far.size(); i++) {
+    far[i] = Noise(&seed);
+  }
+  for (size_t i = 0; i < near.size(); i++) {
+    near[i] = Noise(&seed);
+  }
+  InitAecm();
+  InitAecmStream(&g_stream, 0);
+  for (int round = 0; round < 20000; round++) {
+    const size_t far_len = rand_r(&seed) % 8 == 0 ? rand_r(&seed) % far.size() : rand_r(&seed) % 400;
+    AecmStreamFar(&g_stream, far.data(), far_len);
+    if (g_stream.far.read_pos % BLOCK_LEN != 0) {
+      fprintf(stderr, "FAIL: round %d: far read position %zu is not block aligned\n", round, g_stream.far.read_pos);
+      return false;
+    }
+    AecmStreamNear(&g_stream, near.data(), out.data(), rand_r(&seed) % 400);
+  }
+  return true;
+}
+
+int main() {
+  SetStatsLevel(0);
+  const bool ok = CheckOverflowThenNear() && CheckRandomOverflow();
+  printf("%s: far overflow keeps blocks contiguous\n", ok ? "OK" : "FAIL");
+  return ok ? 0 : 1;
+}
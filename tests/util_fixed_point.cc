@@ -0,0 +1,202 @@
+// util.h の固定小数演算のテスト（make check）。組み込み関数を使う版と素朴な実装（-DUTIL_HAS_BUILTINS=0）の
+// 両方でビルドし、ヘッダへ移す前の util.cc の実装（下の Ref*、当時のまま）と、境界値の全組み合わせ・
+// すべての int16 値・乱数の組で一致することを確かめる。失敗なら終了コード 1。
+// 引数: 乱数の組の数（既定 1000 万）。
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "util.h"
+
+// ---- 移す前の実装 ----
+static int RefCountLeadingZeros32(uint32_t n) {
+  if (n == 0) {
+    return 32;
+  }
+  int count = 0;
+  while ((n & 0x80000000u) == 0) {
+    n <<= 1;
+    ++count;
+  }
+  return count;
+}
+
+static int RefCountLeadingZeros64(uint64_t n) {
+  if (n == 0) {
+    return 64;
+  }
+  int count = 0;
+  while ((n & 0x8000000000000000ULL) == 0) {
+    n <<= 1;
+    ++count;
+  }
+  return count;
+}
+
+static int16_t RefSatW32ToW16(int32_t value32) {
+  if (value32 > 32767) {
+    return 32767;
+  }
+  if (value32 < -32768) {
+    return -32768;
+  }
+  return (int16_t)value32;
+}
+
+static int32_t RefAddSatW32(int32_t a, int32_t b) {
+  const int32_t sum = (int32_t)((uint32_t)a + (uint32_t)b);
+  if ((a < 0) == (b < 0) && (a < 0) != (sum < 0)) {
+    return sum < 0 ? INT32_MAX : INT32_MIN;
+  }
+  return sum;
+}
+
+static int32_t RefSubSatW32(int32_t a, int32_t b) {
+  const int32_t diff = (int32_t)((uint32_t)a - (uint32_t)b);
+  if ((a < 0) != (b < 0) && (a < 0) != (diff < 0)) {
+    return diff < 0 ? INT32_MAX : INT32_MIN;
+  }
+  return diff;
+}
+
+static int16_t RefAddSatW16(int16_t a, int16_t b) {
+  return RefSatW32ToW16((int32_t)a + (int32_t)b);
+}
+
+static int16_t RefSubSatW16(int16_t a, int16_t b) {
+  return RefSatW32ToW16((int32_t)a - (int32_t)b);
+}
+
+static int16_t RefNormW32(int32_t a) {
+  if (a == 0) {
+    return 0;
+  }
+  int32_t magnitude = a < 0 ? ~a : a;
+  return (int16_t)(RefCountLeadingZeros32((uint32_t)magnitude) - 1);
+}
+
+static int16_t RefNormU32(uint32_t a) {
+  return a == 0 ? 0 : (int16_t)RefCountLeadingZeros32(a);
+}
+
+static int16_t RefNormW16(int16_t a) {
+  if (a == 0) {
+    return 0;
+  }
+  int32_t a32 = a;
+  int32_t magnitude = a < 0 ? ~a32 : a32;
+  return (int16_t)(RefCountLeadingZeros32((uint32_t)magnitude) - 17);
+}
+
+static int32_t RefMulAccumW16(int16_t a, int16_t b, int32_t c) {
+  return a * b + c;
+}
+
+static int16_t RefGetSizeInBits(uint32_t n) {
+  return (int16_t)(32 - RefCountLeadingZeros32(n));
+}
+
+static uint32_t RefDivU32U16(uint32_t num, uint16_t den) {
+  return den == 0 ? UINT32_MAX : (uint32_t)(num / den);
+}
+
+static int32_t RefDivW32W16(int32_t num, int16_t den) {
+  return den == 0 ? INT32_MAX : (int32_t)(num / den);
+}
+
+// ---- 比較 ----
+static long g_failures = 0;
+
+#define EXPECT_SAME(expr, ref, fmt, ...)                                        \
+  do {                                                                          \
+    if ((expr) != (ref)) {                                                      \
+      if (g_failures++ < 20) {                                                  \
+        fprintf(stderr, "FAIL: %s (" fmt ")\n", #expr, __VA_ARGS__);            \
+      }                                                                         \
+    }                                                                           \
+  } while (0)
+
+// 32 ビット値 2 つに対するもの（a, b の順）
+static void CheckPair32(int32_t a, int32_t b) {
+  EXPECT_SAME(AddSatW32(a, b), RefAddSatW32(a, b), "%d, %d", a, b);
+  EXPECT_SAME(SubSatW32(a, b), RefSubSatW32(a, b), "%d, %d", a, b);
+  const int16_t a16 = (int16_t)a;
+  const int16_t b16 = (int16_t)b;
+  EXPECT_SAME(AddSatW16(a16, b16), RefAddSatW16(a16, b16), "%d, %d", a16, b16);
+  EXPECT_SAME(SubSatW16(a16, b16), RefSubSatW16(a16, b16), "%d, %d", a16, b16);
+  EXPECT_SAME(DivU32U16((uint32_t)a, (uint16_t)b), RefDivU32U16((uint32_t)a, (uint16_t)b), "%u, %u",
+              (uint32_t)a, (uint16_t)b);
+  if (!(a == INT32_MIN && b16 == -1)) { // 商が int32 に収まらない組は従来も未定義
+    EXPECT_SAME(DivW32W16(a, b16), RefDivW32W16(a, b16), "%d, %d", a, b16);
+  }
+  const int64_t mac = (int64_t)a16 * b16 + (int64_t)b;
+  if (mac >= INT32_MIN && mac <= INT32_MAX) { // 桁あふれする組は従来も未定義
+    EXPECT_SAME(MulAccumW16(a16, b16, b), RefMulAccumW16(a16, b16, b), "%d, %d, %d", a16, b16, b);
+  }
+}
+
+// 32 ビット値 1 つに対するもの
+static void CheckSingle32(int32_t a) {
+  const uint32_t u = (uint32_t)a;
+  EXPECT_SAME(CountLeadingZeros32(u), RefCountLeadingZeros32(u), "%u", u);
+  const uint64_t u64 = ((uint64_t)u << 32) | (u >> 3);
+  EXPECT_SAME(CountLeadingZeros64(u64), RefCountLeadingZeros64(u64), "%llu", (unsigned long long)u64);
+  EXPECT_SAME(CountLeadingZeros64((uint64_t)u), RefCountLeadingZeros64((uint64_t)u), "%u", u);
+  EXPECT_SAME(SatW32ToW16(a), RefSatW32ToW16(a), "%d", a);
+  EXPECT_SAME(NormW32(a), RefNormW32(a), "%d", a);
+  EXPECT_SAME(NormU32(u), RefNormU32(u), "%u", u);
+  EXPECT_SAME(GetSizeInBits(u), RefGetSizeInBits(u), "%u", u);
+}
+
+int main(int argc, char** argv) {
+  const long pairs = argc > 1 ? atol(argv[1]) : 10000000;
+
+  // 境界値: 0, ±1, 16 ビット・32 ビットの端, 2 のべき乗とその前後
+  std::vector<int32_t> edges = {0, 1, -1, 32767, -32768, 32768, -32769, 65535, 65536,
+                                INT32_MAX, INT32_MIN, INT32_MAX - 1, INT32_MIN + 1};
+  for (int bit = 0; bit < 31; bit++) {
+    const int32_t p = (int32_t)(1u << bit);
+    edges.push_back(p);
+    edges.push_back(p - 1);
+    edges.push_back(p + 1);
+    edges.push_back(-p);
+    edges.push_back(-p - 1);
+    edges.push_back(-p + 1);
+  }
+  for (int32_t a : edges) {
+    CheckSingle32(a);
+    for (int32_t b : edges) {
+      CheckPair32(a, b);
+    }
+  }
+
+  // すべての int16 値（16 ビット版は境界値との組も）
+  for (int32_t v = -32768; v <= 32767; v++) {
+    const int16_t v16 = (int16_t)v;
+    EXPECT_SAME(NormW16(v16), RefNormW16(v16), "%d", v);
+    CheckSingle32(v);
+    for (int32_t b : edges) {
+      CheckPair32(v, b);
+    }
+  }
+
+  // 乱数の組（上位ビットも変わるように 2 回分をつなぐ）
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  auto next = [&state]() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t)(state >> 16);
+  };
+  for (long i = 0; i < pairs; i++) {
+    const int32_t a = (int32_t)next();
+    const int32_t b = (int32_t)next();
+    CheckSingle32(a);
+    CheckPair32(a, b);
+    CheckPair32(a >> (next() & 31), b >> (next() & 31)); // 小さい値も混ぜる
+  }
+
+  printf("%s: UTIL_HAS_BUILTINS=%d, %zu edge values, %ld random pairs, %ld mismatches\n",
+         g_failures == 0 ? "OK" : "FAIL", UTIL_HAS_BUILTINS, edges.size(), pairs, g_failures);
+  return g_failures == 0 ? 0 : 1;
+}
@@ -4,7 +4,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "aecm_defines.h"
+
 #ifdef __cplusplus
+#include <atomic>
+
 extern "C" {
 #endif
 
@@ -44,22 +48,152 @@ typedef struct RingBuffer {
   char* data; // 格納先バッファ先頭
 } RingBuffer;
 
-int CountLeadingZeros32(uint32_t n); // 32ビット値の先頭ゼロ数計算
-int CountLeadingZeros64(uint64_t n); // 64ビット値の先頭ゼロ数計算
-int16_t SatW32ToW16(int32_t value32); // 32ビットを16ビットへ飽和変換
-int32_t AddSatW32(int32_t a, int32_t b); // 32ビット飽和加算
-int32_t SubSatW32(int32_t a, int32_t b); // 32ビット飽和減算
-int16_t AddSatW16(int16_t a, int16_t b); // 16ビット飽和加算
-int16_t SubSatW16(int16_t a, int16_t b); // 16ビット飽和減算
-int16_t NormW32(int32_t a); // 32ビット正規化シフト量取得
-int16_t NormU32(uint32_t a); // 32ビット符号なし正規化シフト量
-int16_t NormW16(int16_t a); // 16ビット正規化シフト量取得
-int16_t GetSizeInBits(uint32_t n); // ビット幅取得
-int32_t MulAccumW16(int16_t a, int16_t b, int32_t c); // 16ビット乗算累積
+// 固定小数の基本演算。ビンごとのループ（NLMS・マスク・IFFT）の中でインライン展開されるよう
+// ヘッダに置き、C++ では constexpr にしてコンパイル時にも評価できるようにする。
+// GCC/Clang では先頭ゼロ数とオーバーフロー判定にビルトインを使い（clz/lzcnt, add+cmov/csel）、
+// それ以外のコンパイラでは同じ結果になる素朴な実装を使う。
+#ifdef __cplusplus
+#define UTIL_INLINE constexpr inline
+#else
+#define UTIL_INLINE static inline
+#endif
+#ifndef UTIL_HAS_BUILTINS  // -DUTIL_HAS_BUILTINS=0 で素朴な実装を強制できる
+#if defined(__GNUC__) || defined(__clang__)
+#define UTIL_HAS_BUILTINS 1
+#else
+#define UTIL_HAS_BUILTINS 0
+#endif
+#endif
+
+// 32ビット値の先頭ゼロ数計算
+UTIL_INLINE int CountLeadingZeros32(uint32_t n) {
+#if UTIL_HAS_BUILTINS
+  return n == 0 ? 32 : __builtin_clz(n);
+#else
+  if (n == 0) {
+    return 32;
+  }
+  int count = 0;
+  while ((n & 0x80000000u) == 0) {
+    n <<= 1;
+    ++count;
+  }
+  return count;
+#endif
+}
+
+// 64ビット値の先頭ゼロ数計算
+UTIL_INLINE int CountLeadingZeros64(uint64_t n) {
+#if UTIL_HAS_BUILTINS
+  return n == 0 ? 64 : __builtin_clzll(n);
+#else
+  if (n == 0) {
+    return 64;
+  }
+  int count = 0;
+  while ((n & 0x8000000000000000ULL) == 0) {
+    n <<= 1;
+    ++count;
+  }
+  return count;
+#endif
+}
+
+// 32ビットを16ビットへ飽和変換
+UTIL_INLINE int16_t SatW32ToW16(int32_t value32) {
+  return (int16_t)(value32 > 32767 ? 32767 : value32 < -32768 ? -32768 : value32);
+}
+
+// 32ビット飽和加算
+UTIL_INLINE int32_t AddSatW32(int32_t a, int32_t b) {
+#if UTIL_HAS_BUILTINS
+  int32_t sum = 0;
+  if (__builtin_add_overflow(a, b, &sum)) {
+    return a < 0 ? INT32_MIN : INT32_MAX; // 桁あふれは a と b が同符号のときだけ
+  }
+  return sum;
+#else
+  const int32_t sum = (int32_t)((uint32_t)a + (uint32_t)b);
+  if ((a < 0) == (b < 0) && (a < 0) != (sum < 0)) {
+    return sum < 0 ? INT32_MAX : INT32_MIN;
+  }
+  return sum;
+#endif
+}
+
+// 32ビット飽和減算
+UTIL_INLINE int32_t SubSatW32(int32_t a, int32_t b) {
+#if UTIL_HAS_BUILTINS
+  int32_t diff = 0;
+  if (__builtin_sub_overflow(a, b, &diff)) {
+    return a < 0 ? INT32_MIN : INT32_MAX; // 桁あふれは a と b が異符号のときだけ
+  }
+  return diff;
+#else
+  const int32_t diff = (int32_t)((uint32_t)a - (uint32_t)b);
+  if ((a < 0) != (b < 0) && (a < 0) != (diff < 0)) {
+    return diff < 0 ? INT32_MAX : INT32_MIN;
+  }
+  return diff;
+#endif
+}
+
+// 16ビット飽和加算
+UTIL_INLINE int16_t AddSatW16(int16_t a, int16_t b) {
+  return SatW32ToW16((int32_t)a + (int32_t)b);
+}
+
+// 16ビット飽和減算
+UTIL_INLINE int16_t SubSatW16(int16_t a, int16_t b) {
+  return SatW32ToW16((int32_t)a - (int32_t)b);
+}
+
+// 32ビット正規化シフト量取得（0 なら 0）
+UTIL_INLINE int16_t NormW32(int32_t a) {
+  if (a == 0) {
+    return 0;
+  }
+  const int32_t magnitude = a < 0 ? ~a : a;
+  return (int16_t)(CountLeadingZeros32((uint32_t)magnitude) - 1);
+}
+
+// 32ビット符号なし正規化シフト量（0 なら 0）
+UTIL_INLINE int16_t NormU32(uint32_t a) {
+  return a == 0 ? 0 : (int16_t)CountLeadingZeros32(a);
+}
+
+// 16ビット正規化シフト量取得（0 なら 0）
+UTIL_INLINE int16_t NormW16(int16_t a) {
+  if (a == 0) {
+    return 0;
+  }
+  const int32_t a32 = a;
+  const int32_t magnitude = a < 0 ? ~a32 : a32;
+  return (int16_t)(CountLeadingZeros32((uint32_t)magnitude) - 17);
+}
+
+// ビット幅取得
+UTIL_INLINE int16_t GetSizeInBits(uint32_t n) {
+  return (int16_t)(32 - CountLeadingZeros32(n));
+}
+
+// 16ビット乗算累積
+UTIL_INLINE int32_t MulAccumW16(int16_t a, int16_t b, int32_t c) {
+  return a * b + c;
+}
+
+// 符号なし32÷16除算（0 除算なら最大値）
+UTIL_INLINE uint32_t DivU32U16(uint32_t num, uint16_t den) {
+  return den == 0 ? UINT32_MAX : (uint32_t)(num / den);
+}
+
+// 符号付き32÷16除算（0 除算なら最大値）
+UTIL_INLINE int32_t DivW32W16(int32_t num, int16_t den) {
+  return den == 0 ? INT32_MAX : (int32_t)(num / den);
+}
+
 int16_t MaxAbsValueW16C(const int16_t* vector, size_t length); // 16ビット最大絶対値
 #define MaxAbsValueW16 MaxAbsValueW16C // 最大絶対値関数エイリアス
-uint32_t DivU32U16(uint32_t num, uint16_t den); // 符号なし32÷16除算
-int32_t DivW32W16(int32_t num, int16_t den); // 符号付き32÷16除算
 int32_t SqrtFloor(int32_t value); // 平方根の床値
 int16_t ExtractFractionPart(uint32_t a, int zeros);
 int16_t LogOfEnergyInQ8(uint32_t energy, int q_domain);
@@ -71,9 +205,17 @@ size_t WriteBuffer(RingBuffer* handle, const void* data, size_t element_count);
 int MoveReadPtr(RingBuffer* handle, int element_count); // 読み位置移動
 size_t available_read(const RingBuffer* handle); // 読み可能要素数取得
 size_t available_write(const RingBuffer* handle); // 書き可能要素数取得
+// 読み出し・書き込み可能な領域を最大 2 つの連続領域で返す（コピーなしの読み書き用）
+size_t GetBufferReadRegions(RingBuffer* handle, size_t element_count,
+                            void** data_ptr_1, size_t* data_ptr_bytes_1,
+                            void** data_ptr_2, size_t* data_ptr_bytes_2);
+size_t GetBufferWriteRegions(RingBuffer* handle, size_t element_count,
+                             void** data_ptr_1, size_t* data_ptr_bytes_1,
+                             void** data_ptr_2, size_t* data_ptr_bytes_2);
+size_t MoveWritePtr(RingBuffer* handle, size_t element_count); // 書き込み位置移動（領域へ書いた分を確定）
 
-// 固定長 2^7 (=128) ポイント FFT を前提にした実数 FFT ルーチン
-enum { kRealFftOrder = 7 };
+// 2^(PART_LEN_SHIFT) ポイント（既定 128）の実数 FFT ルーチン（実装は kernels.cc）
+enum { kRealFftOrder = PART_LEN_SHIFT };
 
 int RealForwardFFT(const int16_t* real_data_in, int16_t* complex_data_out); // 実数入力の前方FFT
 int RealInverseFFT(const int16_t* complex_data_in, int16_t* real_data_out); // 実数出力の逆FFT
@@ -98,6 +240,69 @@ void WindowAndFFT(int16_t* fft,
 
 #ifdef __cplusplus
 }
+
+// 単一生産者・単一消費者 (SPSC) のロックフリーなリングバッファ。RingBuffer と違い、書き込み側と読み出し側を
+// 別々のスレッド（例: オーディオコールバックと処理スレッド）から同時に呼べる。
+//   - 容量は 2 のべき乗。位置は巻き戻さずに増やし続け、添字は下位ビットで求める（rw_wrap は不要）。
+//   - 書き込み位置・読み出し位置は atomic で、それぞれ別のキャッシュラインに置く。
+//     書き込み側は release で確定し、読み出し側は acquire で受け取る（逆向きも同様）。
+//   - 相手側の位置の最後に見た値を自分のラインに持ち、足りないときだけ読み直す。
+//   - 書き込み側の関数は生産者スレッドだけ、読み出し側の関数は消費者スレッドだけが呼ぶ。
+//     spsc_available_read / spsc_available_write はどのスレッドからでも呼べる（待ちなし）。
+typedef struct SpscRingBuffer {
+  alignas(AECM_CACHE_LINE) std::atomic<size_t> write_pos; // 書き込んだ要素数の累計（生産者が進める）
+  size_t cached_read_pos; // 生産者が最後に見た read_pos
+  alignas(AECM_CACHE_LINE) std::atomic<size_t> read_pos; // 読み出した要素数の累計（消費者が進める）
+  size_t cached_write_pos; // 消費者が最後に見た write_pos
+  alignas(AECM_CACHE_LINE) size_t element_count; // 要素総数（2 のべき乗）
+  size_t element_size; // 要素サイズ（バイト）
+  char* data; // 格納先バッファ先頭
+} SpscRingBuffer;
+
+// 外部メモリで初期化する。element_count が 2 のべき乗でなければ -1。両側のスレッドを止めて呼ぶ。
+int InitSpscBufferWith(SpscRingBuffer* handle, void* backing, size_t element_count, size_t element_size);
+size_t spsc_available_read(const SpscRingBuffer* handle); // 読み可能要素数
+size_t spsc_available_write(const SpscRingBuffer* handle); // 書き可能要素数
+// 生産者側: 書き込める領域を最大 2 つの連続領域で返し、書いた分を MoveSpscWritePtr で確定する。
+size_t GetSpscBufferWriteRegions(SpscRingBuffer* handle, size_t element_count,
+                                 void** data_ptr_1, size_t* data_ptr_bytes_1,
+                                 void** data_ptr_2, size_t* data_ptr_bytes_2);
+size_t MoveSpscWritePtr(SpscRingBuffer* handle, size_t element_count);
+size_t WriteSpscBuffer(SpscRingBuffer* handle, const void* data, size_t element_count);
+// 消費者側: 読み出せる領域を最大 2 つの連続領域で返し、使い終わった分を MoveSpscReadPtr で解放する。
+size_t GetSpscBufferReadRegions(SpscRingBuffer* handle, size_t element_count,
+                                void** data_ptr_1, size_t* data_ptr_bytes_1,
+                                void** data_ptr_2, size_t* data_ptr_bytes_2);
+size_t MoveSpscReadPtr(SpscRingBuffer* handle, size_t element_count);
+size_t ReadSpscBuffer(SpscRingBuffer* handle, void* data, size_t element_count);
+
+// constexpr でのテーブル生成用に sin(2π num / den) を求める。
+// 象限の対称性で [0, π/2) に畳み込んでからテイラー展開するので、
+// 0 や ±1 になる点は誤差なく求まる。
+constexpr double ConstexprSin2Pi(int num, int den) {
+  long long t = (4LL * num) % (4LL * den);
+  if (t < 0) {
+    t += 4LL * den;
+  }
+  const int quadrant = (int)(t / den);
+  const double a = 1.5707963267948966 * (double)(t % den) / (double)den;
+  double sin_a = 0.0;
+  double cos_a = 0.0;
+  double term_sin = a;
+  double term_cos = 1.0;
+  for (int n = 1; n < 32; n += 2) {
+    sin_a += term_sin;
+    cos_a += term_cos;
+    term_sin *= -a * a / ((n + 1) * (n + 2));
+    term_cos *= -a * a / (n * (n + 1));
+  }
+  switch (quadrant) {
+    case 0: return sin_a;
+    case 1: return cos_a;
+    case 2: return -sin_a;
+    default: return -cos_a;
+  }
+}
 #endif
 
 #endif  // UTIL_H_
@@ -1,6 +1,7 @@
 // Minimal C API wrapper for the fixed-point AECM implementation to compile with Emscripten.
 // - 16 kHz mono, 64-sample blocks
 // - Exposes create/destroy/reset, bypass toggles, process, delay accessor
+// - aecm_process_frames accepts any frame length (buffered by AecmStream)
 
 #include <cstdint>
 #include <cstdlib>
@@ -14,8 +15,12 @@
 
 #include "aecm.h"
 #include "aecm_defines.h"
+#include "aecm_stream.h"
 
-struct AecmHandle {};
+struct AecmHandle {
+  AecmStream stream;
+  int stream_frame_len = -1; // -1: not initialized yet (set on the first aecm_process_frames call)
+};
 
 extern "C" {
 
@@ -39,6 +44,7 @@ KEEPALIVE void aecm_reset(void* handle) {
     return;
   }
   InitAecm();
+  reinterpret_cast<AecmHandle*>(handle)->stream_frame_len = -1;
 }
 
 KEEPALIVE int aecm_process(void* handle, const int16_t* farend64, const int16_t* nearend64, int16_t* out64) {
@@ -48,6 +54,30 @@ KEEPALIVE int aecm_process(void* handle, const int16_t* farend64, const int16_t*
   return ProcessBlock(farend64, nearend64, out64);
 }
 
+// Arbitrary frame length (e.g. 128-sample AudioWorklet quanta). The output lags the input by
+// aecm_get_stream_latency() samples; the first call's length is taken as the nominal frame length.
+KEEPALIVE int aecm_process_frames(void* handle, const int16_t* farend, const int16_t* nearend, int16_t* out, int samples) {
+  if (!handle || !farend || !nearend || !out || samples < 0) {
+    return -1;
+  }
+  auto* h = reinterpret_cast<AecmHandle*>(handle);
+  if (h->stream_frame_len < 0) {
+    h->stream_frame_len = samples;
+    InitAecmStream(&h->stream, samples);
+  }
+  AecmStreamFar(&h->stream, farend, (size_t)samples);
+  AecmStreamNear(&h->stream, nearend, out, (size_t)samples);
+  return 0;
+}
+
+KEEPALIVE int aecm_get_stream_latency(void* handle) {
+  if (!handle) {
+    return 0;
+  }
+  auto* h = reinterpret_cast<AecmHandle*>(handle);
+  return h->stream_frame_len < 0 ? 0 : GetAecmStreamLatency(&h->stream);
+}
+
 KEEPALIVE void aecm_set_bypass_supmask(void* /*handle*/, int enable) {
   SetBypassSupMask(enable);
 }